@@ -1,5 +1,10 @@
 #include "glad/glad.h"
+#include "glDebug.h"
+#include "goldenImage.h"
+#include "frameRecorder.h"
+#include "perfHud.h"
 #include <GLFW/glfw3.h>
+#include <cstring>
 #include <iostream>
 
 const char *vertexShaderSource = R"glsl(
@@ -22,11 +27,29 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
   glViewport(0, 0, width, height);
 }
 
-int main() {
+int main(int argc, char **argv) {
+  const char *goldenPath = nullptr;
+  bool updateGolden = false;
+  const char *recordPath = nullptr;
+  bool showHud = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+      goldenPath = argv[++i];
+    else if (strcmp(argv[i], "--update") == 0)
+      updateGolden = true;
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+      recordPath = argv[++i];
+    else if (strcmp(argv[i], "--hud") == 0)
+      showHud = true;
+  }
+
   glfwInit();
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+  if (goldenPath)
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
   GLFWwindow *window =
       glfwCreateWindow(800, 600, "GL 2D Triangle", nullptr, nullptr);
@@ -42,6 +65,7 @@ int main() {
     std::cerr << "Failed to initialize GLAD\n";
     return -1;
   }
+  installDebugOutput((GLADloadproc)glfwGetProcAddress);
 
   float vertices[] = {-0.5f, -0.5f, 0.5f, -0.5f, 0.0f, 0.5f};
 
@@ -60,33 +84,77 @@ int main() {
   unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
   glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
   glCompileShader(vertexShader);
+  checkShaderCompile(vertexShader, "vertex");
 
   unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
   glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
   glCompileShader(fragmentShader);
+  checkShaderCompile(fragmentShader, "fragment");
 
   unsigned int shaderProgram = glCreateProgram();
   glAttachShader(shaderProgram, vertexShader);
   glAttachShader(shaderProgram, fragmentShader);
   glLinkProgram(shaderProgram);
+  checkProgramLink(shaderProgram);
 
   glDeleteShader(vertexShader);
   glDeleteShader(fragmentShader);
 
+  GoldenCapture golden;
+  if (goldenPath)
+    golden.begin(800, 600);
+
+  // --record out.y4m|out.yuv|out.png: frames are read back through a PBO ring
+  // and encoded off the render loop
+  FrameReadback readback;
+  FrameRecorder recorder;
+  if (recordPath) {
+    if (!recorder.open(recordPath))
+      return -1;
+    readback.start([&recorder](ReadbackFrame &f) { recorder.encode(f); });
+  }
+  long frame = 0;
+  PerfHud hud;
+  if (showHud && !goldenPath)
+    hud.init();
+
   while (!glfwWindowShouldClose(window)) {
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f); // dark gray
     glClear(GL_COLOR_BUFFER_BIT);
 
+    int scene = gpuTimers.begin("scene");
     glUseProgram(shaderProgram);
     glBindVertexArray(VAO);
     glDrawArrays(GL_TRIANGLES, 0, 3);
+    gpuTimers.end(scene);
+    if (goldenPath)
+      break;
+    if (recordPath) {
+      int width, height;
+      glfwGetFramebufferSize(window, &width, &height);
+      readback.capture(frame++, width, height);
+      readback.poll();
+    }
+    if (hud.program) {
+      int width, height;
+      glfwGetFramebufferSize(window, &width, &height);
+      hud.draw(width, height);
+    }
+    gpuTimers.nextFrame();
 
     glfwSwapBuffers(window);
     glfwPollEvents();
+    flushDebugOutput();
   }
 
+  int result = goldenPath ? golden.finish(goldenPath, updateGolden) : 0;
+  readback.stop();
+  recorder.close();
+  hud.destroy();
+  gpuTimers.destroy();
   glDeleteVertexArrays(1, &VAO);
   glDeleteBuffers(1, &VBO);
+  shutdownDebugOutput();
   glfwTerminate();
-  return 0;
+  return result;
 }
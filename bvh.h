@@ -0,0 +1,299 @@
+#pragma once
+// Bounding volume hierarchy over axis-aligned boxes, one per scene object.
+// Built top-down with the binned surface area heuristic (Wald, "On fast
+// Construction of SAH-based Bounding Volume Hierarchies", 2007) and stored
+// depth-first in one array of 32-byte nodes: a left child follows its
+// parent, so only the right child's index is kept. Moving boxes are refit
+// bottom-up without touching the topology. Queries only read the tree and
+// keep their stack locally, so any number of threads can run them at once.
+#include "frustum.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+const int BVH_BINS = 16;
+const int BVH_MAX_LEAF = 4;    // items a leaf may hold when no split pays
+const int BVH_MAX_DEPTH = 64;  // query stack size
+const int BVH_MEDIAN_DEPTH = 32; // below this, splits halve the items
+
+struct BvhNode {
+  glm::vec3 lo;
+  int first; // leaf: first entry in items; interior: right child
+  glm::vec3 hi;
+  int count; // items in a leaf, 0 for an interior node
+};
+
+// World bounds of a transformed box, as in Arvo, "Transforming Axis-Aligned
+// Bounding Boxes", Graphics Gems, 1990.
+inline void transformBox(const glm::mat4 &m, glm::vec3 lo, glm::vec3 hi,
+                         glm::vec3 &outLo, glm::vec3 &outHi) {
+  outLo = outHi = glm::vec3(m[3]);
+  for (int c = 0; c < 3; c++)
+    for (int r = 0; r < 3; r++) {
+      float a = m[c][r] * lo[c], b = m[c][r] * hi[c];
+      outLo[r] += std::min(a, b);
+      outHi[r] += std::max(a, b);
+    }
+}
+
+inline float boxHalfArea(glm::vec3 lo, glm::vec3 hi) {
+  glm::vec3 d = glm::max(hi - lo, glm::vec3(0.0f));
+  return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// Distance along the ray at which it enters the box, or FLT_MAX when it
+// misses it within [0, tMax]. invDir is 1 / direction.
+inline float rayBoxDistance(glm::vec3 origin, glm::vec3 invDir, glm::vec3 lo,
+                            glm::vec3 hi, float tMax) {
+  glm::vec3 t0 = (lo - origin) * invDir, t1 = (hi - origin) * invDir;
+  glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+  float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+  float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+  return enter <= exit ? enter : FLT_MAX;
+}
+
+struct Bvh {
+  std::vector<BvhNode> nodes;
+  std::vector<int> items; // box indices in leaf order
+
+  void build(const glm::vec3 *lo, const glm::vec3 *hi, int count) {
+    nodes.clear();
+    items.resize(count);
+    for (int i = 0; i < count; i++)
+      items[i] = i;
+    if (!count)
+      return;
+    nodes.reserve(2 * count);
+    std::vector<glm::vec3> centers(count);
+    for (int i = 0; i < count; i++)
+      centers[i] = (lo[i] + hi[i]) * 0.5f;
+    split(lo, hi, centers.data(), 0, count, 0);
+  }
+
+  // Appends the node over items [first, first + count) and its subtree.
+  void split(const glm::vec3 *lo, const glm::vec3 *hi,
+             const glm::vec3 *centers, int first, int count, int depth) {
+    int index = (int)nodes.size();
+    nodes.push_back({});
+    glm::vec3 boxLo(FLT_MAX), boxHi(-FLT_MAX);
+    glm::vec3 centerLo(FLT_MAX), centerHi(-FLT_MAX);
+    for (int i = first; i < first + count; i++) {
+      int item = items[i];
+      boxLo = glm::min(boxLo, lo[item]);
+      boxHi = glm::max(boxHi, hi[item]);
+      centerLo = glm::min(centerLo, centers[item]);
+      centerHi = glm::max(centerHi, centers[item]);
+    }
+    nodes[index].lo = boxLo;
+    nodes[index].hi = boxHi;
+
+    // Costs are in box tests, relative to the node's area: a leaf costs
+    // count, a split 1 plus each side's count weighted by its area.
+    float area = boxHalfArea(boxLo, boxHi);
+    float bestCost = (float)count;
+    int bestAxis = -1, bestBin = 0;
+    auto binOf = [&](int item, int axis) {
+      float extent = centerHi[axis] - centerLo[axis];
+      int b = (int)((centers[item][axis] - centerLo[axis]) / extent *
+                    BVH_BINS);
+      return std::min(b, BVH_BINS - 1);
+    };
+    for (int axis = 0; count > 1 && area > 0 && depth < BVH_MEDIAN_DEPTH &&
+                       axis < 3;
+         axis++) {
+      if (centerHi[axis] <= centerLo[axis])
+        continue;
+      glm::vec3 binLo[BVH_BINS], binHi[BVH_BINS];
+      int binCount[BVH_BINS] = {};
+      for (int b = 0; b < BVH_BINS; b++) {
+        binLo[b] = glm::vec3(FLT_MAX);
+        binHi[b] = glm::vec3(-FLT_MAX);
+      }
+      for (int i = first; i < first + count; i++) {
+        int item = items[i], b = binOf(item, axis);
+        binLo[b] = glm::min(binLo[b], lo[item]);
+        binHi[b] = glm::max(binHi[b], hi[item]);
+        binCount[b]++;
+      }
+      // Right sides [b, BVH_BINS) swept from the right, then left sides.
+      float rightCost[BVH_BINS];
+      glm::vec3 sideLo(FLT_MAX), sideHi(-FLT_MAX);
+      int side = 0;
+      for (int b = BVH_BINS - 1; b > 0; b--) {
+        sideLo = glm::min(sideLo, binLo[b]);
+        sideHi = glm::max(sideHi, binHi[b]);
+        side += binCount[b];
+        rightCost[b] = side ? boxHalfArea(sideLo, sideHi) * side : -1.0f;
+      }
+      sideLo = glm::vec3(FLT_MAX);
+      sideHi = glm::vec3(-FLT_MAX);
+      side = 0;
+      for (int b = 0; b + 1 < BVH_BINS; b++) {
+        sideLo = glm::min(sideLo, binLo[b]);
+        sideHi = glm::max(sideHi, binHi[b]);
+        side += binCount[b];
+        if (!side || rightCost[b + 1] < 0)
+          continue;
+        float cost = 1.0f +
+                     (boxHalfArea(sideLo, sideHi) * side + rightCost[b + 1]) /
+                         area;
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          bestBin = b;
+        }
+      }
+    }
+
+    int *begin = items.data() + first, *end = begin + count;
+    int half;
+    if (bestAxis >= 0) {
+      half = (int)(std::partition(begin, end,
+                                  [&](int item) {
+                                    return binOf(item, bestAxis) <= bestBin;
+                                  }) -
+                   begin);
+    } else if (count > BVH_MAX_LEAF) {
+      // No split pays, or the tree is deep: halve along the widest spread.
+      glm::vec3 spread = centerHi - centerLo;
+      int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2)
+                                     : (spread.y > spread.z ? 1 : 2);
+      half = count / 2;
+      std::nth_element(begin, begin + half, end, [&](int a, int b) {
+        return centers[a][axis] < centers[b][axis];
+      });
+    } else {
+      nodes[index].first = first;
+      nodes[index].count = count;
+      return;
+    }
+    split(lo, hi, centers, first, half, depth + 1);
+    nodes[index].first = (int)nodes.size();
+    split(lo, hi, centers, first + half, count - half, depth + 1);
+  }
+
+  // New bounds for the same boxes. Children come after their parent, so one
+  // backward pass sees every child before it.
+  void refit(const glm::vec3 *lo, const glm::vec3 *hi) {
+    for (int n = (int)nodes.size() - 1; n >= 0; n--) {
+      BvhNode &node = nodes[n];
+      if (node.count) {
+        node.lo = glm::vec3(FLT_MAX);
+        node.hi = glm::vec3(-FLT_MAX);
+        for (int i = node.first; i < node.first + node.count; i++) {
+          node.lo = glm::min(node.lo, lo[items[i]]);
+          node.hi = glm::max(node.hi, hi[items[i]]);
+        }
+      } else {
+        const BvhNode &left = nodes[n + 1], &right = nodes[node.first];
+        node.lo = glm::min(left.lo, right.lo);
+        node.hi = glm::max(left.hi, right.hi);
+      }
+    }
+  }
+
+  // Calls visit(item) for every box at least partly inside the frustum; lo
+  // and hi are the boxes the tree was built or last refit with. Planes a
+  // node lies wholly inside are not tested again below it.
+  template <class Visit>
+  void cull(const Frustum &frustum, const glm::vec3 *lo, const glm::vec3 *hi,
+            Visit &&visit) const {
+    // Clears the planes the box is wholly inside; false if outside one.
+    auto inside = [&](glm::vec3 boxLo, glm::vec3 boxHi, unsigned &mask) {
+      for (int p = 0; p < 6; p++) {
+        if (!(mask & (1u << p)))
+          continue;
+        const glm::vec4 &plane = frustum.planes[p];
+        glm::vec3 normal(plane);
+        glm::vec3 far(plane.x > 0 ? boxHi.x : boxLo.x,
+                      plane.y > 0 ? boxHi.y : boxLo.y,
+                      plane.z > 0 ? boxHi.z : boxLo.z);
+        glm::vec3 near(plane.x > 0 ? boxLo.x : boxHi.x,
+                       plane.y > 0 ? boxLo.y : boxHi.y,
+                       plane.z > 0 ? boxLo.z : boxHi.z);
+        if (glm::dot(normal, far) + plane.w < 0)
+          return false;
+        if (glm::dot(normal, near) + plane.w >= 0)
+          mask &= ~(1u << p);
+      }
+      return true;
+    };
+    if (nodes.empty())
+      return;
+    int stack[BVH_MAX_DEPTH];
+    unsigned masks[BVH_MAX_DEPTH];
+    int top = 0;
+    stack[top] = 0;
+    masks[top++] = 0x3f;
+    while (top) {
+      top--;
+      int n = stack[top];
+      unsigned mask = masks[top];
+      const BvhNode &node = nodes[n];
+      if (!inside(node.lo, node.hi, mask))
+        continue;
+      if (node.count) {
+        for (int i = node.first; i < node.first + node.count; i++) {
+          unsigned itemMask = mask;
+          if (!mask || inside(lo[items[i]], hi[items[i]], itemMask))
+            visit(items[i]);
+        }
+        continue;
+      }
+      stack[top] = node.first;
+      masks[top++] = mask;
+      stack[top] = n + 1;
+      masks[top++] = mask;
+    }
+  }
+
+  // Nearest hit along origin + t * dir with t in [0, tMax]. hit(item, tMax)
+  // returns the item's hit distance, or FLT_MAX for a miss. Nodes are
+  // entered nearest first and skipped once they start behind the best hit.
+  // Returns the item hit, or -1; tMax becomes its distance.
+  template <class Hit>
+  int raycast(glm::vec3 origin, glm::vec3 dir, float &tMax, Hit &&hit) const {
+    if (nodes.empty())
+      return -1;
+    glm::vec3 invDir = glm::vec3(1.0f) / dir;
+    int stack[BVH_MAX_DEPTH];
+    float enters[BVH_MAX_DEPTH];
+    int top = 0, best = -1;
+    float enter = rayBoxDistance(origin, invDir, nodes[0].lo, nodes[0].hi,
+                                 tMax);
+    if (enter == FLT_MAX)
+      return -1;
+    stack[top] = 0;
+    enters[top++] = enter;
+    while (top) {
+      top--;
+      if (enters[top] > tMax)
+        continue;
+      int n = stack[top];
+      const BvhNode &node = nodes[n];
+      if (node.count) {
+        for (int i = node.first; i < node.first + node.count; i++) {
+          float t = hit(items[i], tMax);
+          if (t < tMax) {
+            tMax = t;
+            best = items[i];
+          }
+        }
+        continue;
+      }
+      int children[2] = {n + 1, node.first};
+      float t[2];
+      for (int c = 0; c < 2; c++)
+        t[c] = rayBoxDistance(origin, invDir, nodes[children[c]].lo,
+                              nodes[children[c]].hi, tMax);
+      int nearer = t[1] < t[0]; // pushed last, so popped first
+      for (int c : {1 - nearer, nearer})
+        if (t[c] != FLT_MAX) {
+          stack[top] = children[c];
+          enters[top++] = t[c];
+        }
+    }
+    return best;
+  }
+};
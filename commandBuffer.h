@@ -0,0 +1,199 @@
+#pragma once
+// Deferred draw recording. Worker threads each fill their own CommandBuffer
+// (a linear arena of packed commands, no locking); the GL thread merges the
+// buffers into one list ordered by sort key and replays it. The packed format
+// holds plain integers only, so recording never touches GL.
+#include "glad/glad.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+enum CommandType : uint16_t {
+  CMD_BIND_PROGRAM = 1,
+  CMD_BIND_VERTEX_ARRAY,
+  CMD_UNIFORM_MAT4,
+  CMD_UNIFORM_BLOCK_RANGE,
+  CMD_DRAW_INDEXED,
+};
+
+struct CommandHeader {
+  uint16_t type;
+  uint16_t size; // payload bytes following the header
+};
+
+struct CmdUniformMat4 {
+  int32_t location;
+  float value[16];
+};
+
+struct CmdUniformBlockRange {
+  uint32_t binding, buffer, offset, size;
+};
+
+struct CmdDrawIndexed {
+  uint32_t indexCount, firstIndex;
+  int32_t baseVertex;
+  uint32_t indexType;
+};
+
+// GL's layout for glMultiDrawElementsIndirect.
+struct DrawElementsIndirectCommand {
+  uint32_t count, instanceCount, firstIndex;
+  int32_t baseVertex;
+  uint32_t baseInstance;
+};
+
+inline uint32_t indexTypeSize(uint32_t indexType) {
+  return indexType == GL_UNSIGNED_INT ? 4 : indexType == GL_UNSIGNED_SHORT ? 2
+                                                                           : 1;
+}
+
+// Program in the top bits so replay sees few program switches, then vertex
+// array, then caller-defined order (e.g. quantized depth).
+inline uint64_t drawSortKey(uint32_t program, uint32_t vao, uint32_t order) {
+  return ((uint64_t)(program & 0xffff) << 48) |
+         ((uint64_t)(vao & 0xffff) << 32) | order;
+}
+
+struct CommandPacket {
+  uint64_t key;
+  uint32_t offset, size;
+};
+
+struct CommandBuffer {
+  std::vector<unsigned char> arena; // keeps its capacity across frames
+  size_t used = 0;
+  std::vector<CommandPacket> packets;
+  size_t packetStart = 0;
+  uint64_t packetKey = 0;
+
+  void reset() {
+    used = 0;
+    packets.clear();
+  }
+
+  void *alloc(size_t size) {
+    size = (size + 3) & ~(size_t)3;
+    if (used + size > arena.size())
+      arena.resize(std::max(arena.size() * 2, used + size + 4096));
+    void *p = arena.data() + used;
+    used += size;
+    return p;
+  }
+
+  void push(CommandType type, const void *payload, uint16_t size) {
+    CommandHeader header{type, size};
+    memcpy(alloc(sizeof(header)), &header, sizeof(header));
+    if (size)
+      memcpy(alloc(size), payload, size);
+  }
+
+  // Commands between begin/end replay together, ordered by key.
+  void begin(uint64_t key) {
+    packetKey = key;
+    packetStart = used;
+  }
+  void end() {
+    packets.push_back(
+        {packetKey, (uint32_t)packetStart, (uint32_t)(used - packetStart)});
+  }
+
+  void bindProgram(uint32_t program) {
+    push(CMD_BIND_PROGRAM, &program, sizeof(program));
+  }
+  void bindVertexArray(uint32_t vao) {
+    push(CMD_BIND_VERTEX_ARRAY, &vao, sizeof(vao));
+  }
+  void uniformMat4(int32_t location, const float *value) {
+    CmdUniformMat4 cmd;
+    cmd.location = location;
+    memcpy(cmd.value, value, sizeof(cmd.value));
+    push(CMD_UNIFORM_MAT4, &cmd, sizeof(cmd));
+  }
+  void uniformBlockRange(uint32_t binding, uint32_t buffer, uint32_t offset,
+                         uint32_t size) {
+    CmdUniformBlockRange cmd{binding, buffer, offset, size};
+    push(CMD_UNIFORM_BLOCK_RANGE, &cmd, sizeof(cmd));
+  }
+  void drawIndexed(uint32_t indexCount, uint32_t firstIndex = 0,
+                   int32_t baseVertex = 0,
+                   uint32_t indexType = GL_UNSIGNED_INT) {
+    CmdDrawIndexed cmd{indexCount, firstIndex, baseVertex, indexType};
+    push(CMD_DRAW_INDEXED, &cmd, sizeof(cmd));
+  }
+};
+
+struct MergedPacket {
+  uint64_t key;
+  const unsigned char *data;
+  uint32_t size;
+};
+
+// Stable merge keeps each thread's recording order for equal keys.
+inline void mergeCommandBuffers(const std::vector<CommandBuffer> &buffers,
+                                std::vector<MergedPacket> &out) {
+  out.clear();
+  for (const CommandBuffer &b : buffers)
+    for (const CommandPacket &p : b.packets)
+      out.push_back({p.key, b.arena.data() + p.offset, p.size});
+  std::stable_sort(out.begin(), out.end(),
+                   [](const MergedPacket &a, const MergedPacket &b) {
+                     return a.key < b.key;
+                   });
+}
+
+// GL thread only. Redundant program/vertex array binds are skipped.
+inline void replayCommands(const std::vector<MergedPacket> &packets) {
+  uint32_t program = ~0u, vao = ~0u;
+  for (const MergedPacket &packet : packets) {
+    const unsigned char *p = packet.data, *end = p + packet.size;
+    while (p < end) {
+      CommandHeader header;
+      memcpy(&header, p, sizeof(header));
+      const unsigned char *payload = p + sizeof(header);
+      p = payload + ((header.size + 3) & ~3u);
+      switch (header.type) {
+      case CMD_BIND_PROGRAM: {
+        uint32_t v;
+        memcpy(&v, payload, sizeof(v));
+        if (v != program)
+          glUseProgram(program = v);
+        break;
+      }
+      case CMD_BIND_VERTEX_ARRAY: {
+        uint32_t v;
+        memcpy(&v, payload, sizeof(v));
+        if (v != vao)
+          glBindVertexArray(vao = v);
+        break;
+      }
+      case CMD_UNIFORM_MAT4: {
+        CmdUniformMat4 cmd;
+        memcpy(&cmd, payload, sizeof(cmd));
+        glUniformMatrix4fv(cmd.location, 1, GL_FALSE, cmd.value);
+        break;
+      }
+      case CMD_UNIFORM_BLOCK_RANGE: {
+        CmdUniformBlockRange cmd;
+        memcpy(&cmd, payload, sizeof(cmd));
+        glBindBufferRange(GL_UNIFORM_BUFFER, cmd.binding, cmd.buffer,
+                          cmd.offset, cmd.size);
+        break;
+      }
+      case CMD_DRAW_INDEXED: {
+        CmdDrawIndexed cmd;
+        memcpy(&cmd, payload, sizeof(cmd));
+        const void *offset = (const void *)(uintptr_t)(
+            cmd.firstIndex * indexTypeSize(cmd.indexType));
+        if (cmd.baseVertex)
+          glDrawElementsBaseVertex(GL_TRIANGLES, cmd.indexCount, cmd.indexType,
+                                   offset, cmd.baseVertex);
+        else
+          glDrawElements(GL_TRIANGLES, cmd.indexCount, cmd.indexType, offset);
+        break;
+      }
+      }
+    }
+  }
+}
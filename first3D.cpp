@@ -1,8 +1,33 @@
 #include "glad/glad.h"
+#include "glDebug.h"
+#include "glTrace.h"
+#include "fixedTimestep.h"
+#include "renderThread.h"
+#include "workerPool.h"
+#include "softRaster.h"
+#include "goldenImage.h"
+#include "frameRecorder.h"
+#include "perfHud.h"
+#include "profiler.h"
+#include "objLoader.h"
+#include "glbLoader.h"
+#include "meshCache.h"
+#include "overdrawMeter.h"
+#include "meshlets.h"
+#include "occlusion.h"
+#include "gpuCulling.h"
+#include "bvh.h"
+#include "picking.h"
+#include "gpuResources.h"
+#include "geometryPool.h"
+#include "frameArena.h"
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 
 float lastX = 400, lastY = 300, yaw = -90.0f, pitch = 0.0f;
 float fov = 45.0f;
@@ -10,10 +35,23 @@ glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, 6.0f);
 glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
 glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 bool firstMouse = true;
-float deltaTime = 0.0f, lastFrame = 0.0f;
+float deltaTime = 0.0f;
+int framebufferWidth = 800, framebufferHeight = 600;
+bool screenshotRequested = false;
+bool hudVisible = false;
+bool pickRequested = false;
+float pickX, pickY; // cursor in normalized device coordinates
 
+// Per-frame lists come from the frame arenas. Every operator new is counted,
+// and frames after the warm-up should not call it at all.
+COUNT_HEAP_ALLOCATIONS
+const long ARENA_WARMUP_FRAMES = 60;
+FrameArenas frameArenas;
+
+// The viewport is applied by whichever thread owns the context.
 void framebuffer_size_callback(GLFWwindow *, int width, int height) {
-  glViewport(0, 0, width, height);
+  framebufferWidth = width;
+  framebufferHeight = height;
 }
 void mouse_callback(GLFWwindow *, double xpos, double ypos) {
   if (firstMouse) {
@@ -35,10 +73,27 @@ void mouse_callback(GLFWwindow *, double xpos, double ypos) {
   dir.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
   cameraFront = glm::normalize(dir);
 }
+void mouse_button_callback(GLFWwindow *window, int button, int action, int) {
+  if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS)
+    return;
+  double x, y;
+  int width, height;
+  glfwGetCursorPos(window, &x, &y);
+  glfwGetWindowSize(window, &width, &height);
+  pickX = (float)(2.0 * x / width - 1.0);
+  pickY = (float)(1.0 - 2.0 * y / height);
+  pickRequested = true;
+}
 void scroll_callback(GLFWwindow *, double, double yoffset) {
   fov -= yoffset;
   fov = glm::clamp(fov, 1.0f, 45.0f);
 }
+void key_callback(GLFWwindow *, int key, int, int action, int) {
+  if (key == GLFW_KEY_P && action == GLFW_PRESS)
+    screenshotRequested = true;
+  if (key == GLFW_KEY_H && action == GLFW_PRESS)
+    hudVisible = !hudVisible;
+}
 void processInput(GLFWwindow *window) {
   float speed = 2.5f * deltaTime;
   if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
@@ -55,13 +110,14 @@ const char *vertexShaderSrc = R"(
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
+layout (location = 2) in vec4 aNormal; // w is 0 unless a normal array is bound
 out vec3 vertexColor;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 void main() {
     gl_Position = projection * view * model * vec4(aPos, 1.0);
-    vertexColor = aColor;
+    vertexColor = mix(aColor, aNormal.xyz * 0.5 + 0.5, aNormal.w);
 })";
 
 const char *fragmentShaderSrc = R"(
@@ -76,6 +132,7 @@ unsigned int compileShader(unsigned int type, const char *src) {
   unsigned int id = glCreateShader(type);
   glShaderSource(id, 1, &src, nullptr);
   glCompileShader(id);
+  checkShaderCompile(id, type == GL_VERTEX_SHADER ? "vertex" : "fragment");
   return id;
 }
 unsigned int createShaderProgram() {
@@ -85,121 +142,891 @@ unsigned int createShaderProgram() {
   glAttachShader(program, vs);
   glAttachShader(program, fs);
   glLinkProgram(program);
+  checkProgramLink(program);
   glDeleteShader(vs);
   glDeleteShader(fs);
   return program;
 }
 
-int main() {
+float cubeVertices[] = {-0.5, -0.5, -0.5, 1, 0, 0, 0.5,  -0.5, -0.5, 0, 1, 0,
+                        0.5,  0.5,  -0.5, 0, 0, 1, -0.5, 0.5,  -0.5, 1, 1, 0,
+                        -0.5, -0.5, 0.5,  1, 0, 1, 0.5,  -0.5, 0.5,  0, 1, 1,
+                        0.5,  0.5,  0.5,  1, 1, 1, -0.5, 0.5,  0.5,  0, 0, 0};
+unsigned int cubeIndices[] = {0, 1, 2, 2, 3, 0, 4, 5, 6, 6, 7, 4,
+                              0, 1, 5, 5, 4, 0, 2, 3, 7, 7, 6, 2,
+                              0, 3, 7, 7, 4, 0, 1, 2, 6, 6, 5, 1};
+
+float prismVertices[] = {
+    0.0f,  0.5f,  0.5f,  1.0f, 0.0f, 0.0f, // A (front top)
+    -0.5f, -0.5f, 0.5f,  0.0f, 1.0f, 0.0f, // B (front left)
+    0.5f,  -0.5f, 0.5f,  0.0f, 0.0f, 1.0f, // C (front right)
+    0.0f,  0.5f,  -0.5f, 1.0f, 1.0f, 0.0f, // A'
+    -0.5f, -0.5f, -0.5f, 0.0f, 1.0f, 1.0f, // B'
+    0.5f,  -0.5f, -0.5f, 1.0f, 0.0f, 1.0f  // C'
+};
+unsigned int prismIndices[] = {0, 1, 2, 3, 5, 4, 0, 3, 1, 1, 3, 4,
+                               0, 2, 3, 2, 5, 3, 1, 4, 2, 2, 4, 5};
+
+struct SceneObject {
+  unsigned int vao = 0;
+  int indexCount = 0;
+  glm::vec3 position = glm::vec3(0.0f), spinAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+  const float *vertices = nullptr; // position + color, 6 floats per vertex
+  int vertexCount = 0;
+  const unsigned int *indices = nullptr;
+  unsigned int indexType = GL_UNSIGNED_INT;
+  unsigned int firstIndex = 0;
+  glm::mat4 transform = glm::mat4(1.0f); // applied before the spin
+  const MeshLod *lods = nullptr; // ranges from firstIndex, finest first
+  int lodCount = 0;
+  float extent = 0.0f; // largest side in world units
+  const Meshlet *meshlets = nullptr; // sorted, ranges from firstIndex
+  int meshletCount = 0;
+  glm::mat4 meshletSpace = glm::mat4(1.0f); // meshlet bounds to vertices
+  glm::vec3 lo = glm::vec3(0.0f), hi = glm::vec3(0.0f); // vertex space
+  OccluderMesh occluder; // drawn into the occlusion buffer when large
+  // Built-in and OBJ objects live in the shared geometry pages.
+  GeometryAllocation geometry;
+  int baseVertex = 0;
+};
+
+glm::mat4 objectModel(const SceneObject &object, float time) {
+  glm::mat4 model = glm::mat4(1.0f);
+  model = glm::translate(model, object.position);
+  return glm::rotate(model, time, object.spinAxis) * object.transform;
+}
+
+// Centers a bounding box on the origin and scales its largest side to 2.
+glm::mat4 fitTransform(glm::vec3 lo, glm::vec3 hi) {
+  glm::vec3 extent = hi - lo;
+  float scale = 2.0f / std::max({extent.x, extent.y, extent.z, 1e-6f});
+  return glm::translate(glm::scale(glm::mat4(1.0f), glm::vec3(scale)),
+                        (lo + hi) * -0.5f);
+}
+
+// Uploads an object's vertices and indices into a new VAO.
+// GL objects made here are owned by resources and freed through it.
+GpuResources resources;
+GeometryPool geometry;
+void uploadObjectGeometry(SceneObject &object) {
+  geometry.resources = &resources;
+  object.geometry = geometry.allocate(object.vertices, object.vertexCount,
+                                      object.indices, object.indexCount);
+  object.vao = geometry.pages[object.geometry.page].vao;
+  object.firstIndex = object.geometry.indices.offset;
+  object.baseVertex = (int)object.geometry.vertices.offset;
+}
+
+void destroySceneResources(std::vector<SceneObject> &objects,
+                           ProgramHandle &program) {
+  for (SceneObject &object : objects)
+    geometry.free(object.geometry);
+  geometry.destroy();
+  resources.destroy(program);
+}
+
+struct SceneUniforms {
+  int model, view, projection;
+};
+SceneUniforms uniforms;
+int viewportWidth = 0, viewportHeight = 0;
+FrameReadback readback;
+PerfHud perfHud;
+
+// With LODs, draws the coarsest level that stays within LOD_PIXEL_ERROR of
+// the full mesh as seen from eye.
+DrawCommand objectDraw(const SceneObject &object, float time, glm::vec3 eye,
+                       float pixelsPerUnit) {
+  DrawCommand draw = {object.vao, object.indexCount, objectModel(object, time),
+                      object.indexType, object.firstIndex};
+  draw.baseVertex = object.baseVertex;
+  if (object.lodCount) {
+    float distance = glm::length(object.position - eye) - object.extent * 0.5f;
+    const MeshLod &lod = object.lods[selectLod(
+        object.lods, object.lodCount, object.extent, distance, pixelsPerUnit)];
+    draw.indexCount = lod.indexCount;
+    draw.firstIndex += lod.firstIndex;
+  }
+  return draw;
+}
+
+// --occlusion: the objects that cover the most of the screen, within
+// OCCLUSION_MAX_TRIANGLES, are rasterized on the CPU before recording, and
+// every object's bounds are tested against the result.
+bool occlusionCulling = false;
+OcclusionBuffer occlusion;
+OcclusionStats occlusionStats;
+void drawOccluders(const std::vector<SceneObject> &objects,
+                   const ArenaVector<int> &visible, float time,
+                   glm::vec3 eye, const glm::mat4 &viewProjection) {
+  ArenaVector<std::pair<float, int>> order(frameArenas.local(0));
+  order.reserve(visible.size()); // angular size, object
+  for (int i : visible) {
+    const SceneObject &object = objects[i];
+    glm::mat4 model = objectModel(object, time);
+    if (!object.occluder.indexCount)
+      continue;
+    glm::vec3 center(model * glm::vec4((object.lo + object.hi) * 0.5f, 1.0f));
+    glm::vec3 halfSize(model * glm::vec4((object.hi - object.lo) * 0.5f, 0.0f));
+    order.push_back({glm::length(halfSize) /
+                         std::max(glm::length(center - eye), 1e-3f),
+                     i});
+  }
+  std::sort(order.begin(), order.end(), std::greater<>());
+  occlusion.clear();
+  for (const auto &entry : order) {
+    const SceneObject &object = objects[entry.second];
+    if (occlusion.triangles + object.occluder.indexCount / 3 <=
+        OCCLUSION_MAX_TRIANGLES)
+      occlusion.drawOccluder(object.occluder,
+                             viewProjection * objectModel(object, time));
+  }
+  occlusion.buildPyramid();
+}
+
+// For objects the BVH found in the frustum.
+bool objectVisible(const SceneObject &object, float time,
+                   const glm::mat4 &viewProjection, OcclusionStats &stats) {
+  glm::mat4 mvp = viewProjection * objectModel(object, time);
+  if (!occlusion.boxVisible(object.lo, object.hi, mvp)) {
+    stats.occluded++;
+    return false;
+  }
+  return true;
+}
+
+// World bounds of every object, kept in a BVH that is built on the first
+// frame and refit after that; objects only spin in place, so the topology
+// stays good. Frustum culling and picking both walk it.
+Bvh sceneBvh;
+std::vector<glm::vec3> worldLo, worldHi;
+void updateSceneBvh(const std::vector<SceneObject> &objects, float time) {
+  worldLo.resize(objects.size());
+  worldHi.resize(objects.size());
+  for (size_t i = 0; i < objects.size(); i++)
+    transformBox(objectModel(objects[i], time), objects[i].lo, objects[i].hi,
+                 worldLo[i], worldHi[i]);
+  if (sceneBvh.nodes.empty())
+    sceneBvh.build(worldLo.data(), worldHi.data(), (int)objects.size());
+  else
+    sceneBvh.refit(worldLo.data(), worldHi.data());
+}
+
+// The nearest object under the cursor, and the triangle hit when the
+// object's triangles are in client memory (built-in and OBJ scenes); other
+// objects are hit by their boxes. --gpu-pick reads the ID buffer instead.
+bool gpuPicking = false;
+IdBufferPicker idPicker;
+std::vector<TriangleBvh> objectTriangles; // built on an object's first pick
+PickHit pickObject(const std::vector<SceneObject> &objects, float time,
+                   const glm::mat4 &viewProjection) {
+  PickRay ray = unprojectCursor(pickX, pickY, viewProjection);
+  glm::vec3 invDir = glm::vec3(1.0f) / ray.dir;
+  objectTriangles.resize(objects.size());
+  PickHit hit;
+  hit.object = sceneBvh.raycast(
+      ray.origin, ray.dir, hit.distance, [&](int i, float tMax) {
+        const SceneObject &object = objects[i];
+        float t =
+            rayBoxDistance(ray.origin, invDir, worldLo[i], worldHi[i], tMax);
+        if (t == FLT_MAX)
+          return FLT_MAX;
+        if (!object.indices) {
+          hit.triangle = -1;
+          return t;
+        }
+        TriangleBvh &triangles = objectTriangles[i];
+        if (!triangles.built())
+          triangles.build(object.vertices, 6, object.indices,
+                          object.indexCount);
+        // Not renormalized, so distances stay in world units.
+        glm::mat4 toModel = glm::inverse(objectModel(object, time));
+        float distance = tMax;
+        int triangle = triangles.raycast(
+            glm::vec3(toModel * glm::vec4(ray.origin, 1.0f)),
+            glm::vec3(toModel * glm::vec4(ray.dir, 0.0f)), distance);
+        if (triangle < 0)
+          return FLT_MAX;
+        hit.triangle = triangle;
+        return distance;
+      });
+  return hit;
+}
+
+void reportPick(const PickHit &hit) {
+  if (hit.object < 0)
+    printf("Picked nothing\n");
+  else if (hit.triangle < 0)
+    printf("Picked object %d\n", hit.object);
+  else
+    printf("Picked object %d, triangle %d\n", hit.object, hit.triangle);
+}
+
+// --meshlets: swaps the draw's single range for those of its meshlets that
+// pass the frustum, normal cone and (with --occlusion) occlusion tests,
+// appended to indirect. --gpu-cull only picks the meshlet range of the
+// draw's level and leaves the tests to the compute pass.
+bool meshletCulling = false;
+bool gpuCulling = false;
+GpuMeshletCuller gpuCuller;
+MeshletCullStats meshletStats;
+template <class Indirect>
+void cullObjectMeshlets(const SceneObject &object, float time, glm::vec3 eye,
+                        const glm::mat4 &viewProjection, DrawCommand &draw,
+                        Indirect &indirect, MeshletCullStats &stats) {
+  auto byFirst = [](const Meshlet &m, uint32_t first) {
+    return m.firstIndex < first;
+  };
+  uint32_t first = draw.firstIndex - object.firstIndex;
+  const Meshlet *end = object.meshlets + object.meshletCount;
+  const Meshlet *begin = std::lower_bound(object.meshlets, end, first, byFirst);
+  end = std::lower_bound(begin, end, first + draw.indexCount, byFirst);
+  if (gpuCulling) {
+    draw.cullFirst = (int)(begin - object.meshlets);
+    draw.cullCount = (int)(end - begin);
+    return;
+  }
+  draw.indirectFirst = (int)indirect.size();
+  glm::mat4 model = objectModel(object, time) * object.meshletSpace;
+  cullMeshlets(begin, end - begin, model, viewProjection, eye,
+               object.firstIndex, indirect, stats,
+               occlusionCulling ? &occlusion : nullptr);
+  draw.indirectCount = (int)indirect.size() - draw.indirectFirst;
+}
+
+IndirectDrawer indirectDrawer;
+void drawObject(const DrawCommand &draw,
+                const FrameCommands *frame = nullptr) {
+  glUniformMatrix4fv(uniforms.model, 1, GL_FALSE, glm::value_ptr(draw.model));
+  glBindVertexArray(draw.vao);
+  if (draw.indirectFirst >= 0) {
+    indirectDrawer.draw(frame->indirect.data() + draw.indirectFirst,
+                        draw.indirectCount, draw.indexType);
+    return;
+  }
+  if (draw.cullFirst >= 0) {
+    glm::vec3 eye = glm::vec3(glm::inverse(frame->view)[3]);
+    gpuCuller.cull(draw.cullFirst, draw.cullCount, draw.model,
+                   frame->projection * frame->view, eye,
+                   !frame->pyramid.empty());
+    gpuCuller.draw(draw.cullCount, draw.indexType);
+    return;
+  }
+  glDrawElementsBaseVertex(GL_TRIANGLES, draw.indexCount, draw.indexType,
+                           (void *)(uintptr_t)(draw.firstIndex *
+                                               indexTypeSize(draw.indexType)),
+                           draw.baseVertex);
+}
+
+// Issues one frame's GL calls. Runs on the main thread, or on the render
+// thread with --render-thread.
+void executeFrame(const FrameCommands &frame) {
+  PROFILE_ZONE("execute frame");
+  if (frame.width != viewportWidth || frame.height != viewportHeight) {
+    viewportWidth = frame.width;
+    viewportHeight = frame.height;
+    glViewport(0, 0, viewportWidth, viewportHeight);
+  }
+  glClearColor(frame.clearColor.x, frame.clearColor.y, frame.clearColor.z,
+               frame.clearColor.w);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  int sceneScope = gpuTimers.begin("scene");
+  glUniformMatrix4fv(uniforms.view, 1, GL_FALSE, glm::value_ptr(frame.view));
+  glUniformMatrix4fv(uniforms.projection, 1, GL_FALSE,
+                     glm::value_ptr(frame.projection));
+  if (!frame.pyramid.empty())
+    gpuCuller.uploadPyramid(occlusion, frame.pyramid);
+  for (const DrawCommand &draw : frame.draws)
+    drawObject(draw, &frame);
+  replayCommands(frame.merged);
+  gpuTimers.end(sceneScope);
+  if (frame.pickX >= 0) {
+    idPicker.begin(frame.width, frame.height, frame.pickX, frame.pickY,
+                   frame.view, frame.projection);
+    for (const PickDraw &pick : frame.pickDraws)
+      idPicker.draw(pick.draw.vao, pick.draw.model, pick.object,
+                    pick.firstTriangle, pick.draw.indexType,
+                    pick.draw.firstIndex, pick.draw.indexCount,
+                    pick.draw.baseVertex);
+    idPicker.end();
+  }
+  PickHit hit;
+  if (idPicker.poll(hit))
+    reportPick(hit);
+  if (frame.capture)
+    readback.capture(frame.index, frame.width, frame.height, frame.capture);
+  readback.poll();
+  if (frame.hud) { // after the capture, so recordings stay clean
+    if (!perfHud.program)
+      perfHud.init();
+    perfHud.draw(frame.width, frame.height);
+  }
+  gpuTimers.nextFrame();
+  resources.endFrame(frame.index);
+  traceFrameEnd();
+  flushDebugOutput();
+}
+
+// Draws the scene at a fixed simulation time on the CPU rasterizer and writes
+// it as a PPM; needs no window or GL context.
+int renderSoftFrame(const SceneObject *objects, int objectCount, float time,
+                    const char *path) {
+  WorkerPool workers;
+  SoftRasterizer raster(&workers);
+  raster.resize(800, 600);
+  raster.framebuffer.clear(0.1f, 0.1f, 0.15f, 1.0f);
+  glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+  glm::mat4 projection =
+      glm::perspective(glm::radians(fov), 800.0f / 600.0f, 0.1f, 100.0f);
+  for (int i = 0; i < objectCount; i++) {
+    const SceneObject &object = objects[i];
+    glm::mat4 mvp = projection * view * objectModel(object, time);
+    raster.draw(object.vertices, object.vertexCount, {6, 3, 3},
+                object.indices, object.indexCount, glm::value_ptr(mvp));
+  }
+  raster.render();
+  if (!raster.framebuffer.writePPM(path)) {
+    fprintf(stderr, "Failed to write %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *tracePath = nullptr;
+  SimClock simClock;
+  long maxFrames = -1;
+  bool useRenderThread = false;
+  bool parallelRecord = false;
+  const char *softPath = nullptr;
+  float captureTime = 1.0f; // --soft / --golden simulation time
+  const char *goldenPath = nullptr;
+  bool updateGolden = false;
+  const char *recordPath = nullptr;
+  const char *profilePath = nullptr;
+  const char *objPath = nullptr;
+  const char *glbPath = nullptr;
+  const char *meshPath = nullptr;
+  bool overdraw = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      tracePath = argv[++i];
+    else if (strcmp(argv[i], "--fixed-clock") == 0 && i + 1 < argc)
+      simClock.seed(strtoull(argv[++i], nullptr, 10));
+    else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+      maxFrames = strtol(argv[++i], nullptr, 10);
+    else if (strcmp(argv[i], "--render-thread") == 0)
+      useRenderThread = true;
+    else if (strcmp(argv[i], "--parallel-record") == 0)
+      parallelRecord = true;
+    else if (strcmp(argv[i], "--soft") == 0 && i + 1 < argc)
+      softPath = argv[++i];
+    else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc)
+      captureTime = strtof(argv[++i], nullptr);
+    else if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+      goldenPath = argv[++i];
+    else if (strcmp(argv[i], "--update") == 0)
+      updateGolden = true;
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+      recordPath = argv[++i];
+    else if (strcmp(argv[i], "--hud") == 0)
+      hudVisible = true;
+    else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+      profilePath = argv[++i];
+    else if (strcmp(argv[i], "--obj") == 0 && i + 1 < argc)
+      objPath = argv[++i];
+    else if (strcmp(argv[i], "--glb") == 0 && i + 1 < argc)
+      glbPath = argv[++i];
+    else if (strcmp(argv[i], "--mesh") == 0 && i + 1 < argc)
+      meshPath = argv[++i];
+    else if (strcmp(argv[i], "--overdraw") == 0)
+      overdraw = true;
+    else if (strcmp(argv[i], "--meshlets") == 0)
+      meshletCulling = true;
+    else if (strcmp(argv[i], "--occlusion") == 0)
+      occlusionCulling = true;
+    else if (strcmp(argv[i], "--gpu-cull") == 0)
+      gpuCulling = true;
+    else if (strcmp(argv[i], "--gpu-pick") == 0)
+      gpuPicking = true;
+  }
+
+  SceneObject prism; // right side
+  prism.indexCount = 24;
+  prism.position = glm::vec3(1.0f, 0.0f, 0.0f);
+  prism.spinAxis = glm::vec3(0.2f, 1.0f, 0.0f);
+  prism.vertices = prismVertices;
+  prism.vertexCount = 6;
+  prism.indices = prismIndices;
+  SceneObject cube; // left side
+  cube.indexCount = 36;
+  cube.position = glm::vec3(-1.0f, 0.0f, 0.0f);
+  cube.spinAxis = glm::vec3(0.5f, 1.0f, 0.0f);
+  cube.vertices = cubeVertices;
+  cube.vertexCount = 8;
+  cube.indices = cubeIndices;
+  std::vector<SceneObject> objects = {prism, cube};
+  // An imported mesh replaces the built-in cube and prism.
+  Mesh mesh;
+  if (objPath) {
+    WorkerPool loaderPool;
+    if (!loadOBJ(objPath, mesh, loaderPool))
+      return -1;
+    mesh.fit(2.0f);
+    SceneObject object;
+    object.indexCount = (int)mesh.indices.size();
+    object.vertices = mesh.vertices.data();
+    object.vertexCount = (int)mesh.vertexCount();
+    object.indices = mesh.indices.data();
+    objects = {object};
+  }
+  if (softPath && (glbPath || meshPath)) {
+    fprintf(stderr, "--soft cannot draw --glb or --mesh scenes; they are "
+                    "uploaded straight to the GPU\n");
+    return -1;
+  }
+  if ((meshletCulling || gpuCulling) && !meshPath) {
+    fprintf(stderr, "--meshlets and --gpu-cull need a --mesh cache, which "
+                    "stores the meshlets\n");
+    return -1;
+  }
+  if (softPath)
+    return renderSoftFrame(objects.data(), (int)objects.size(), captureTime,
+                           softPath);
+
   glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  // --gpu-cull needs compute shaders and indirect draws from GL 4.3.
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, gpuCulling ? 4 : 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+  if (goldenPath || overdraw) {
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    useRenderThread = false;
+  }
   GLFWwindow *window =
       glfwCreateWindow(800, 600, "GL 3D Cube & Prism", NULL, NULL);
+  if (!window && gpuCulling) {
+    fprintf(stderr, "No GL 4.3 context; culling meshlets on the CPU\n");
+    gpuCulling = false;
+    meshletCulling = true;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    window = glfwCreateWindow(800, 600, "GL 3D Cube & Prism", NULL, NULL);
+  }
   glfwMakeContextCurrent(window);
+  glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
   glfwSetCursorPosCallback(window, mouse_callback);
+  glfwSetMouseButtonCallback(window, mouse_button_callback);
   glfwSetScrollCallback(window, scroll_callback);
+  glfwSetKeyCallback(window, key_callback);
   glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
   gladLoadGLLoader((GLADloadproc)glfwGetProcAddress);
+  if (tracePath)
+    startGLTrace(tracePath);
+  installDebugOutput((GLADloadproc)glfwGetProcAddress);
+  if (profilePath && startProfiler(profilePath)) {
+    profileThreadName("main");
+    startProfilerGpu();
+  }
   glEnable(GL_DEPTH_TEST);
 
-  float cubeVertices[] = {-0.5, -0.5, -0.5, 1, 0, 0, 0.5,  -0.5, -0.5, 0, 1, 0,
-                          0.5,  0.5,  -0.5, 0, 0, 1, -0.5, 0.5,  -0.5, 1, 1, 0,
-                          -0.5, -0.5, 0.5,  1, 0, 1, 0.5,  -0.5, 0.5,  0, 1, 1,
-                          0.5,  0.5,  0.5,  1, 1, 1, -0.5, 0.5,  0.5,  0, 0, 0};
-  unsigned int cubeIndices[] = {0, 1, 2, 2, 3, 0, 4, 5, 6, 6, 7, 4,
-                                0, 1, 5, 5, 4, 0, 2, 3, 7, 7, 6, 2,
-                                0, 3, 7, 7, 4, 0, 1, 2, 6, 6, 5, 1};
-
-  float prismVertices[] = {
-      0.0f,  0.5f,  0.5f,  1.0f, 0.0f, 0.0f, // A (front top)
-      -0.5f, -0.5f, 0.5f,  0.0f, 1.0f, 0.0f, // B (front left)
-      0.5f,  -0.5f, 0.5f,  0.0f, 0.0f, 1.0f, // C (front right)
-      0.0f,  0.5f,  -0.5f, 1.0f, 1.0f, 0.0f, // A'
-      -0.5f, -0.5f, -0.5f, 0.0f, 1.0f, 1.0f, // B'
-      0.5f,  -0.5f, -0.5f, 1.0f, 0.0f, 1.0f  // C'
-  };
-  unsigned int prismIndices[] = {0, 1, 2, 3, 5, 4, 0, 3, 1, 1, 3, 4,
-                                 0, 2, 3, 2, 5, 3, 1, 4, 2, 2, 4, 5};
-
-  unsigned int cubeVAO, cubeVBO, cubeEBO;
-  glGenVertexArrays(1, &cubeVAO);
-  glGenBuffers(1, &cubeVBO);
-  glGenBuffers(1, &cubeEBO);
-  glBindVertexArray(cubeVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices,
-               GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(cubeIndices), cubeIndices,
-               GL_STATIC_DRAW);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
-
-  unsigned int prismVAO, prismVBO, prismEBO;
-  glGenVertexArrays(1, &prismVAO);
-  glGenBuffers(1, &prismVBO);
-  glGenBuffers(1, &prismEBO);
-  glBindVertexArray(prismVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, prismVBO);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(prismVertices), prismVertices,
-               GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, prismEBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(prismIndices), prismIndices,
-               GL_STATIC_DRAW);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
-
-  unsigned int shader = createShaderProgram();
+  // A .glb scene is uploaded straight from the file and replaces the built-in
+  // objects, one per primitive, scaled to fit like an OBJ mesh.
+  GlbScene glb;
+  MeshCacheGpu meshCache;
+  if (glbPath) {
+    if (!loadGLB(glbPath, glb))
+      return -1;
+    glm::vec3 lo, hi;
+    glb.bounds(lo, hi);
+    glm::mat4 fit = fitTransform(lo, hi);
+    objects.clear();
+    for (const GlbPrimitive &prim : glb.primitives) {
+      SceneObject object;
+      object.vao = prim.vao;
+      object.indexCount = prim.indexCount;
+      object.indexType = prim.indexType;
+      object.firstIndex = prim.firstIndex;
+      object.transform = fit * prim.transform;
+      object.lo = prim.vertexLo;
+      object.hi = prim.vertexHi;
+      objects.push_back(object);
+    }
+  } else if (meshPath) {
+    if (!loadMeshCache(meshPath, meshCache))
+      return -1;
+    const MeshCacheHeader &h = meshCache.header;
+    glm::vec3 lo(h.boundsMin[0], h.boundsMin[1], h.boundsMin[2]);
+    glm::vec3 hi(h.boundsMax[0], h.boundsMax[1], h.boundsMax[2]);
+    SceneObject object;
+    object.vao = meshCache.vao;
+    object.indexCount = (int)h.lods[0].indexCount;
+    object.indexType = h.indexType;
+    object.firstIndex = meshCache.firstIndex;
+    object.transform = fitTransform(lo, hi) * meshCache.dequantize;
+    object.lods = h.lods;
+    object.lodCount = (int)h.lodCount;
+    object.extent = 2.0f;
+    object.meshlets = meshCache.meshlets.data();
+    object.meshletCount = (int)meshCache.meshlets.size();
+    object.meshletSpace = glm::inverse(meshCache.dequantize);
+    object.lo = glm::vec3(object.meshletSpace * glm::vec4(lo, 1.0f));
+    object.hi = glm::vec3(object.meshletSpace * glm::vec4(hi, 1.0f));
+    object.occluder = {meshCache.occluderPositions.data(), 3,
+                       (int)meshCache.occluderPositions.size() / 3,
+                       meshCache.occluderIndices.data(),
+                       (int)meshCache.occluderIndices.size()};
+    objects = {object};
+    if (gpuCulling &&
+        !gpuCuller.init(object.meshlets, object.meshletCount,
+                        object.firstIndex, object.meshletSpace)) {
+      fprintf(stderr, "Culling meshlets on the CPU instead\n");
+      gpuCulling = false;
+      meshletCulling = true;
+    }
+  } else {
+    for (SceneObject &object : objects) {
+      uploadObjectGeometry(object);
+      object.lo = glm::vec3(FLT_MAX);
+      object.hi = glm::vec3(-FLT_MAX);
+      for (int v = 0; v < object.vertexCount; v++) {
+        const float *vertex = object.vertices + v * 6;
+        glm::vec3 p(vertex[0], vertex[1], vertex[2]);
+        object.lo = glm::min(object.lo, p);
+        object.hi = glm::max(object.hi, p);
+      }
+      object.occluder = {object.vertices, 6, object.vertexCount,
+                         object.indices, object.indexCount};
+    }
+  }
+  const int objectCount = (int)objects.size();
+  // Current values for disabled arrays: grey when a mesh has no colors, and
+  // w = 0 so the normal is ignored unless a VAO supplies one.
+  glVertexAttrib3f(1, 0.8f, 0.8f, 0.8f);
+  glVertexAttrib4f(2, 0.0f, 0.0f, 0.0f, 0.0f);
+  // Dropping meshlets whose faces all point away only matches the full
+  // mesh when back faces are culled anyway.
+  if (meshletCulling || gpuCulling)
+    glEnable(GL_CULL_FACE);
+
+  ProgramHandle sceneProgram =
+      resources.add<RESOURCE_PROGRAM>(createShaderProgram(), "scene");
+  unsigned int shader = resources.name(sceneProgram);
   glUseProgram(shader);
+  uniforms.model = glGetUniformLocation(shader, "model");
+  uniforms.view = glGetUniformLocation(shader, "view");
+  uniforms.projection = glGetUniformLocation(shader, "projection");
+
+  // --overdraw: measure shaded fragments per covered pixel at the capture
+  // time and exit.
+  if (overdraw) {
+    OverdrawStats stats = measureOverdraw(
+        4.0f, [&](const glm::mat4 &view, const glm::mat4 &projection) {
+          glUniformMatrix4fv(uniforms.view, 1, GL_FALSE, glm::value_ptr(view));
+          glUniformMatrix4fv(uniforms.projection, 1, GL_FALSE,
+                             glm::value_ptr(projection));
+          for (const SceneObject &object : objects)
+            drawObject(objectDraw(object, captureTime, glm::vec3(0.0f),
+                                  FLT_MAX));
+        });
+    printf("Overdraw: %.3f shaded fragments per covered pixel (%ld pixels, "
+           "%d views)\n",
+           stats.ratio(), stats.covered, OVERDRAW_VIEWS);
+    glb.destroy();
+    meshCache.destroy();
+    destroySceneResources(objects, sceneProgram);
+    resources.shutdown();
+    stopProfiler();
+    stopGLTrace();
+    shutdownDebugOutput();
+    glfwTerminate();
+    return 0;
+  }
+
+  WorkerPool workers(parallelRecord ? -1 : 0);
+  // --parallel-record: each worker's counts, and its heap allocations in
+  // the frame being recorded
+  std::vector<MeshletCullStats> workerMeshletStats(workers.workerCount());
+  std::vector<OcclusionStats> workerOcclusionStats(workers.workerCount());
+  std::vector<uint64_t> workerAllocations(workers.workerCount());
+  frameArenas.init(workers.workerCount());
+  uint64_t steadyAllocations = 0;
+  long steadyFrames = 0;
 
-  while (!glfwWindowShouldClose(window)) {
-    float time = glfwGetTime();
-    deltaTime = time - lastFrame;
-    lastFrame = time;
+  GoldenCapture golden;
+  if (goldenPath) {
+    golden.begin(800, 600);
+    framebufferWidth = 800;
+    framebufferHeight = 600;
+  }
+
+  // P saves a screenshot and --record dumps every frame; the PBO ring reads
+  // them back a couple of frames later and the worker encodes and writes
+  // them, so the render loop never stalls.
+  FrameRecorder recorder;
+  if (recordPath && !recorder.open(recordPath))
+    return -1;
+  readback.start([&recorder](ReadbackFrame &shot) {
+    if (shot.tag & CAPTURE_RECORD)
+      recorder.encode(shot);
+    if (!(shot.tag & CAPTURE_SCREENSHOT))
+      return;
+    Image image;
+    image.width = shot.width;
+    image.height = shot.height;
+    image.rgb.resize((size_t)shot.width * shot.height * 3);
+    for (int y = 0; y < shot.height; y++) {
+      const unsigned char *src =
+          &shot.rgba[(size_t)(shot.height - 1 - y) * shot.width * 4];
+      unsigned char *dst = &image.rgb[(size_t)y * shot.width * 3];
+      for (int x = 0; x < shot.width; x++)
+        memcpy(dst + x * 3, src + x * 4, 3);
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "screenshot-%05llu.ppm",
+             (unsigned long long)shot.index);
+    if (writePPM(path, image))
+      printf("Saved %s\n", path);
+    else
+      fprintf(stderr, "Failed to write %s\n", path);
+  });
+
+  FrameCommands inlineFrame;
+  RenderThread renderThread;
+  if (useRenderThread)
+    renderThread.start(window, executeFrame);
 
-    processInput(window);
-    glClearColor(0.1f, 0.1f, 0.15f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  // Simulation runs at a fixed rate; rendering interpolates between the last
+  // two simulation states so animation does not depend on frame timing.
+  FixedTimestep timestep;
+  double simTime = 0.0, previousTime = 0.0;
+  glm::vec3 previousCameraPos = cameraPos;
+  deltaTime = (float)timestep.step;
 
-    glm::mat4 view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
-    glm::mat4 projection =
+  for (long frame = 0; !glfwWindowShouldClose(window) && frame != maxFrames;
+       frame++) {
+    // This thread's allocations, plus the pool's while it records for us;
+    // the render, readback and recorder threads keep their own counts.
+    uint64_t allocationsBefore = heapAllocations;
+    std::fill(workerAllocations.begin(), workerAllocations.end(), 0);
+    PROFILE_ZONE("frame");
+    profileFrameMark();
+    resources.beginFrame(frame);
+    double frameTime = simClock.tick(glfwGetTime());
+    profileCounter("frame ms", frameTime * 1000.0);
+    int steps = timestep.advance(frameTime);
+    {
+      PROFILE_ZONE("simulate");
+      for (int step = 0; step < steps; step++) {
+        previousTime = simTime;
+        previousCameraPos = cameraPos;
+        processInput(window);
+        simTime += timestep.step;
+      }
+    }
+    float alpha = timestep.alpha();
+    float time = (float)(previousTime + (simTime - previousTime) * alpha);
+    glm::vec3 eye = glm::mix(previousCameraPos, cameraPos, alpha);
+    if (goldenPath) {
+      time = captureTime;
+      eye = cameraPos;
+    }
+
+    FrameCommands &frameCommands =
+        useRenderThread ? renderThread.frame() : inlineFrame;
+    frameCommands.index = frame;
+    frameArenas.beginFrame(frame);
+    frameCommands.capture = (screenshotRequested ? CAPTURE_SCREENSHOT : 0) |
+                            (recordPath ? CAPTURE_RECORD : 0);
+    screenshotRequested = false;
+    frameCommands.hud = hudVisible && !goldenPath;
+    frameCommands.width = framebufferWidth;
+    frameCommands.height = framebufferHeight;
+    frameCommands.clearColor = glm::vec4(0.1f, 0.1f, 0.15f, 1.0f);
+    frameCommands.view = glm::lookAt(eye, eye + cameraFront, cameraUp);
+    frameCommands.projection =
         glm::perspective(glm::radians(fov), 800.0f / 600.0f, 0.1f, 100.0f);
-    glUniformMatrix4fv(glGetUniformLocation(shader, "view"), 1, GL_FALSE,
-                       glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "projection"), 1, GL_FALSE,
-                       glm::value_ptr(projection));
-
-    // Prism (right side)
-    glm::mat4 model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(1.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, time, glm::vec3(0.2f, 1.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE,
-                       glm::value_ptr(model));
-    glBindVertexArray(prismVAO);
-    glDrawElements(GL_TRIANGLES, 24, GL_UNSIGNED_INT, 0);
-
-    // Cube (left side)
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, glm::vec3(-1.0f, 0.0f, 0.0f));
-    model = glm::rotate(model, time, glm::vec3(0.5f, 1.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader, "model"), 1, GL_FALSE,
-                       glm::value_ptr(model));
-    glBindVertexArray(cubeVAO);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-
-    glfwSwapBuffers(window);
+    frameCommands.draws.clear();
+    frameCommands.indirect.clear();
+    frameCommands.merged.clear();
+    float pixelsPerUnit =
+        frameCommands.projection[1][1] * framebufferHeight * 0.5f;
+    glm::mat4 viewProjection = frameCommands.projection * frameCommands.view;
+    ArenaVector<int> visible(frameArenas.local(0)); // objects in the frustum
+    visible.reserve(objects.size());
+    {
+      PROFILE_ZONE("bvh");
+      updateSceneBvh(objects, time);
+      Frustum frustum;
+      frustum.extract(viewProjection);
+      sceneBvh.cull(frustum, worldLo.data(), worldHi.data(),
+                    [&](int i) { visible.push_back(i); });
+    }
+    frameCommands.pickX = frameCommands.pickY = -1;
+    frameCommands.pickDraws.clear();
+    if (pickRequested && gpuPicking) {
+      frameCommands.pickX = glm::clamp(
+          (int)((pickX * 0.5f + 0.5f) * framebufferWidth), 0,
+          framebufferWidth - 1);
+      frameCommands.pickY = glm::clamp(
+          (int)((pickY * 0.5f + 0.5f) * framebufferHeight), 0,
+          framebufferHeight - 1);
+      for (int i : visible) {
+        DrawCommand draw = objectDraw(objects[i], time, eye, pixelsPerUnit);
+        int firstTriangle = (int)(draw.firstIndex - objects[i].firstIndex) / 3;
+        frameCommands.pickDraws.push_back({draw, i, firstTriangle});
+      }
+    } else if (pickRequested) {
+      reportPick(pickObject(objects, time, viewProjection));
+    }
+    pickRequested = false;
+    if (occlusionCulling) {
+      PROFILE_ZONE("occlusion");
+      double start = glfwGetTime();
+      occlusionStats.tested += objectCount;
+      occlusionStats.outside += objectCount - (int)visible.size();
+      drawOccluders(objects, visible, time, eye, viewProjection);
+      occlusionStats.frames++;
+      occlusionStats.triangles += occlusion.triangles;
+      occlusionStats.seconds += glfwGetTime() - start;
+    }
+    if (gpuCulling && occlusionCulling)
+      frameCommands.pyramid = occlusion.depth;
+
+    if (parallelRecord) {
+      // Workers record packets into their own buffers; the GL thread replays
+      // the merged list in sort order.
+      frameCommands.recorded.resize(workers.workerCount());
+      for (CommandBuffer &buffer : frameCommands.recorded)
+        buffer.reset();
+      PROFILE_ZONE("record commands");
+      workers.parallelFor((int)visible.size(), [&](int v, int worker) {
+        HeapAllocationScope allocations(workerAllocations[worker]);
+        PROFILE_ZONE("record object");
+        int i = visible[v];
+        if (gpuCulling && objects[i].meshletCount)
+          return; // recorded below, as its draw is made on the GPU
+        if (occlusionCulling && !objectVisible(objects[i], time, viewProjection,
+                                               workerOcclusionStats[worker]))
+          return;
+        CommandBuffer &cmd = frameCommands.recorded[worker];
+        DrawCommand draw = objectDraw(objects[i], time, eye, pixelsPerUnit);
+        cmd.begin(drawSortKey(shader, objects[i].vao, i));
+        cmd.bindProgram(shader);
+        cmd.uniformMat4(uniforms.model, glm::value_ptr(draw.model));
+        cmd.bindVertexArray(objects[i].vao);
+        if (meshletCulling && objects[i].meshletCount) {
+          ArenaVector<DrawElementsIndirectCommand> ranges(
+              frameArenas.local(worker));
+          ranges.reserve(objects[i].meshletCount);
+          cullObjectMeshlets(objects[i], time, eye, viewProjection, draw,
+                             ranges, workerMeshletStats[worker]);
+          for (const DrawElementsIndirectCommand &range : ranges)
+            cmd.drawIndexed(range.count, range.firstIndex, 0, draw.indexType);
+        } else {
+          cmd.drawIndexed(draw.indexCount, draw.firstIndex, draw.baseVertex,
+                          draw.indexType);
+        }
+        cmd.end();
+      });
+      mergeCommandBuffers(frameCommands.recorded, frameCommands.merged);
+      for (int i : visible) {
+        const SceneObject &object = objects[i];
+        if (!gpuCulling || !object.meshletCount ||
+            (occlusionCulling &&
+             !objectVisible(object, time, viewProjection, occlusionStats)))
+          continue;
+        DrawCommand draw = objectDraw(object, time, eye, pixelsPerUnit);
+        cullObjectMeshlets(object, time, eye, viewProjection, draw,
+                           frameCommands.indirect, meshletStats);
+        frameCommands.draws.push_back(draw);
+      }
+    } else {
+      for (int i : visible) {
+        const SceneObject &object = objects[i];
+        if (occlusionCulling &&
+            !objectVisible(object, time, viewProjection, occlusionStats))
+          continue;
+        DrawCommand draw = objectDraw(object, time, eye, pixelsPerUnit);
+        if ((meshletCulling || gpuCulling) && object.meshletCount)
+          cullObjectMeshlets(object, time, eye, viewProjection, draw,
+                             frameCommands.indirect, meshletStats);
+        frameCommands.draws.push_back(draw);
+      }
+    }
+
+    if (useRenderThread) {
+      PROFILE_ZONE("submit");
+      renderThread.submit();
+    } else {
+      executeFrame(frameCommands);
+      if (goldenPath)
+        break;
+      PROFILE_ZONE("swap");
+      glfwSwapBuffers(window);
+    }
     glfwPollEvents();
+    if (frame >= ARENA_WARMUP_FRAMES) {
+      steadyAllocations += heapAllocations - allocationsBefore;
+      for (int w = 1; w < workers.workerCount(); w++) // 0 is this thread
+        steadyAllocations += workerAllocations[w];
+      steadyFrames++;
+    }
   }
 
+  if (useRenderThread)
+    renderThread.stop();
+  readback.stop();
+  recorder.close();
+  stopProfiler();
+  perfHud.destroy();
+  gpuTimers.destroy();
+  indirectDrawer.destroy();
+  if (gpuCulling && gpuCuller.tested)
+    printf("GPU culling: the last frame drew %u of %d meshlets tested\n",
+           gpuCuller.lastDrawCount(), gpuCuller.tested);
+  gpuCuller.destroy();
+  idPicker.destroy();
+  for (const MeshletCullStats &stats : workerMeshletStats) {
+    meshletStats.tested += stats.tested;
+    meshletStats.outside += stats.outside;
+    meshletStats.backFacing += stats.backFacing;
+    meshletStats.occluded += stats.occluded;
+  }
+  if (meshletStats.tested)
+    printf("Meshlets: %ld tested, %.1f%% outside the frustum, %.1f%% "
+           "back-facing, %.1f%% occluded\n",
+           meshletStats.tested,
+           100.0 * meshletStats.outside / meshletStats.tested,
+           100.0 * meshletStats.backFacing / meshletStats.tested,
+           100.0 * meshletStats.occluded / meshletStats.tested);
+  for (const OcclusionStats &stats : workerOcclusionStats) {
+    occlusionStats.tested += stats.tested;
+    occlusionStats.outside += stats.outside;
+    occlusionStats.occluded += stats.occluded;
+  }
+  if (occlusionStats.frames && occlusionStats.tested)
+    printf("Occlusion: %.0f occluder triangles in %.2f ms per frame; %ld "
+           "objects tested, %.1f%% outside the frustum, %.1f%% occluded\n",
+           (double)occlusionStats.triangles / occlusionStats.frames,
+           occlusionStats.seconds * 1000.0 / occlusionStats.frames,
+           occlusionStats.tested,
+           100.0 * occlusionStats.outside / occlusionStats.tested,
+           100.0 * occlusionStats.occluded / occlusionStats.tested);
+  geometry.printStats();
+  if (steadyFrames)
+    printf("Heap: %llu allocations in %ld frames after the first %ld; frame "
+           "arenas peaked at %zu bytes\n",
+           (unsigned long long)steadyAllocations, steadyFrames,
+           ARENA_WARMUP_FRAMES, frameArenas.peakBytes());
+  glb.destroy();
+  meshCache.destroy();
+  destroySceneResources(objects, sceneProgram);
+  resources.shutdown();
+  int result = goldenPath ? golden.finish(goldenPath, updateGolden) : 0;
+  stopGLTrace();
+  shutdownDebugOutput();
   glfwTerminate();
-  return 0;
+  return result;
 }
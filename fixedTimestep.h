@@ -0,0 +1,68 @@
+#pragma once
+// Fixed-timestep simulation driver. The render loop feeds it frame times; it
+// reports how many whole simulation steps to run and the interpolation factor
+// between the previous and current simulation state for rendering.
+#include <cstdint>
+
+// Frame clock. In real mode it forwards the wall clock; in deterministic mode
+// it ignores the wall clock and advances by a fixed render interval with
+// seeded jitter, so a given seed always produces the same frame times.
+struct SimClock {
+  bool deterministic = false;
+  double renderInterval = 1.0 / 60.0;
+  double jitter = 0.25; // +/- fraction of renderInterval
+  uint64_t rng = 0;
+  double now = 0.0;
+  double last = 0.0;
+  bool started = false;
+
+  void seed(uint64_t s) {
+    deterministic = true;
+    rng = s ? s : 0x9E3779B97F4A7C15ull;
+  }
+
+  // xorshift64*, mapped to [0, 1)
+  double random() {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (double)((rng * 0x2545F4914F6CDD1Dull) >> 11) *
+           (1.0 / 9007199254740992.0);
+  }
+
+  // Returns the duration of the frame that just ended.
+  double tick(double wallTime) {
+    if (deterministic) {
+      double dt = renderInterval * (1.0 + jitter * (2.0 * random() - 1.0));
+      now += dt;
+      return dt;
+    }
+    if (!started) {
+      last = wallTime;
+      started = true;
+    }
+    double dt = wallTime - last;
+    last = now = wallTime;
+    return dt;
+  }
+};
+
+struct FixedTimestep {
+  double step = 1.0 / 120.0;
+  double accumulator = 0.0;
+  int maxSteps = 8; // clamp after hitches instead of spiralling
+
+  int advance(double frameTime) {
+    accumulator += frameTime;
+    int steps = (int)(accumulator / step);
+    if (steps > maxSteps) {
+      steps = maxSteps;
+      accumulator = 0.0;
+    } else {
+      accumulator -= steps * step;
+    }
+    return steps;
+  }
+
+  float alpha() const { return (float)(accumulator / step); }
+};
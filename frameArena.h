@@ -0,0 +1,137 @@
+#pragma once
+// Bump allocation for data that lives one frame. Each worker has its own
+// arena, so workers never share a cursor, and there are two sets used on
+// alternate frames: whatever a frame allocates stays valid until the frame
+// after next begins. A set is reset when its frame index comes round again.
+// Nothing is freed singly.
+// When an arena runs out it takes extra blocks from the heap and, at the
+// next reset, regrows to the size the frame needed, so after a few frames
+// the arenas stop touching the heap.
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+const size_t FRAME_ARENA_BYTES = 64 * 1024; // per worker, per frame set
+
+struct LinearArena {
+  std::vector<char> block;
+  size_t used = 0;
+  std::vector<std::vector<char>> overflow; // since the last reset
+  size_t overflowBytes = 0;
+  size_t peak = 0; // most any frame has asked for
+
+  // align is a power of two, at most alignof(std::max_align_t).
+  void *allocate(size_t size, size_t align) {
+    size_t offset = (used + align - 1) & ~(align - 1);
+    if (offset + size <= block.size()) {
+      used = offset + size;
+      return block.data() + offset;
+    }
+    overflow.emplace_back(size ? size : 1);
+    overflowBytes += size + align;
+    return overflow.back().data();
+  }
+
+  void reset() {
+    size_t needed = used + overflowBytes;
+    if (needed > peak)
+      peak = needed;
+    if (!overflow.empty()) {
+      overflow.clear();
+      size_t capacity = block.size() ? block.size() : FRAME_ARENA_BYTES;
+      while (capacity < needed)
+        capacity *= 2;
+      block = std::vector<char>(capacity);
+    }
+    used = 0;
+    overflowBytes = 0;
+  }
+};
+
+struct FrameArenas {
+  std::vector<LinearArena> sets[2]; // per worker, by frame parity
+  int current = 0;
+
+  void init(int workers, size_t bytes = FRAME_ARENA_BYTES) {
+    for (std::vector<LinearArena> &set : sets) {
+      set.assign(workers, LinearArena());
+      for (LinearArena &arena : set)
+        arena.block.resize(bytes);
+    }
+  }
+
+  // Recording thread, before anything of frame index is allocated. The set
+  // it reuses belonged to frame index - 2.
+  void beginFrame(long index) {
+    current = (int)(index & 1);
+    for (LinearArena &arena : sets[current])
+      arena.reset();
+  }
+
+  // Worker numbers as in WorkerPool::parallelFor; 0 is the calling thread.
+  LinearArena &local(int worker) { return sets[current][worker]; }
+
+  size_t peakBytes() const {
+    size_t bytes = 0;
+    for (const std::vector<LinearArena> &set : sets)
+      for (const LinearArena &arena : set)
+        bytes = arena.peak > bytes ? arena.peak : bytes;
+    return bytes;
+  }
+};
+
+// Lets standard containers allocate from an arena. deallocate() does
+// nothing; a growing container leaves its old storage behind until the
+// reset, so reserve() what is known up front.
+template <class T> struct ArenaAllocator {
+  using value_type = T;
+  LinearArena *arena;
+
+  ArenaAllocator(LinearArena &a) : arena(&a) {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+  T *allocate(size_t n) {
+    return (T *)arena->allocate(n * sizeof(T), alignof(T));
+  }
+  void deallocate(T *, size_t) {}
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+  return a.arena == b.arena;
+}
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+  return a.arena != b.arena;
+}
+
+template <class T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Calls to operator new made by the current thread, counted by the
+// replacement a program defines with COUNT_HEAP_ALLOCATIONS in exactly one
+// source file. The sized delete frees through the plain one, and both that
+// and new are kept out of line so GCC does not pair malloc with a delete and
+// warn about every call.
+inline thread_local uint64_t heapAllocations = 0;
+
+#define COUNT_HEAP_ALLOCATIONS                                                 \
+  [[gnu::noinline]] void *operator new(size_t size) {                          \
+    heapAllocations++;                                                         \
+    if (void *p = malloc(size ? size : 1))                                     \
+      return p;                                                                \
+    throw std::bad_alloc();                                                    \
+  }                                                                            \
+  [[gnu::noinline]] void operator delete(void *p) noexcept { free(p); }        \
+  void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+// Adds what the calling thread allocates while it lives to total, for work a
+// pool worker does on a frame's behalf.
+struct HeapAllocationScope {
+  uint64_t &total;
+  uint64_t start = heapAllocations;
+  explicit HeapAllocationScope(uint64_t &t) : total(t) {}
+  ~HeapAllocationScope() { total += heapAllocations - start; }
+};
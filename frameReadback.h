@@ -0,0 +1,182 @@
+#pragma once
+// Asynchronous framebuffer readback. capture() queues a glReadPixels into the
+// next pixel pack buffer of a small ring and fences it; poll() maps buffers
+// whose fence has signalled (by then the copy is done, so mapping does not
+// stall) and hands the pixels to a worker thread. With three buffers, frame N
+// is copied while frames N+1 and N+2 render. All GL calls must be made on the
+// context thread; the consumer runs on the worker.
+#include "glad/glad.h"
+#include "profiler.h"
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+const int READBACK_RING_SIZE = 3;
+
+struct ReadbackFrame {
+  uint64_t index = 0;
+  int tag = 0; // passed through from capture()
+  int width = 0, height = 0;
+  std::vector<unsigned char> rgba; // bottom-up rows, as read from GL
+};
+
+struct FrameReadback {
+  struct Slot {
+    unsigned int pbo = 0;
+    GLsync fence = nullptr;
+    uint64_t index = 0;
+    int tag = 0;
+    int width = 0, height = 0;
+  };
+  Slot slots[READBACK_RING_SIZE];
+  int head = 0, pending = 0;
+  size_t bufferSize = 0;
+
+  std::function<void(ReadbackFrame &)> consumer;
+  std::thread worker;
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<ReadbackFrame *> queue;
+  std::vector<ReadbackFrame *> freeFrames; // recycled to avoid per-frame allocs
+  bool quit = false;
+  size_t maxQueued = 8; // frames waiting for the consumer before we block
+
+  void start(std::function<void(ReadbackFrame &)> fn) {
+    consumer = std::move(fn);
+    worker = std::thread([this] { run(); });
+  }
+
+  // Call after drawing, before swapping. Blocks only when the ring is full,
+  // i.e. the GPU is more than READBACK_RING_SIZE frames behind.
+  void capture(uint64_t index, int width, int height, int tag = 0) {
+    size_t size = (size_t)width * height * 4;
+    if (size != bufferSize)
+      resize(size);
+    if (pending == READBACK_RING_SIZE)
+      retire(true);
+    Slot &slot = slots[head];
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.index = index;
+    slot.tag = tag;
+    slot.width = width;
+    slot.height = height;
+    head = (head + 1) % READBACK_RING_SIZE;
+    pending++;
+  }
+
+  // Call once per frame: hands over every capture the GPU has finished.
+  void poll() {
+    while (pending && retire(false)) {
+    }
+  }
+
+  // Waits for all outstanding captures and the consumer, then frees GL
+  // objects. Call on the context thread before the context goes away.
+  void stop() {
+    while (pending)
+      retire(true);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    ready.notify_all();
+    if (worker.joinable())
+      worker.join();
+    for (ReadbackFrame *f : freeFrames)
+      delete f;
+    freeFrames.clear();
+    for (Slot &slot : slots)
+      if (slot.pbo)
+        glDeleteBuffers(1, &slot.pbo);
+    bufferSize = 0;
+  }
+
+  void resize(size_t size) {
+    while (pending)
+      retire(true);
+    for (Slot &slot : slots) {
+      if (!slot.pbo)
+        glGenBuffers(1, &slot.pbo);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+      glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    bufferSize = size;
+  }
+
+  // Oldest capture: copy out and queue if its fence signalled (or always,
+  // waiting for it, when block is set).
+  bool retire(bool block) {
+    Slot &slot =
+        slots[(head - pending + READBACK_RING_SIZE) % READBACK_RING_SIZE];
+    if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+      if (!block)
+        return false;
+      glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+    }
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    pending--;
+
+    PROFILE_ZONE("readback copy");
+    ReadbackFrame *frame = acquireFrame();
+    frame->index = slot.index;
+    frame->tag = slot.tag;
+    frame->width = slot.width;
+    frame->height = slot.height;
+    size_t size = (size_t)slot.width * slot.height * 4;
+    frame->rgba.resize(size);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+                                  GL_MAP_READ_BIT);
+    if (data) {
+      memcpy(frame->rgba.data(), data, size);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait(lock, [this] { return queue.size() < maxQueued; });
+      queue.push_back(frame);
+    }
+    ready.notify_all();
+    return true;
+  }
+
+  ReadbackFrame *acquireFrame() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freeFrames.empty())
+      return new ReadbackFrame;
+    ReadbackFrame *frame = freeFrames.back();
+    freeFrames.pop_back();
+    return frame;
+  }
+
+  void run() {
+    profileThreadName("readback");
+    for (;;) {
+      ReadbackFrame *frame;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [this] { return quit || !queue.empty(); });
+        if (queue.empty())
+          return;
+        frame = queue.front();
+        queue.pop_front();
+      }
+      ready.notify_all();
+      consumer(*frame);
+      std::lock_guard<std::mutex> lock(mutex);
+      freeFrames.push_back(frame);
+    }
+  }
+};
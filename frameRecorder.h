@@ -0,0 +1,281 @@
+#pragma once
+// --record: encodes frames handed over by FrameReadback and streams them to
+// disk. out.y4m writes YUV4MPEG2 (4:2:0), out.yuv the same planes without
+// headers, and out.png a numbered PNG sequence (out-00000.png, ...).
+// Conversion and compression run on the readback worker, split across a
+// worker pool; a writer thread drains a bounded queue with one large write
+// per frame.
+#include "frameReadback.h"
+#include "pngEncode.h"
+#include "workerPool.h"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const int RECORD_FPS = 60;
+const int RECORD_QUEUE_DEPTH = 4;
+const int RECORD_BAND_ROWS = 64; // even, so chroma rows stay in one band
+
+enum RecordFormat { RECORD_Y4M, RECORD_YUV, RECORD_PNG };
+
+// BT.601 limited range, 2x2 box-filtered chroma. Converts rows [y0, y1) (an
+// even range) of an RGBA image with even width into I420 planes.
+inline void rgbaToI420(const unsigned char *rows, ptrdiff_t pitch, int width,
+                       int y0, int y1, unsigned char *yPlane,
+                       unsigned char *uPlane, unsigned char *vPlane) {
+  int cw = width / 2;
+  for (int y = y0; y < y1; y += 2) {
+    const unsigned char *s0 = rows + (ptrdiff_t)y * pitch;
+    const unsigned char *s1 = s0 + pitch;
+    unsigned char *d0 = yPlane + (size_t)y * width, *d1 = d0 + width;
+    unsigned char *u = uPlane + (size_t)(y / 2) * cw;
+    unsigned char *v = vPlane + (size_t)(y / 2) * cw;
+    int x = 0;
+#ifdef __SSE2__
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128i kr = _mm_set1_epi16(66), kg = _mm_set1_epi16(129),
+                  kb = _mm_set1_epi16(25), round = _mm_set1_epi16(128),
+                  offset = _mm_set1_epi16(16), ones = _mm_set1_epi16(1);
+    auto pair = [](int lo, int hi) {
+      return _mm_set1_epi32((int)((uint32_t)(uint16_t)lo |
+                                  (uint32_t)(uint16_t)hi << 16));
+    };
+    const __m128i uRG = pair(-38, -74), uB = pair(112, 512);
+    const __m128i vRG = pair(112, -94), vB = pair(-18, 512);
+    const __m128i chromaOffset = _mm_set1_epi32(128);
+    // 8 RGBA pixels -> three vectors of 8 x 16-bit channels
+    auto split = [&](const unsigned char *p, __m128i &r, __m128i &g,
+                     __m128i &b) {
+      __m128i lo = _mm_loadu_si128((const __m128i *)p);
+      __m128i hi = _mm_loadu_si128((const __m128i *)(p + 16));
+      r = _mm_packs_epi32(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask));
+      g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 8), mask),
+                          _mm_and_si128(_mm_srli_epi32(hi, 8), mask));
+      b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(lo, 16), mask),
+                          _mm_and_si128(_mm_srli_epi32(hi, 16), mask));
+    };
+    // sums stay below 2^16, so unsigned 16-bit lanes do not overflow
+    auto luma = [&](__m128i r, __m128i g, __m128i b) {
+      __m128i sum = _mm_add_epi16(
+          _mm_add_epi16(_mm_mullo_epi16(r, kr), _mm_mullo_epi16(g, kg)),
+          _mm_add_epi16(_mm_mullo_epi16(b, kb), round));
+      __m128i yv = _mm_add_epi16(_mm_srli_epi16(sum, 8), offset);
+      return _mm_packus_epi16(yv, yv);
+    };
+    for (; x + 8 <= width; x += 8) {
+      __m128i r0, g0, b0, r1, g1, b1;
+      split(s0 + x * 4, r0, g0, b0);
+      split(s1 + x * 4, r1, g1, b1);
+      _mm_storel_epi64((__m128i *)(d0 + x), luma(r0, g0, b0));
+      _mm_storel_epi64((__m128i *)(d1 + x), luma(r1, g1, b1));
+      // 2x2 sums (at most 1020) in the low four 16-bit lanes
+      __m128i rs = _mm_madd_epi16(_mm_add_epi16(r0, r1), ones);
+      __m128i gs = _mm_madd_epi16(_mm_add_epi16(g0, g1), ones);
+      __m128i bs = _mm_madd_epi16(_mm_add_epi16(b0, b1), ones);
+      __m128i rg = _mm_unpacklo_epi16(_mm_packs_epi32(rs, rs),
+                                      _mm_packs_epi32(gs, gs));
+      __m128i b1s = _mm_unpacklo_epi16(_mm_packs_epi32(bs, bs), ones);
+      __m128i uv = _mm_add_epi32(_mm_madd_epi16(rg, uRG),
+                                 _mm_madd_epi16(b1s, uB));
+      __m128i vv = _mm_add_epi32(_mm_madd_epi16(rg, vRG),
+                                 _mm_madd_epi16(b1s, vB));
+      uv = _mm_add_epi32(_mm_srai_epi32(uv, 10), chromaOffset);
+      vv = _mm_add_epi32(_mm_srai_epi32(vv, 10), chromaOffset);
+      uv = _mm_packs_epi32(uv, uv);
+      vv = _mm_packs_epi32(vv, vv);
+      int u4 = _mm_cvtsi128_si32(_mm_packus_epi16(uv, uv));
+      int v4 = _mm_cvtsi128_si32(_mm_packus_epi16(vv, vv));
+      memcpy(u + x / 2, &u4, 4);
+      memcpy(v + x / 2, &v4, 4);
+    }
+#endif
+    for (; x < width; x += 2) {
+      int rs = 0, gs = 0, bs = 0;
+      for (int dy = 0; dy < 2; dy++)
+        for (int dx = 0; dx < 2; dx++) {
+          const unsigned char *p = (dy ? s1 : s0) + (x + dx) * 4;
+          (dy ? d1 : d0)[x + dx] =
+              (unsigned char)(((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >>
+                               8) +
+                              16);
+          rs += p[0];
+          gs += p[1];
+          bs += p[2];
+        }
+      u[x / 2] = (unsigned char)(((-38 * rs - 74 * gs + 112 * bs + 512) >> 10) +
+                                 128);
+      v[x / 2] = (unsigned char)(((112 * rs - 94 * gs - 18 * bs + 512) >> 10) +
+                                 128);
+    }
+  }
+}
+
+struct FrameRecorder {
+  struct Encoded {
+    std::vector<unsigned char> bytes;
+    long index = 0;
+  };
+
+  RecordFormat format = RECORD_Y4M;
+  std::string path; // video file, or PNG path without the extension
+  FILE *file = nullptr;
+  int width = 0, height = 0; // fixed by the first frame
+  long frames = 0, skipped = 0;
+  double encodeSeconds = 0;
+  std::unique_ptr<WorkerPool> pool;
+  std::unique_ptr<PngEncoder> png;
+
+  std::thread writer;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::deque<Encoded *> queue;
+  std::vector<Encoded *> freeList;
+  bool quit = false, failed = false;
+
+  bool open(const char *outPath) {
+    path = outPath;
+    auto endsWith = [&](const char *ext) {
+      size_t n = strlen(ext);
+      return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+    };
+    if (endsWith(".png")) {
+      format = RECORD_PNG;
+      path.resize(path.size() - 4);
+    } else {
+      format = endsWith(".yuv") ? RECORD_YUV : RECORD_Y4M;
+      file = fopen(outPath, "wb");
+      if (!file) {
+        fprintf(stderr, "Failed to open %s\n", outPath);
+        return false;
+      }
+      setvbuf(file, nullptr, _IONBF, 0); // frames are written whole
+    }
+    pool.reset(new WorkerPool());
+    png.reset(new PngEncoder(pool.get()));
+    writer = std::thread([this] { run(); });
+    return true;
+  }
+
+  // Called on the readback worker for every captured frame, in order.
+  void encode(const ReadbackFrame &frame) {
+    if (!width) {
+      width = frame.width & ~1; // 4:2:0 needs even dimensions
+      height = frame.height & ~1;
+    }
+    if (frame.width < width || frame.height < height || !width || !height) {
+      skipped++; // window shrank; the stream size is fixed
+      return;
+    }
+    PROFILE_ZONE("encode frame");
+    auto start = std::chrono::steady_clock::now();
+    Encoded *out = acquire();
+    out->index = frames;
+    const unsigned char *top =
+        frame.rgba.data() + (size_t)(frame.height - 1) * frame.width * 4;
+    ptrdiff_t pitch = -(ptrdiff_t)frame.width * 4; // GL rows are bottom-up
+    if (format == RECORD_PNG) {
+      png->encode(top, pitch, 4, width, height, out->bytes);
+    } else {
+      char header[128] = "";
+      if (format == RECORD_Y4M) {
+        if (frames == 0)
+          snprintf(header, sizeof(header),
+                   "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height,
+                   RECORD_FPS);
+        strcat(header, "FRAME\n");
+      }
+      size_t headerSize = strlen(header), lumaSize = (size_t)width * height;
+      out->bytes.resize(headerSize + lumaSize * 3 / 2);
+      memcpy(out->bytes.data(), header, headerSize);
+      unsigned char *yPlane = out->bytes.data() + headerSize;
+      unsigned char *uPlane = yPlane + lumaSize;
+      unsigned char *vPlane = uPlane + lumaSize / 4;
+      int bands = (height + RECORD_BAND_ROWS - 1) / RECORD_BAND_ROWS;
+      pool->parallelFor(bands, [&](int band, int) {
+        int y0 = band * RECORD_BAND_ROWS;
+        int y1 = std::min(height, y0 + RECORD_BAND_ROWS);
+        rgbaToI420(top, pitch, width, y0, y1, yPlane, uPlane, vPlane);
+      });
+    }
+    encodeSeconds += std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    frames++;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [this] {
+        return queue.size() < (size_t)RECORD_QUEUE_DEPTH;
+      });
+      queue.push_back(out);
+    }
+    changed.notify_all();
+  }
+
+  // Call after FrameReadback::stop(), so no more frames arrive.
+  void close() {
+    if (!writer.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    changed.notify_all();
+    writer.join();
+    if (file)
+      fclose(file);
+    file = nullptr;
+    for (Encoded *e : freeList)
+      delete e;
+    freeList.clear();
+    printf("Recorded %ld frames (%dx%d), %.2f ms encode per frame%s\n",
+           frames, width, height,
+           frames ? encodeSeconds * 1000.0 / frames : 0.0,
+           failed ? ", write errors" : "");
+    if (skipped)
+      printf("Skipped %ld frames after the window was resized\n", skipped);
+  }
+
+  Encoded *acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (freeList.empty())
+      return new Encoded;
+    Encoded *e = freeList.back();
+    freeList.pop_back();
+    return e;
+  }
+
+  void run() {
+    profileThreadName("recorder");
+    for (;;) {
+      Encoded *e;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return quit || !queue.empty(); });
+        if (queue.empty())
+          return;
+        e = queue.front();
+        queue.pop_front();
+      }
+      changed.notify_all();
+      PROFILE_ZONE("write frame");
+      if (format == RECORD_PNG) {
+        char name[32];
+        snprintf(name, sizeof(name), "-%05ld.png", e->index);
+        FILE *f = fopen((path + name).c_str(), "wb");
+        failed |= !f || fwrite(e->bytes.data(), 1, e->bytes.size(), f) !=
+                            e->bytes.size();
+        if (f)
+          fclose(f);
+      } else {
+        failed |= fwrite(e->bytes.data(), 1, e->bytes.size(), file) !=
+                  e->bytes.size();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      freeList.push_back(e);
+    }
+  }
+};
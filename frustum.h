@@ -0,0 +1,41 @@
+#pragma once
+// View frustum planes, extracted from a clip matrix as in Gribb and Hartmann,
+// "Fast Extraction of Viewing Frustum Planes from the World-View-Projection
+// Matrix", with the bounding volume tests the culling passes share.
+#include <glm/glm.hpp>
+
+struct Frustum {
+  glm::vec4 planes[6]; // inside where dot(xyz, p) + w >= 0; xyz unit length
+
+  // The planes in the space that matrix maps to clip space, so passing
+  // projection * view * model gives them in model space.
+  void extract(const glm::mat4 &m) {
+    glm::vec4 row[4];
+    for (int i = 0; i < 4; i++)
+      row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+    for (int i = 0; i < 3; i++) {
+      planes[i * 2] = row[3] + row[i];
+      planes[i * 2 + 1] = row[3] - row[i];
+    }
+    for (glm::vec4 &p : planes)
+      p = p / glm::length(glm::vec3(p));
+  }
+
+  bool sphereVisible(glm::vec3 center, float radius) const {
+    for (const glm::vec4 &p : planes)
+      if (glm::dot(glm::vec3(p), center) + p.w < -radius)
+        return false;
+    return true;
+  }
+
+  // Tests the box corner furthest along each plane's normal.
+  bool boxVisible(glm::vec3 lo, glm::vec3 hi) const {
+    for (const glm::vec4 &p : planes) {
+      glm::vec3 corner(p.x > 0 ? hi.x : lo.x, p.y > 0 ? hi.y : lo.y,
+                       p.z > 0 ? hi.z : lo.z);
+      if (glm::dot(glm::vec3(p), corner) + p.w < 0)
+        return false;
+    }
+    return true;
+  }
+};
@@ -0,0 +1,333 @@
+#pragma once
+// Meshes carved out of large shared buffers. OffsetAllocator hands out
+// ranges of a fixed-size space with a two-level segregated fit scheme, after
+// Masmano et al., "TLSF: a New Dynamic Memory Allocator for Real-Time
+// Systems", 2004: free ranges sit in bins by size class, found through two
+// levels of bitmasks in constant time, and a freed range merges with its
+// free neighbours. GeometryPool keeps pages of one vertex and one index
+// buffer behind one vertex array, so meshes in a page draw with
+// glDrawElementsBaseVertex and no rebinding.
+#include "glad/glad.h"
+#include "gpuResources.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+const int ALLOCATOR_SUBBIN_BITS = 3; // 8 size classes per power of two
+const int ALLOCATOR_SUBBINS = 1 << ALLOCATOR_SUBBIN_BITS;
+const int ALLOCATOR_LEVELS = 32;
+const uint32_t ALLOCATOR_NO_SPACE = UINT32_MAX;
+
+inline int floorLog2(uint32_t v) { return 31 - __builtin_clz(v); }
+
+struct OffsetAllocation {
+  uint32_t offset = ALLOCATOR_NO_SPACE;
+  int block = -1;
+};
+
+struct AllocatorStats {
+  uint32_t capacity, used, free, largestFree;
+  int freeRanges;
+  // Share of the free space outside the largest free range.
+  float fragmentation() const {
+    return free ? 1.0f - (float)largestFree / free : 0.0f;
+  }
+};
+
+struct OffsetAllocator {
+  struct Block {
+    uint32_t offset, size;
+    int prev, next;         // neighbours in address order
+    int prevFree, nextFree; // bin list, while free
+    bool free;
+  };
+  std::vector<Block> blocks;
+  std::vector<int> unusedBlocks;
+  uint32_t levelMask = 0;
+  uint32_t binMasks[ALLOCATOR_LEVELS] = {};
+  int bins[ALLOCATOR_LEVELS][ALLOCATOR_SUBBINS];
+  uint32_t capacity = 0, freeSpace = 0;
+  int freeRanges = 0;
+
+  void init(uint32_t size) {
+    blocks.clear();
+    unusedBlocks.clear();
+    levelMask = 0;
+    for (int l = 0; l < ALLOCATOR_LEVELS; l++) {
+      binMasks[l] = 0;
+      for (int s = 0; s < ALLOCATOR_SUBBINS; s++)
+        bins[l][s] = -1;
+    }
+    capacity = freeSpace = size;
+    freeRanges = 0;
+    insertFree(newBlock(0, size, -1, -1));
+  }
+
+  // Sizes below ALLOCATOR_SUBBINS get one bin each; above, each power of
+  // two is split into ALLOCATOR_SUBBINS classes.
+  static void binOf(uint32_t size, int &level, int &sub) {
+    if (size < ALLOCATOR_SUBBINS) {
+      level = 0;
+      sub = (int)size;
+      return;
+    }
+    int log = floorLog2(size);
+    level = log - ALLOCATOR_SUBBIN_BITS + 1;
+    sub = (int)(size >> (log - ALLOCATOR_SUBBIN_BITS)) - ALLOCATOR_SUBBINS;
+  }
+
+  OffsetAllocation allocate(uint32_t size) {
+    OffsetAllocation allocation;
+    if (!size || size > freeSpace)
+      return allocation;
+    // Round up to the next class boundary, so that any range in the bin
+    // found is large enough.
+    uint32_t rounded = size;
+    if (size >= ALLOCATOR_SUBBINS) {
+      uint32_t step = 1u << (floorLog2(size) - ALLOCATOR_SUBBIN_BITS);
+      if (size > UINT32_MAX - step)
+        return allocation;
+      rounded = size + step - 1;
+    }
+    int level, sub;
+    binOf(rounded, level, sub);
+    uint32_t subs = binMasks[level] & (~0u << sub);
+    if (!subs) {
+      uint32_t levels = levelMask & (~0u << (level + 1));
+      if (!levels)
+        return allocation;
+      level = __builtin_ctz(levels);
+      subs = binMasks[level];
+    }
+    sub = __builtin_ctz(subs);
+    int b = bins[level][sub];
+    removeFree(b);
+    if (blocks[b].size > size) {
+      int rest = newBlock(blocks[b].offset + size, blocks[b].size - size, b,
+                          blocks[b].next);
+      if (blocks[rest].next >= 0)
+        blocks[blocks[rest].next].prev = rest;
+      blocks[b].next = rest;
+      blocks[b].size = size;
+      insertFree(rest);
+    }
+    freeSpace -= size;
+    allocation.offset = blocks[b].offset;
+    allocation.block = b;
+    return allocation;
+  }
+
+  void free(OffsetAllocation &allocation) {
+    int b = allocation.block;
+    allocation = OffsetAllocation();
+    if (b < 0)
+      return;
+    freeSpace += blocks[b].size;
+    int prev = blocks[b].prev, next = blocks[b].next;
+    if (prev >= 0 && blocks[prev].free) {
+      removeFree(prev);
+      blocks[prev].size += blocks[b].size;
+      unlink(b);
+      b = prev;
+    }
+    if (next >= 0 && blocks[next].free) {
+      removeFree(next);
+      blocks[b].size += blocks[next].size;
+      unlink(next);
+    }
+    insertFree(b);
+  }
+
+  AllocatorStats stats() const {
+    AllocatorStats s = {capacity, capacity - freeSpace, freeSpace, 0,
+                        freeRanges};
+    if (levelMask) {
+      int level = floorLog2(levelMask);
+      for (int sub = 0; sub < ALLOCATOR_SUBBINS; sub++)
+        for (int b = bins[level][sub]; b >= 0; b = blocks[b].nextFree)
+          s.largestFree = std::max(s.largestFree, blocks[b].size);
+    }
+    return s;
+  }
+
+  int newBlock(uint32_t offset, uint32_t size, int prev, int next) {
+    int b;
+    if (unusedBlocks.empty()) {
+      b = (int)blocks.size();
+      blocks.push_back({});
+    } else {
+      b = unusedBlocks.back();
+      unusedBlocks.pop_back();
+    }
+    blocks[b] = {offset, size, prev, next, -1, -1, false};
+    return b;
+  }
+
+  // Drops a block merged into its previous neighbour.
+  void unlink(int b) {
+    int prev = blocks[b].prev, next = blocks[b].next;
+    if (prev >= 0)
+      blocks[prev].next = next;
+    if (next >= 0)
+      blocks[next].prev = prev;
+    unusedBlocks.push_back(b);
+  }
+
+  void insertFree(int b) {
+    int level, sub;
+    binOf(blocks[b].size, level, sub);
+    Block &block = blocks[b];
+    block.free = true;
+    block.prevFree = -1;
+    block.nextFree = bins[level][sub];
+    if (block.nextFree >= 0)
+      blocks[block.nextFree].prevFree = b;
+    bins[level][sub] = b;
+    binMasks[level] |= 1u << sub;
+    levelMask |= 1u << level;
+    freeRanges++;
+  }
+
+  void removeFree(int b) {
+    int level, sub;
+    binOf(blocks[b].size, level, sub);
+    Block &block = blocks[b];
+    if (block.prevFree >= 0)
+      blocks[block.prevFree].nextFree = block.nextFree;
+    else
+      bins[level][sub] = block.nextFree;
+    if (block.nextFree >= 0)
+      blocks[block.nextFree].prevFree = block.prevFree;
+    if (bins[level][sub] < 0) {
+      binMasks[level] &= ~(1u << sub);
+      if (!binMasks[level])
+        levelMask &= ~(1u << level);
+    }
+    block.free = false;
+    freeRanges--;
+  }
+};
+
+const int GEOMETRY_VERTEX_FLOATS = 6; // position + color
+const uint32_t GEOMETRY_PAGE_VERTICES = 1 << 18;
+const uint32_t GEOMETRY_PAGE_INDICES = 1 << 20;
+
+struct GeometryPage {
+  VertexArrayHandle vertexArray;
+  BufferHandle vertexBuffer, indexBuffer;
+  unsigned int vao = 0, vbo = 0, ebo = 0;
+  OffsetAllocator vertices, indices; // in vertices and in indices
+};
+
+struct GeometryAllocation {
+  int page = -1;
+  OffsetAllocation vertices, indices;
+};
+
+// Call on the context thread. Pages are registered with resources.
+struct GeometryPool {
+  GpuResources *resources = nullptr;
+  std::vector<GeometryPage> pages;
+
+  // Uploads a mesh into the first page with room, adding a page (at least
+  // the default size) when none has.
+  GeometryAllocation allocate(const float *vertexData, uint32_t vertexCount,
+                              const unsigned int *indexData,
+                              uint32_t indexCount) {
+    GeometryAllocation a;
+    for (int p = 0; p < (int)pages.size() && a.page < 0; p++) {
+      a.vertices = pages[p].vertices.allocate(vertexCount);
+      if (a.vertices.block < 0)
+        continue;
+      a.indices = pages[p].indices.allocate(indexCount);
+      if (a.indices.block < 0) {
+        pages[p].vertices.free(a.vertices);
+        continue;
+      }
+      a.page = p;
+    }
+    if (a.page < 0) {
+      addPage(std::max(vertexCount, GEOMETRY_PAGE_VERTICES),
+              std::max(indexCount, GEOMETRY_PAGE_INDICES));
+      a.page = (int)pages.size() - 1;
+      a.vertices = pages.back().vertices.allocate(vertexCount);
+      a.indices = pages.back().indices.allocate(indexCount);
+    }
+    const GeometryPage &page = pages[a.page];
+    size_t vertexSize = GEOMETRY_VERTEX_FLOATS * sizeof(float);
+    glBindBuffer(GL_ARRAY_BUFFER, page.vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, a.vertices.offset * vertexSize,
+                    vertexCount * vertexSize, vertexData);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, page.ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+                    a.indices.offset * sizeof(unsigned int),
+                    indexCount * sizeof(unsigned int), indexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return a;
+  }
+
+  // GL orders later uploads after earlier draws, so the ranges can be
+  // reused at once.
+  void free(GeometryAllocation &a) {
+    if (a.page >= 0) {
+      pages[a.page].vertices.free(a.vertices);
+      pages[a.page].indices.free(a.indices);
+    }
+    a = GeometryAllocation();
+  }
+
+  void addPage(uint32_t vertexCapacity, uint32_t indexCapacity) {
+    pages.emplace_back();
+    GeometryPage &page = pages.back();
+    size_t vertexSize = GEOMETRY_VERTEX_FLOATS * sizeof(float);
+    glGenVertexArrays(1, &page.vao);
+    glGenBuffers(1, &page.vbo);
+    glGenBuffers(1, &page.ebo);
+    page.vertexArray =
+        resources->add<RESOURCE_VERTEX_ARRAY>(page.vao, "geometry page");
+    page.vertexBuffer = resources->add<RESOURCE_BUFFER>(
+        page.vbo, "geometry vertices", vertexCapacity * vertexSize);
+    page.indexBuffer = resources->add<RESOURCE_BUFFER>(
+        page.ebo, "geometry indices", indexCapacity * sizeof(unsigned int));
+    page.vertices.init(vertexCapacity);
+    page.indices.init(indexCapacity);
+    glBindVertexArray(page.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, page.vbo);
+    glBufferData(GL_ARRAY_BUFFER, vertexCapacity * vertexSize, nullptr,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 indexCapacity * sizeof(unsigned int), nullptr,
+                 GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, vertexSize, (void *)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertexSize,
+                          (void *)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  void printStats() const {
+    for (size_t p = 0; p < pages.size(); p++) {
+      AllocatorStats v = pages[p].vertices.stats();
+      AllocatorStats i = pages[p].indices.stats();
+      printf("Geometry page %zu: %u of %u vertices, %u of %u indices used; "
+             "%d and %d free ranges, %.1f%% and %.1f%% fragmented\n",
+             p, v.used, v.capacity, i.used, i.capacity, v.freeRanges,
+             i.freeRanges, 100.0f * v.fragmentation(),
+             100.0f * i.fragmentation());
+    }
+  }
+
+  void destroy() {
+    for (GeometryPage &page : pages) {
+      resources->destroy(page.vertexArray);
+      resources->destroy(page.vertexBuffer);
+      resources->destroy(page.indexBuffer);
+    }
+    pages.clear();
+  }
+};
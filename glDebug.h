@@ -0,0 +1,203 @@
+#pragma once
+// KHR_debug capture. The driver callback only copies into a preallocated
+// ring (no locks, no allocation, no I/O); flushDebugOutput() prints from the
+// render loop. Repeats of the same source/type/id are counted, not requeued.
+#include "glad/glad.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+const unsigned int DEBUG_RING_SIZE = 256; // power of two
+const unsigned int DEBUG_TEXT_SIZE = 256;
+const unsigned int DEBUG_DEDUP_SIZE = 512; // power of two
+
+struct DebugMessage {
+  std::atomic<unsigned int> sequence;
+  GLenum source, type, severity;
+  GLuint id;
+  char text[DEBUG_TEXT_SIZE];
+};
+
+struct DebugLog {
+  DebugMessage ring[DEBUG_RING_SIZE];
+  std::atomic<unsigned int> head{0};
+  unsigned int tail = 0; // only touched by the flushing thread
+  std::atomic<uint64_t> keys[DEBUG_DEDUP_SIZE];
+  std::atomic<unsigned int> counts[DEBUG_DEDUP_SIZE];
+  std::atomic<unsigned int> dropped{0};
+
+  DebugLog() {
+    for (unsigned int i = 0; i < DEBUG_RING_SIZE; i++)
+      ring[i].sequence.store(i, std::memory_order_relaxed);
+    for (unsigned int i = 0; i < DEBUG_DEDUP_SIZE; i++) {
+      keys[i].store(0, std::memory_order_relaxed);
+      counts[i].store(0, std::memory_order_relaxed);
+    }
+  }
+};
+
+inline DebugLog debugLog;
+
+inline const char *debugSourceName(GLenum source) {
+  switch (source) {
+  case GL_DEBUG_SOURCE_API: return "api";
+  case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "window";
+  case GL_DEBUG_SOURCE_SHADER_COMPILER: return "compiler";
+  case GL_DEBUG_SOURCE_THIRD_PARTY: return "third-party";
+  case GL_DEBUG_SOURCE_APPLICATION: return "app";
+  default: return "other";
+  }
+}
+
+inline const char *debugTypeName(GLenum type) {
+  switch (type) {
+  case GL_DEBUG_TYPE_ERROR: return "error";
+  case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+  case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined";
+  case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+  case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+  case GL_DEBUG_TYPE_MARKER: return "marker";
+  default: return "other";
+  }
+}
+
+inline const char *debugSeverityName(GLenum severity) {
+  switch (severity) {
+  case GL_DEBUG_SEVERITY_HIGH: return "high";
+  case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+  case GL_DEBUG_SEVERITY_LOW: return "low";
+  default: return "note";
+  }
+}
+
+// Returns the occurrence count of this message including this one.
+inline unsigned int countDebugMessage(GLenum source, GLenum type, GLuint id) {
+  uint64_t key = ((uint64_t)(source & 0xffff) << 48) ^
+                 ((uint64_t)(type & 0xffff) << 32) ^ id;
+  key += 1; // 0 marks an empty slot
+  unsigned int slot = (unsigned int)(key * 0x9E3779B97F4A7C15ull >> 40);
+  for (unsigned int probe = 0; probe < DEBUG_DEDUP_SIZE; probe++) {
+    unsigned int i = (slot + probe) & (DEBUG_DEDUP_SIZE - 1);
+    uint64_t expected = debugLog.keys[i].load(std::memory_order_acquire);
+    if (expected == 0 && debugLog.keys[i].compare_exchange_strong(
+                             expected, key, std::memory_order_acq_rel))
+      expected = key;
+    if (expected == key)
+      return debugLog.counts[i].fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+  return 1; // table full: treat as new
+}
+
+// Bounded multi-producer queue (per-slot sequence numbers), drops when full.
+inline void pushDebugMessage(GLenum source, GLenum type, GLenum severity,
+                             GLuint id, GLsizei length, const char *message) {
+  unsigned int pos = debugLog.head.load(std::memory_order_relaxed);
+  DebugMessage *slot;
+  for (;;) {
+    slot = &debugLog.ring[pos & (DEBUG_RING_SIZE - 1)];
+    unsigned int seq = slot->sequence.load(std::memory_order_acquire);
+    int diff = (int)(seq - pos);
+    if (diff == 0) {
+      if (debugLog.head.compare_exchange_weak(pos, pos + 1,
+                                              std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      debugLog.dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    } else {
+      pos = debugLog.head.load(std::memory_order_relaxed);
+    }
+  }
+  slot->source = source;
+  slot->type = type;
+  slot->severity = severity;
+  slot->id = id;
+  size_t n = length < 0 ? strlen(message) : (size_t)length;
+  if (n >= DEBUG_TEXT_SIZE)
+    n = DEBUG_TEXT_SIZE - 1;
+  memcpy(slot->text, message, n);
+  slot->text[n] = '\0';
+  slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+inline void APIENTRY debugMessageCallback(GLenum source, GLenum type,
+                                          GLuint id, GLenum severity,
+                                          GLsizei length, const GLchar *message,
+                                          const void *) {
+  if (countDebugMessage(source, type, id) == 1)
+    pushDebugMessage(source, type, severity, id, length, message);
+}
+
+// Falls back to the loader for drivers that expose KHR_debug on a 3.3
+// context (glad only fills the pointer for GL 4.3+).
+inline bool installDebugOutput(GLADloadproc load) {
+  if (!glad_glDebugMessageCallback && load) {
+    glad_glDebugMessageCallback =
+        (PFNGLDEBUGMESSAGECALLBACKPROC)load("glDebugMessageCallback");
+    glad_glDebugMessageControl =
+        (PFNGLDEBUGMESSAGECONTROLPROC)load("glDebugMessageControl");
+  }
+  if (!glad_glDebugMessageCallback)
+    return false;
+  glEnable(GL_DEBUG_OUTPUT);
+  glDebugMessageCallback(debugMessageCallback, nullptr);
+  if (glad_glDebugMessageControl)
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE,
+                          GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE);
+  return true;
+}
+
+// Call once per frame (or at shutdown) from the thread that owns stderr.
+inline void flushDebugOutput() {
+  for (;;) {
+    DebugMessage &m = debugLog.ring[debugLog.tail & (DEBUG_RING_SIZE - 1)];
+    if (m.sequence.load(std::memory_order_acquire) != debugLog.tail + 1)
+      break;
+    fprintf(stderr, "GL %s %s [%s] #%u: %s\n", debugSourceName(m.source),
+            debugTypeName(m.type), debugSeverityName(m.severity), m.id,
+            m.text);
+    m.sequence.store(debugLog.tail + DEBUG_RING_SIZE,
+                     std::memory_order_release);
+    debugLog.tail++;
+  }
+  unsigned int dropped =
+      debugLog.dropped.exchange(0, std::memory_order_relaxed);
+  if (dropped)
+    fprintf(stderr, "GL debug ring full, dropped %u messages\n", dropped);
+}
+
+// Final flush plus a summary of messages that were suppressed as repeats.
+inline void shutdownDebugOutput() {
+  flushDebugOutput();
+  for (unsigned int i = 0; i < DEBUG_DEDUP_SIZE; i++) {
+    unsigned int count = debugLog.counts[i].load(std::memory_order_relaxed);
+    if (count > 1) {
+      uint64_t key = debugLog.keys[i].load(std::memory_order_relaxed) - 1;
+      fprintf(stderr, "GL message #%u repeated %u times\n",
+              (unsigned int)(key & 0xffffffffu), count);
+    }
+  }
+}
+
+inline bool checkShaderCompile(unsigned int shader, const char *label) {
+  int ok = 0;
+  glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+  if (!ok) {
+    char log[1024];
+    glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+    fprintf(stderr, "Shader compile failed (%s):\n%s\n", label, log);
+  }
+  return ok != 0;
+}
+
+inline bool checkProgramLink(unsigned int program) {
+  int ok = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &ok);
+  if (!ok) {
+    char log[1024];
+    glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+    fprintf(stderr, "Program link failed:\n%s\n", log);
+  }
+  return ok != 0;
+}
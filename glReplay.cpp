@@ -0,0 +1,334 @@
+// Replays a trace recorded with first3D --trace as fast as the driver allows,
+// on a hidden window, with no input or timing dependence.
+//   glReplay <trace.gltr> [--sync]
+// --sync waits for the GPU at every frame boundary (glFinish) so the reported
+// frame times include GPU execution, not just submission.
+#include "glad/glad.h"
+#include "glTrace.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+struct TraceReader {
+  const char *p;
+  template <typename T> T get() {
+    T v;
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return v;
+  }
+  const char *bytes(size_t n) {
+    const char *b = p;
+    p += n;
+    return b;
+  }
+};
+
+// Recorded object names are small integers, so plain vectors map them.
+struct NameMap {
+  std::vector<GLuint> names;
+  GLuint &operator[](GLuint recorded) {
+    if (recorded >= names.size())
+      names.resize(recorded + 1, 0);
+    return names[recorded];
+  }
+};
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: glReplay <trace.gltr> [--sync]\n";
+    return -1;
+  }
+  bool sync = argc > 2 && strcmp(argv[2], "--sync") == 0;
+
+  int fd = open(argv[1], O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 ||
+      st.st_size < (off_t)sizeof(TraceFileHeader)) {
+    std::cerr << "Failed to open trace " << argv[1] << "\n";
+    return -1;
+  }
+  const char *data = (const char *)mmap(nullptr, st.st_size, PROT_READ,
+                                        MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    std::cerr << "Failed to map trace\n";
+    return -1;
+  }
+  madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+  TraceFileHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+    std::cerr << "Not a GL trace (or unsupported version)\n";
+    return -1;
+  }
+
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow *window = glfwCreateWindow(800, 600, "GL Replay", NULL, NULL);
+  if (!window) {
+    std::cerr << "Failed to create GLFW window\n";
+    glfwTerminate();
+    return -1;
+  }
+  glfwMakeContextCurrent(window);
+  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+    std::cerr << "Failed to initialize GLAD\n";
+    return -1;
+  }
+
+  NameMap vaos, buffers, shaders, programs;
+  // uniform locations per recorded program, indexed by recorded location
+  std::vector<std::vector<GLint>> locations;
+  GLuint currentProgram = 0;
+  std::vector<double> frameMs;
+  std::vector<GLuint> scratch;
+
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+  auto frameStart = start;
+
+  const char *p = data + sizeof(TraceFileHeader);
+  const char *end = data + st.st_size;
+  while (p + sizeof(TraceRecord) <= end) {
+    TraceRecord rec;
+    memcpy(&rec, p, sizeof(rec));
+    if (rec.size > (size_t)(end - p - sizeof(rec))) {
+      std::cerr << "Truncated trace (op " << rec.op << "), stopping\n";
+      break;
+    }
+    TraceReader r{p + sizeof(rec)};
+    p += sizeof(rec) + rec.size;
+    switch (rec.op) {
+    case TRACE_GEN_VERTEX_ARRAYS:
+    case TRACE_GEN_BUFFERS: {
+      GLsizei n = r.get<uint32_t>();
+      scratch.resize(n);
+      if (rec.op == TRACE_GEN_VERTEX_ARRAYS)
+        glGenVertexArrays(n, scratch.data());
+      else
+        glGenBuffers(n, scratch.data());
+      NameMap &map = rec.op == TRACE_GEN_VERTEX_ARRAYS ? vaos : buffers;
+      for (GLsizei i = 0; i < n; i++)
+        map[r.get<uint32_t>()] = scratch[i];
+      break;
+    }
+    case TRACE_DELETE_VERTEX_ARRAYS:
+    case TRACE_DELETE_BUFFERS: {
+      GLsizei n = r.get<uint32_t>();
+      NameMap &map = rec.op == TRACE_DELETE_VERTEX_ARRAYS ? vaos : buffers;
+      scratch.resize(n);
+      for (GLsizei i = 0; i < n; i++)
+        scratch[i] = map[r.get<uint32_t>()];
+      if (rec.op == TRACE_DELETE_VERTEX_ARRAYS)
+        glDeleteVertexArrays(n, scratch.data());
+      else
+        glDeleteBuffers(n, scratch.data());
+      break;
+    }
+    case TRACE_BIND_VERTEX_ARRAY:
+      glBindVertexArray(vaos[r.get<uint32_t>()]);
+      break;
+    case TRACE_BIND_BUFFER: {
+      GLenum target = r.get<uint32_t>();
+      glBindBuffer(target, buffers[r.get<uint32_t>()]);
+      break;
+    }
+    case TRACE_BUFFER_DATA: {
+      GLenum target = r.get<uint32_t>();
+      GLenum usage = r.get<uint32_t>();
+      uint64_t size = r.get<uint64_t>();
+      bool hasData = r.get<uint32_t>() != 0;
+      glBufferData(target, size, hasData ? r.bytes(size) : nullptr, usage);
+      break;
+    }
+    case TRACE_BUFFER_SUB_DATA: {
+      GLenum target = r.get<uint32_t>();
+      uint64_t offset = r.get<uint64_t>();
+      uint64_t size = r.get<uint64_t>();
+      glBufferSubData(target, offset, size, r.bytes(size));
+      break;
+    }
+    case TRACE_VERTEX_ATTRIB_POINTER: {
+      GLuint index = r.get<uint32_t>();
+      GLint size = r.get<int32_t>();
+      GLenum type = r.get<uint32_t>();
+      GLboolean normalized = r.get<uint32_t>();
+      GLsizei stride = r.get<int32_t>();
+      uint64_t offset = r.get<uint64_t>();
+      glVertexAttribPointer(index, size, type, normalized, stride,
+                            (void *)(uintptr_t)offset);
+      break;
+    }
+    case TRACE_ENABLE_VERTEX_ATTRIB_ARRAY:
+      glEnableVertexAttribArray(r.get<uint32_t>());
+      break;
+    case TRACE_CREATE_SHADER: {
+      GLenum type = r.get<uint32_t>();
+      shaders[r.get<uint32_t>()] = glCreateShader(type);
+      break;
+    }
+    case TRACE_SHADER_SOURCE: {
+      GLuint shader = shaders[r.get<uint32_t>()];
+      GLsizei count = r.get<uint32_t>();
+      std::vector<const char *> strings(count);
+      std::vector<GLint> lengths(count);
+      for (GLsizei i = 0; i < count; i++) {
+        lengths[i] = r.get<uint32_t>();
+        strings[i] = r.bytes(lengths[i]);
+      }
+      glShaderSource(shader, count, strings.data(), lengths.data());
+      break;
+    }
+    case TRACE_COMPILE_SHADER:
+      glCompileShader(shaders[r.get<uint32_t>()]);
+      break;
+    case TRACE_DELETE_SHADER:
+      glDeleteShader(shaders[r.get<uint32_t>()]);
+      break;
+    case TRACE_CREATE_PROGRAM:
+      programs[r.get<uint32_t>()] = glCreateProgram();
+      break;
+    case TRACE_ATTACH_SHADER: {
+      GLuint program = programs[r.get<uint32_t>()];
+      glAttachShader(program, shaders[r.get<uint32_t>()]);
+      break;
+    }
+    case TRACE_LINK_PROGRAM:
+      glLinkProgram(programs[r.get<uint32_t>()]);
+      break;
+    case TRACE_USE_PROGRAM:
+      currentProgram = r.get<uint32_t>();
+      glUseProgram(programs[currentProgram]);
+      break;
+    case TRACE_DELETE_PROGRAM:
+      glDeleteProgram(programs[r.get<uint32_t>()]);
+      break;
+    case TRACE_GET_UNIFORM_LOCATION: {
+      GLuint program = r.get<uint32_t>();
+      GLint recorded = r.get<int32_t>();
+      uint32_t n = r.get<uint32_t>();
+      std::string name(r.bytes(n), n);
+      if (recorded < 0)
+        break;
+      if (program >= locations.size())
+        locations.resize(program + 1);
+      std::vector<GLint> &map = locations[program];
+      if ((size_t)recorded >= map.size())
+        map.resize(recorded + 1, -1);
+      map[recorded] = glGetUniformLocation(programs[program], name.c_str());
+      break;
+    }
+    case TRACE_UNIFORM_MATRIX4FV: {
+      GLint recorded = r.get<int32_t>();
+      GLsizei count = r.get<uint32_t>();
+      GLboolean transpose = r.get<uint32_t>();
+      GLint location = -1;
+      if (recorded >= 0 && currentProgram < locations.size() &&
+          (size_t)recorded < locations[currentProgram].size())
+        location = locations[currentProgram][recorded];
+      // payload is 4-byte aligned inside the mapping, safe to pass directly
+      glUniformMatrix4fv(location, count, transpose,
+                         (const GLfloat *)r.bytes(count * 16 * sizeof(float)));
+      break;
+    }
+    case TRACE_CLEAR_COLOR: {
+      float c[4];
+      for (float &v : c)
+        v = r.get<float>();
+      glClearColor(c[0], c[1], c[2], c[3]);
+      break;
+    }
+    case TRACE_CLEAR:
+      glClear(r.get<uint32_t>());
+      break;
+    case TRACE_ENABLE:
+      glEnable(r.get<uint32_t>());
+      break;
+    case TRACE_DISABLE:
+      glDisable(r.get<uint32_t>());
+      break;
+    case TRACE_VIEWPORT: {
+      GLint v[4];
+      for (GLint &x : v)
+        x = r.get<int32_t>();
+      glViewport(v[0], v[1], v[2], v[3]);
+      break;
+    }
+    case TRACE_DRAW_ARRAYS: {
+      GLenum mode = r.get<uint32_t>();
+      GLint first = r.get<int32_t>();
+      glDrawArrays(mode, first, r.get<int32_t>());
+      break;
+    }
+    case TRACE_DRAW_ELEMENTS: {
+      GLenum mode = r.get<uint32_t>();
+      GLsizei count = r.get<uint32_t>();
+      GLenum type = r.get<uint32_t>();
+      glDrawElements(mode, count, type, (void *)(uintptr_t)r.get<uint64_t>());
+      break;
+    }
+    case TRACE_DRAW_ELEMENTS_BASE_VERTEX: {
+      GLenum mode = r.get<uint32_t>();
+      GLsizei count = r.get<uint32_t>();
+      GLenum type = r.get<uint32_t>();
+      GLint baseVertex = (GLint)r.get<uint32_t>();
+      glDrawElementsBaseVertex(mode, count, type,
+                               (void *)(uintptr_t)r.get<uint64_t>(),
+                               baseVertex);
+      break;
+    }
+    case TRACE_VERTEX_ATTRIB_4F: {
+      GLuint index = r.get<uint32_t>();
+      float v[4];
+      for (float &x : v)
+        x = r.get<float>();
+      glVertexAttrib4f(index, v[0], v[1], v[2], v[3]);
+      break;
+    }
+    case TRACE_FRAME_END: {
+      if (sync)
+        glFinish();
+      auto now = clock::now();
+      frameMs.push_back(
+          std::chrono::duration<double, std::milli>(now - frameStart).count());
+      frameStart = now;
+      break;
+    }
+    default:
+      std::cerr << "Unknown trace op " << rec.op << ", stopping\n";
+      p = end;
+      break;
+    }
+  }
+  glFinish();
+  double totalMs =
+      std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+  if (!frameMs.empty()) {
+    double sum = 0;
+    for (double ms : frameMs)
+      sum += ms;
+    std::sort(frameMs.begin(), frameMs.end());
+    std::cout << frameMs.size() << " frames in " << totalMs << " ms\n"
+              << "frame ms: avg " << sum / frameMs.size() << ", min "
+              << frameMs.front() << ", p50 " << frameMs[frameMs.size() / 2]
+              << ", p99 " << frameMs[frameMs.size() * 99 / 100] << ", max "
+              << frameMs.back() << "\n";
+  }
+
+  munmap((void *)data, st.st_size);
+  close(fd);
+  glfwTerminate();
+  return 0;
+}
@@ -0,0 +1,437 @@
+#pragma once
+// GL call trace recorder. startGLTrace() swaps the glad function pointers the
+// demos use for thunks that append a compact binary record and then forward to
+// the driver. glReplay.cpp maps the file and re-issues the stream headlessly.
+//
+// File layout: TraceFileHeader, then records of
+//   uint16 op | uint16 reserved | uint32 payload bytes | payload (4-aligned)
+// Buffer/shader payloads are stored inline so the file is self-contained.
+#include "glad/glad.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+const uint32_t TRACE_MAGIC = 0x52544c47; // "GLTR"
+const uint32_t TRACE_VERSION = 1;
+
+struct TraceFileHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+
+struct TraceRecord {
+  uint16_t op;
+  uint16_t reserved;
+  uint32_t size;
+};
+
+enum TraceOp : uint16_t {
+  TRACE_GEN_VERTEX_ARRAYS = 1,
+  TRACE_DELETE_VERTEX_ARRAYS,
+  TRACE_BIND_VERTEX_ARRAY,
+  TRACE_GEN_BUFFERS,
+  TRACE_DELETE_BUFFERS,
+  TRACE_BIND_BUFFER,
+  TRACE_BUFFER_DATA,
+  TRACE_BUFFER_SUB_DATA,
+  TRACE_VERTEX_ATTRIB_POINTER,
+  TRACE_ENABLE_VERTEX_ATTRIB_ARRAY,
+  TRACE_CREATE_SHADER,
+  TRACE_SHADER_SOURCE,
+  TRACE_COMPILE_SHADER,
+  TRACE_DELETE_SHADER,
+  TRACE_CREATE_PROGRAM,
+  TRACE_ATTACH_SHADER,
+  TRACE_LINK_PROGRAM,
+  TRACE_USE_PROGRAM,
+  TRACE_DELETE_PROGRAM,
+  TRACE_GET_UNIFORM_LOCATION,
+  TRACE_UNIFORM_MATRIX4FV,
+  TRACE_CLEAR_COLOR,
+  TRACE_CLEAR,
+  TRACE_ENABLE,
+  TRACE_DISABLE,
+  TRACE_VIEWPORT,
+  TRACE_DRAW_ARRAYS,
+  TRACE_DRAW_ELEMENTS,
+  TRACE_FRAME_END,
+  TRACE_DRAW_ELEMENTS_BASE_VERTEX,
+  TRACE_VERTEX_ATTRIB_4F, // also glVertexAttrib3f, with w = 1
+};
+
+struct TraceWriter {
+  FILE *file = nullptr;
+  std::vector<char> buffer;
+  size_t recordStart = 0;
+  uint32_t frame = 0;
+
+  void begin(TraceOp op) {
+    recordStart = buffer.size();
+    TraceRecord r{op, 0, 0};
+    put(&r, sizeof(r));
+  }
+  void put(const void *data, size_t size) {
+    const char *p = (const char *)data;
+    buffer.insert(buffer.end(), p, p + size);
+  }
+  void u32(uint32_t v) { put(&v, 4); }
+  void i32(int32_t v) { put(&v, 4); }
+  void u64(uint64_t v) { put(&v, 8); }
+  void f32(float v) { put(&v, 4); }
+  void end() {
+    buffer.resize((buffer.size() + 3) & ~(size_t)3, 0);
+    uint32_t size =
+        (uint32_t)(buffer.size() - recordStart - sizeof(TraceRecord));
+    memcpy(buffer.data() + recordStart + offsetof(TraceRecord, size), &size,
+           4);
+    if (buffer.size() >= (1 << 20))
+      flush();
+  }
+  void flush() {
+    if (file && !buffer.empty())
+      fwrite(buffer.data(), 1, buffer.size(), file);
+    buffer.clear();
+  }
+};
+
+inline TraceWriter traceWriter;
+
+// Original driver entry points, captured when tracing starts.
+struct TraceRealGL {
+  PFNGLGENVERTEXARRAYSPROC genVertexArrays;
+  PFNGLDELETEVERTEXARRAYSPROC deleteVertexArrays;
+  PFNGLBINDVERTEXARRAYPROC bindVertexArray;
+  PFNGLGENBUFFERSPROC genBuffers;
+  PFNGLDELETEBUFFERSPROC deleteBuffers;
+  PFNGLBINDBUFFERPROC bindBuffer;
+  PFNGLBUFFERDATAPROC bufferData;
+  PFNGLBUFFERSUBDATAPROC bufferSubData;
+  PFNGLVERTEXATTRIBPOINTERPROC vertexAttribPointer;
+  PFNGLENABLEVERTEXATTRIBARRAYPROC enableVertexAttribArray;
+  PFNGLVERTEXATTRIB3FPROC vertexAttrib3f;
+  PFNGLVERTEXATTRIB4FPROC vertexAttrib4f;
+  PFNGLCREATESHADERPROC createShader;
+  PFNGLSHADERSOURCEPROC shaderSource;
+  PFNGLCOMPILESHADERPROC compileShader;
+  PFNGLDELETESHADERPROC deleteShader;
+  PFNGLCREATEPROGRAMPROC createProgram;
+  PFNGLATTACHSHADERPROC attachShader;
+  PFNGLLINKPROGRAMPROC linkProgram;
+  PFNGLUSEPROGRAMPROC useProgram;
+  PFNGLDELETEPROGRAMPROC deleteProgram;
+  PFNGLGETUNIFORMLOCATIONPROC getUniformLocation;
+  PFNGLUNIFORMMATRIX4FVPROC uniformMatrix4fv;
+  PFNGLCLEARCOLORPROC clearColor;
+  PFNGLCLEARPROC clear;
+  PFNGLENABLEPROC enable;
+  PFNGLDISABLEPROC disable;
+  PFNGLVIEWPORTPROC viewport;
+  PFNGLDRAWARRAYSPROC drawArrays;
+  PFNGLDRAWELEMENTSPROC drawElements;
+  PFNGLDRAWELEMENTSBASEVERTEXPROC drawElementsBaseVertex;
+};
+
+inline TraceRealGL traceReal;
+
+inline void traceNames(TraceOp op, GLsizei n, const GLuint *names) {
+  traceWriter.begin(op);
+  traceWriter.u32(n);
+  traceWriter.put(names, n * sizeof(GLuint));
+  traceWriter.end();
+}
+
+inline void traceU32s(TraceOp op, std::initializer_list<uint32_t> values) {
+  traceWriter.begin(op);
+  for (uint32_t v : values)
+    traceWriter.u32(v);
+  traceWriter.end();
+}
+
+inline void APIENTRY traceGenVertexArrays(GLsizei n, GLuint *arrays) {
+  traceReal.genVertexArrays(n, arrays);
+  traceNames(TRACE_GEN_VERTEX_ARRAYS, n, arrays);
+}
+inline void APIENTRY traceDeleteVertexArrays(GLsizei n, const GLuint *arrays) {
+  traceNames(TRACE_DELETE_VERTEX_ARRAYS, n, arrays);
+  traceReal.deleteVertexArrays(n, arrays);
+}
+inline void APIENTRY traceBindVertexArray(GLuint array) {
+  traceU32s(TRACE_BIND_VERTEX_ARRAY, {array});
+  traceReal.bindVertexArray(array);
+}
+inline void APIENTRY traceGenBuffers(GLsizei n, GLuint *buffers) {
+  traceReal.genBuffers(n, buffers);
+  traceNames(TRACE_GEN_BUFFERS, n, buffers);
+}
+inline void APIENTRY traceDeleteBuffers(GLsizei n, const GLuint *buffers) {
+  traceNames(TRACE_DELETE_BUFFERS, n, buffers);
+  traceReal.deleteBuffers(n, buffers);
+}
+inline void APIENTRY traceBindBuffer(GLenum target, GLuint buffer) {
+  traceU32s(TRACE_BIND_BUFFER, {target, buffer});
+  traceReal.bindBuffer(target, buffer);
+}
+inline void APIENTRY traceBufferData(GLenum target, GLsizeiptr size,
+                                     const void *data, GLenum usage) {
+  traceWriter.begin(TRACE_BUFFER_DATA);
+  traceWriter.u32(target);
+  traceWriter.u32(usage);
+  traceWriter.u64(size);
+  traceWriter.u32(data != nullptr);
+  if (data)
+    traceWriter.put(data, size);
+  traceWriter.end();
+  traceReal.bufferData(target, size, data, usage);
+}
+inline void APIENTRY traceBufferSubData(GLenum target, GLintptr offset,
+                                        GLsizeiptr size, const void *data) {
+  traceWriter.begin(TRACE_BUFFER_SUB_DATA);
+  traceWriter.u32(target);
+  traceWriter.u64(offset);
+  traceWriter.u64(size);
+  traceWriter.put(data, size);
+  traceWriter.end();
+  traceReal.bufferSubData(target, offset, size, data);
+}
+inline void APIENTRY traceVertexAttribPointer(GLuint index, GLint size,
+                                              GLenum type, GLboolean normalized,
+                                              GLsizei stride,
+                                              const void *pointer) {
+  traceWriter.begin(TRACE_VERTEX_ATTRIB_POINTER);
+  traceWriter.u32(index);
+  traceWriter.i32(size);
+  traceWriter.u32(type);
+  traceWriter.u32(normalized);
+  traceWriter.i32(stride);
+  traceWriter.u64((uint64_t)(uintptr_t)pointer); // offset into bound VBO
+  traceWriter.end();
+  traceReal.vertexAttribPointer(index, size, type, normalized, stride,
+                                pointer);
+}
+inline void APIENTRY traceEnableVertexAttribArray(GLuint index) {
+  traceU32s(TRACE_ENABLE_VERTEX_ATTRIB_ARRAY, {index});
+  traceReal.enableVertexAttribArray(index);
+}
+inline void traceVertexAttrib(GLuint index, GLfloat x, GLfloat y, GLfloat z,
+                              GLfloat w) {
+  traceWriter.begin(TRACE_VERTEX_ATTRIB_4F);
+  traceWriter.u32(index);
+  traceWriter.f32(x);
+  traceWriter.f32(y);
+  traceWriter.f32(z);
+  traceWriter.f32(w);
+  traceWriter.end();
+}
+inline void APIENTRY traceVertexAttrib3f(GLuint index, GLfloat x, GLfloat y,
+                                         GLfloat z) {
+  traceVertexAttrib(index, x, y, z, 1.0f);
+  traceReal.vertexAttrib3f(index, x, y, z);
+}
+inline void APIENTRY traceVertexAttrib4f(GLuint index, GLfloat x, GLfloat y,
+                                         GLfloat z, GLfloat w) {
+  traceVertexAttrib(index, x, y, z, w);
+  traceReal.vertexAttrib4f(index, x, y, z, w);
+}
+inline GLuint APIENTRY traceCreateShader(GLenum type) {
+  GLuint shader = traceReal.createShader(type);
+  traceU32s(TRACE_CREATE_SHADER, {type, shader});
+  return shader;
+}
+inline void APIENTRY traceShaderSource(GLuint shader, GLsizei count,
+                                       const GLchar *const *string,
+                                       const GLint *length) {
+  traceWriter.begin(TRACE_SHADER_SOURCE);
+  traceWriter.u32(shader);
+  traceWriter.u32(count);
+  for (GLsizei i = 0; i < count; i++) {
+    uint32_t n = length && length[i] >= 0 ? length[i] : strlen(string[i]);
+    traceWriter.u32(n);
+    traceWriter.put(string[i], n);
+  }
+  traceWriter.end();
+  traceReal.shaderSource(shader, count, string, length);
+}
+inline void APIENTRY traceCompileShader(GLuint shader) {
+  traceU32s(TRACE_COMPILE_SHADER, {shader});
+  traceReal.compileShader(shader);
+}
+inline void APIENTRY traceDeleteShader(GLuint shader) {
+  traceU32s(TRACE_DELETE_SHADER, {shader});
+  traceReal.deleteShader(shader);
+}
+inline GLuint APIENTRY traceCreateProgram() {
+  GLuint program = traceReal.createProgram();
+  traceU32s(TRACE_CREATE_PROGRAM, {program});
+  return program;
+}
+inline void APIENTRY traceAttachShader(GLuint program, GLuint shader) {
+  traceU32s(TRACE_ATTACH_SHADER, {program, shader});
+  traceReal.attachShader(program, shader);
+}
+inline void APIENTRY traceLinkProgram(GLuint program) {
+  traceU32s(TRACE_LINK_PROGRAM, {program});
+  traceReal.linkProgram(program);
+}
+inline void APIENTRY traceUseProgram(GLuint program) {
+  traceU32s(TRACE_USE_PROGRAM, {program});
+  traceReal.useProgram(program);
+}
+inline void APIENTRY traceDeleteProgram(GLuint program) {
+  traceU32s(TRACE_DELETE_PROGRAM, {program});
+  traceReal.deleteProgram(program);
+}
+inline GLint APIENTRY traceGetUniformLocation(GLuint program,
+                                              const GLchar *name) {
+  GLint location = traceReal.getUniformLocation(program, name);
+  uint32_t n = strlen(name);
+  traceWriter.begin(TRACE_GET_UNIFORM_LOCATION);
+  traceWriter.u32(program);
+  traceWriter.i32(location);
+  traceWriter.u32(n);
+  traceWriter.put(name, n);
+  traceWriter.end();
+  return location;
+}
+inline void APIENTRY traceUniformMatrix4fv(GLint location, GLsizei count,
+                                           GLboolean transpose,
+                                           const GLfloat *value) {
+  traceWriter.begin(TRACE_UNIFORM_MATRIX4FV);
+  traceWriter.i32(location);
+  traceWriter.u32(count);
+  traceWriter.u32(transpose);
+  traceWriter.put(value, count * 16 * sizeof(float));
+  traceWriter.end();
+  traceReal.uniformMatrix4fv(location, count, transpose, value);
+}
+inline void APIENTRY traceClearColor(GLfloat r, GLfloat g, GLfloat b,
+                                     GLfloat a) {
+  traceWriter.begin(TRACE_CLEAR_COLOR);
+  traceWriter.f32(r);
+  traceWriter.f32(g);
+  traceWriter.f32(b);
+  traceWriter.f32(a);
+  traceWriter.end();
+  traceReal.clearColor(r, g, b, a);
+}
+inline void APIENTRY traceClear(GLbitfield mask) {
+  traceU32s(TRACE_CLEAR, {mask});
+  traceReal.clear(mask);
+}
+inline void APIENTRY traceEnable(GLenum cap) {
+  traceU32s(TRACE_ENABLE, {cap});
+  traceReal.enable(cap);
+}
+inline void APIENTRY traceDisable(GLenum cap) {
+  traceU32s(TRACE_DISABLE, {cap});
+  traceReal.disable(cap);
+}
+inline void APIENTRY traceViewport(GLint x, GLint y, GLsizei w, GLsizei h) {
+  traceU32s(TRACE_VIEWPORT, {(uint32_t)x, (uint32_t)y, (uint32_t)w,
+                             (uint32_t)h});
+  traceReal.viewport(x, y, w, h);
+}
+inline void APIENTRY traceDrawArrays(GLenum mode, GLint first, GLsizei count) {
+  traceU32s(TRACE_DRAW_ARRAYS, {mode, (uint32_t)first, (uint32_t)count});
+  traceReal.drawArrays(mode, first, count);
+}
+inline void APIENTRY traceDrawElements(GLenum mode, GLsizei count, GLenum type,
+                                       const void *indices) {
+  traceWriter.begin(TRACE_DRAW_ELEMENTS);
+  traceWriter.u32(mode);
+  traceWriter.u32(count);
+  traceWriter.u32(type);
+  traceWriter.u64((uint64_t)(uintptr_t)indices); // offset into bound EBO
+  traceWriter.end();
+  traceReal.drawElements(mode, count, type, indices);
+}
+inline void APIENTRY traceDrawElementsBaseVertex(GLenum mode, GLsizei count,
+                                                 GLenum type,
+                                                 const void *indices,
+                                                 GLint baseVertex) {
+  traceWriter.begin(TRACE_DRAW_ELEMENTS_BASE_VERTEX);
+  traceWriter.u32(mode);
+  traceWriter.u32(count);
+  traceWriter.u32(type);
+  traceWriter.u32((uint32_t)baseVertex);
+  traceWriter.u64((uint64_t)(uintptr_t)indices);
+  traceWriter.end();
+  traceReal.drawElementsBaseVertex(mode, count, type, indices, baseVertex);
+}
+
+#define TRACE_HOOKS(X)                                                         \
+  X(genVertexArrays, glGenVertexArrays, traceGenVertexArrays)                  \
+  X(deleteVertexArrays, glDeleteVertexArrays, traceDeleteVertexArrays)         \
+  X(bindVertexArray, glBindVertexArray, traceBindVertexArray)                  \
+  X(genBuffers, glGenBuffers, traceGenBuffers)                                 \
+  X(deleteBuffers, glDeleteBuffers, traceDeleteBuffers)                        \
+  X(bindBuffer, glBindBuffer, traceBindBuffer)                                 \
+  X(bufferData, glBufferData, traceBufferData)                                 \
+  X(bufferSubData, glBufferSubData, traceBufferSubData)                        \
+  X(vertexAttribPointer, glVertexAttribPointer, traceVertexAttribPointer)      \
+  X(enableVertexAttribArray, glEnableVertexAttribArray,                        \
+    traceEnableVertexAttribArray)                                              \
+  X(vertexAttrib3f, glVertexAttrib3f, traceVertexAttrib3f)                     \
+  X(vertexAttrib4f, glVertexAttrib4f, traceVertexAttrib4f)                     \
+  X(createShader, glCreateShader, traceCreateShader)                           \
+  X(shaderSource, glShaderSource, traceShaderSource)                           \
+  X(compileShader, glCompileShader, traceCompileShader)                        \
+  X(deleteShader, glDeleteShader, traceDeleteShader)                           \
+  X(createProgram, glCreateProgram, traceCreateProgram)                        \
+  X(attachShader, glAttachShader, traceAttachShader)                           \
+  X(linkProgram, glLinkProgram, traceLinkProgram)                              \
+  X(useProgram, glUseProgram, traceUseProgram)                                 \
+  X(deleteProgram, glDeleteProgram, traceDeleteProgram)                        \
+  X(getUniformLocation, glGetUniformLocation, traceGetUniformLocation)         \
+  X(uniformMatrix4fv, glUniformMatrix4fv, traceUniformMatrix4fv)               \
+  X(clearColor, glClearColor, traceClearColor)                                 \
+  X(clear, glClear, traceClear)                                                \
+  X(enable, glEnable, traceEnable)                                             \
+  X(disable, glDisable, traceDisable)                                          \
+  X(viewport, glViewport, traceViewport)                                       \
+  X(drawArrays, glDrawArrays, traceDrawArrays)                                 \
+  X(drawElements, glDrawElements, traceDrawElements)                           \
+  X(drawElementsBaseVertex, glDrawElementsBaseVertex,                          \
+    traceDrawElementsBaseVertex)
+
+// Must be called after gladLoadGLLoader and before the calls to be captured.
+inline bool startGLTrace(const char *path) {
+  traceWriter.file = fopen(path, "wb");
+  if (!traceWriter.file) {
+    fprintf(stderr, "Failed to open trace file %s\n", path);
+    return false;
+  }
+  TraceFileHeader header{TRACE_MAGIC, TRACE_VERSION};
+  traceWriter.put(&header, sizeof(header));
+#define TRACE_HOOK(field, name, thunk)                                         \
+  traceReal.field = glad_##name;                                               \
+  glad_##name = thunk;
+  TRACE_HOOKS(TRACE_HOOK)
+#undef TRACE_HOOK
+  return true;
+}
+
+// Code that would write GL memory through a mapping asks this first, since
+// such writes cannot be recorded.
+inline bool glTraceActive() { return traceWriter.file != nullptr; }
+
+// Marks a frame boundary; call right before glfwSwapBuffers.
+inline void traceFrameEnd() {
+  if (!traceWriter.file)
+    return;
+  traceU32s(TRACE_FRAME_END, {traceWriter.frame++});
+}
+
+inline void stopGLTrace() {
+  if (!traceWriter.file)
+    return;
+#define TRACE_UNHOOK(field, name, thunk) glad_##name = traceReal.field;
+  TRACE_HOOKS(TRACE_UNHOOK)
+#undef TRACE_UNHOOK
+  traceWriter.flush();
+  fclose(traceWriter.file);
+  traceWriter.file = nullptr;
+  fprintf(stderr, "Trace: %u frames recorded\n", traceWriter.frame);
+}
@@ -0,0 +1,595 @@
+#pragma once
+// glTF 2.0 binary (.glb) import. The file is mapped, its JSON chunk parsed
+// with a small recursive-descent parser, and the bufferViews that the scene's
+// triangle primitives use are copied from the mapped BIN chunk straight into
+// one GL buffer, with no intermediate copy in client memory. Vertex attributes
+// and indices point into that buffer with the accessors' own component types,
+// so quantized data (KHR_mesh_quantization) stays quantized on the GPU.
+#include "glad/glad.h"
+#include "mesh.h"
+#include "objLoader.h"
+#include "stagingUpload.h"
+#include <glm/glm.hpp>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+const int JSON_MAX_DEPTH = 64;
+const size_t GLB_VIEW_ALIGN = 16;
+// first3D's attribute locations. Without COLOR_0 the normal goes to its own
+// location and the shader shows it as a color.
+const int GLB_POSITION_LOCATION = 0, GLB_COLOR_LOCATION = 1,
+          GLB_NORMAL_LOCATION = 2;
+
+struct JsonValue {
+  enum Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+  Type type = NUL;
+  double number = 0; // BOOL: 0 or 1
+  std::string string;
+  std::vector<std::string> keys; // OBJECT: one per item
+  std::vector<JsonValue> items;
+
+  const JsonValue *get(const char *key) const {
+    if (type == OBJECT)
+      for (size_t i = 0; i < keys.size(); i++)
+        if (keys[i] == key)
+          return &items[i];
+    return nullptr;
+  }
+  size_t size() const { return type == ARRAY ? items.size() : 0; }
+  const JsonValue *at(double i) const {
+    return i >= 0 && i < size() ? &items[(size_t)i] : nullptr;
+  }
+  double num(const char *key, double fallback) const {
+    const JsonValue *v = get(key);
+    return v && (v->type == NUMBER || v->type == BOOL) ? v->number : fallback;
+  }
+  const char *str(const char *key) const {
+    const JsonValue *v = get(key);
+    return v && v->type == STRING ? v->string.c_str() : "";
+  }
+};
+
+struct JsonParser {
+  const char *p, *end;
+  int depth = 0;
+
+  void skipSpace() {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+      p++;
+  }
+
+  bool literal(const char *word) {
+    size_t n = strlen(word);
+    if ((size_t)(end - p) < n || memcmp(p, word, n) != 0)
+      return false;
+    p += n;
+    return true;
+  }
+
+  static void appendUtf8(std::string &out, unsigned c) {
+    if (c < 0x80) {
+      out += (char)c;
+    } else if (c < 0x800) {
+      out += (char)(0xc0 | c >> 6);
+      out += (char)(0x80 | (c & 0x3f));
+    } else {
+      out += (char)(0xe0 | c >> 12);
+      out += (char)(0x80 | (c >> 6 & 0x3f));
+      out += (char)(0x80 | (c & 0x3f));
+    }
+  }
+
+  bool parseString(std::string &out) {
+    p++; // opening quote
+    while (p < end && *p != '"') {
+      if (*p != '\\') {
+        out += *p++;
+        continue;
+      }
+      if (++p == end)
+        return false;
+      char c = *p++;
+      switch (c) {
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'u': {
+        unsigned code = 0;
+        for (int i = 0; i < 4; i++, p++) {
+          if (p == end || !isxdigit((unsigned char)*p))
+            return false;
+          code = code * 16 + (*p <= '9' ? *p - '0' : (*p | 0x20) - 'a' + 10);
+        }
+        appendUtf8(out, code); // surrogate pairs are kept as two units
+        break;
+      }
+      default: out += c; // '"', '\\' and '/'
+      }
+    }
+    if (p == end)
+      return false;
+    p++;
+    return true;
+  }
+
+  // Integers are read exactly (byte offsets can exceed float precision).
+  bool parseNumber(double &out) {
+    const char *s = p + (*p == '-');
+    uint64_t whole = 0;
+    const char *digits = s;
+    for (; s < end && *s >= '0' && *s <= '9' && s - digits < 19; s++)
+      whole = whole * 10 + (*s - '0');
+    if (s == digits)
+      return false;
+    if (s < end && (*s == '.' || *s == 'e' || *s == 'E' ||
+                    (*s >= '0' && *s <= '9'))) {
+      float value;
+      const char *next = parseObjFloat(p, end, value);
+      if (next == p)
+        return false;
+      out = value;
+      p = next;
+      return true;
+    }
+    out = *p == '-' ? -(double)whole : (double)whole;
+    p = s;
+    return true;
+  }
+
+  bool parse(JsonValue &v) {
+    skipSpace();
+    if (p == end || ++depth > JSON_MAX_DEPTH)
+      return false;
+    bool ok = true;
+    if (*p == '{' || *p == '[') {
+      bool object = *p++ == '{';
+      v.type = object ? JsonValue::OBJECT : JsonValue::ARRAY;
+      skipSpace();
+      if (p < end && *p == (object ? '}' : ']')) {
+        p++;
+      } else {
+        for (;;) {
+          if (object) {
+            skipSpace();
+            std::string key;
+            if (p == end || *p != '"' || !parseString(key))
+              return false;
+            skipSpace();
+            if (p == end || *p++ != ':')
+              return false;
+            v.keys.push_back(std::move(key));
+          }
+          v.items.emplace_back();
+          if (!parse(v.items.back()))
+            return false;
+          skipSpace();
+          if (p == end)
+            return false;
+          char c = *p++;
+          if (c == (object ? '}' : ']'))
+            break;
+          if (c != ',')
+            return false;
+        }
+      }
+    } else if (*p == '"') {
+      v.type = JsonValue::STRING;
+      ok = parseString(v.string);
+    } else if (literal("true")) {
+      v.type = JsonValue::BOOL;
+      v.number = 1;
+    } else if (literal("false")) {
+      v.type = JsonValue::BOOL;
+    } else if (literal("null")) {
+      v.type = JsonValue::NUL;
+    } else {
+      v.type = JsonValue::NUMBER;
+      ok = parseNumber(v.number);
+    }
+    depth--;
+    return ok;
+  }
+};
+
+// One accessor, validated against its bufferView and the BIN chunk.
+struct GlbAccessor {
+  int view = -1;
+  size_t offset = 0; // within the bufferView
+  GLenum componentType = 0;
+  bool normalized = false;
+  int components = 0;
+  size_t count = 0;
+  size_t stride = 0; // bytes between elements
+  const JsonValue *min = nullptr, *max = nullptr;
+};
+
+inline int glbComponentSize(GLenum type) {
+  switch (type) {
+  case GL_BYTE:
+  case GL_UNSIGNED_BYTE: return 1;
+  case GL_SHORT:
+  case GL_UNSIGNED_SHORT: return 2;
+  case GL_UNSIGNED_INT:
+  case GL_FLOAT: return 4;
+  }
+  return 0;
+}
+
+// Maps a stored component to the value the vertex shader sees.
+inline float glbComponentValue(const unsigned char *p, GLenum type,
+                               bool normalized) {
+  switch (type) {
+  case GL_BYTE: {
+    float v = (float)*(const int8_t *)p;
+    return normalized ? std::max(v / 127.0f, -1.0f) : v;
+  }
+  case GL_UNSIGNED_BYTE: return normalized ? *p / 255.0f : *p;
+  case GL_SHORT: {
+    int16_t s;
+    memcpy(&s, p, 2);
+    return normalized ? std::max(s / 32767.0f, -1.0f) : s;
+  }
+  case GL_UNSIGNED_SHORT: {
+    uint16_t s;
+    memcpy(&s, p, 2);
+    return normalized ? s / 65535.0f : s;
+  }
+  case GL_UNSIGNED_INT: {
+    uint32_t u;
+    memcpy(&u, p, 4);
+    return (float)u;
+  }
+  }
+  float f;
+  memcpy(&f, p, 4);
+  return f;
+}
+
+inline bool glbAccessor(const JsonValue &json, size_t binSize, double index,
+                        GlbAccessor &out) {
+  const JsonValue *accessors = json.get("accessors");
+  const JsonValue *a = accessors ? accessors->at(index) : nullptr;
+  const JsonValue *views = json.get("bufferViews");
+  if (!a || !views || a->get("sparse"))
+    return false;
+  const JsonValue *view = views->at(a->num("bufferView", -1));
+  if (!view || view->num("buffer", 0) != 0)
+    return false;
+  static const char *types[] = {"SCALAR", "VEC2", "VEC3", "VEC4"};
+  for (int i = 0; i < 4; i++)
+    if (strcmp(a->str("type"), types[i]) == 0)
+      out.components = i + 1;
+  out.view = (int)a->num("bufferView", -1);
+  out.offset = (size_t)a->num("byteOffset", 0);
+  out.componentType = (GLenum)a->num("componentType", 0);
+  out.normalized = a->num("normalized", 0) != 0;
+  out.count = (size_t)a->num("count", 0);
+  out.min = a->get("min");
+  out.max = a->get("max");
+  int componentSize = glbComponentSize(out.componentType);
+  size_t elementSize = (size_t)componentSize * out.components;
+  out.stride = (size_t)view->num("byteStride", 0);
+  if (!out.stride)
+    out.stride = elementSize;
+  size_t viewOffset = (size_t)view->num("byteOffset", 0);
+  size_t viewLength = (size_t)view->num("byteLength", 0);
+  return elementSize && out.count && out.offset % componentSize == 0 &&
+         viewOffset <= binSize && viewLength <= binSize - viewOffset &&
+         out.offset <= viewLength &&
+         (out.count - 1) * out.stride + elementSize <= viewLength - out.offset;
+}
+
+// Largest value in an index accessor. Its view must lie inside bin, as
+// glbAccessor() checks.
+inline uint32_t glbMaxIndex(const JsonValue &json, const unsigned char *bin,
+                            const GlbAccessor &a) {
+  const JsonValue *view = json.get("bufferViews")->at(a.view);
+  const unsigned char *p = bin + (size_t)view->num("byteOffset", 0) + a.offset;
+  uint32_t maxIndex = 0;
+  for (size_t i = 0; i < a.count; i++, p += a.stride) {
+    uint32_t index = *p;
+    if (a.componentType == GL_UNSIGNED_SHORT) {
+      uint16_t s;
+      memcpy(&s, p, 2);
+      index = s;
+    } else if (a.componentType == GL_UNSIGNED_INT) {
+      memcpy(&index, p, 4);
+    }
+    maxIndex = std::max(maxIndex, index);
+  }
+  return maxIndex;
+}
+
+struct GlbPrimitive {
+  unsigned int vao = 0;
+  int indexCount = 0;
+  GLenum indexType = GL_UNSIGNED_INT;
+  unsigned int firstIndex = 0;  // in indices of indexType
+  glm::mat4 transform;          // the node's world matrix
+  glm::vec3 lo, hi;             // bounds after transform
+  glm::vec3 vertexLo, vertexHi; // bounds before transform
+};
+
+struct GlbScene {
+  unsigned int buffer = 0;
+  std::vector<GlbPrimitive> primitives;
+
+  void bounds(glm::vec3 &lo, glm::vec3 &hi) const {
+    lo = glm::vec3(FLT_MAX);
+    hi = glm::vec3(-FLT_MAX);
+    for (const GlbPrimitive &prim : primitives) {
+      lo = glm::min(lo, prim.lo);
+      hi = glm::max(hi, prim.hi);
+    }
+  }
+
+  void destroy() {
+    for (GlbPrimitive &prim : primitives)
+      glDeleteVertexArrays(1, &prim.vao);
+    primitives.clear();
+    if (buffer)
+      glDeleteBuffers(1, &buffer);
+    buffer = 0;
+  }
+};
+
+inline glm::mat4 glbNodeMatrix(const JsonValue &node) {
+  glm::mat4 m(1.0f);
+  if (const JsonValue *matrix = node.get("matrix")) {
+    for (size_t i = 0; i < 16 && i < matrix->size(); i++)
+      m[i / 4][i % 4] = (float)matrix->items[i].number;
+    return m;
+  }
+  auto vec = [&](const char *key, int i, float fallback) {
+    const JsonValue *v = node.get(key);
+    return v && v->at(i) ? (float)v->items[i].number : fallback;
+  };
+  float x = vec("rotation", 0, 0), y = vec("rotation", 1, 0),
+        z = vec("rotation", 2, 0), w = vec("rotation", 3, 1);
+  glm::vec3 scale(vec("scale", 0, 1), vec("scale", 1, 1), vec("scale", 2, 1));
+  m[0] = glm::vec4(1 - 2 * (y * y + z * z), 2 * (x * y + w * z),
+                   2 * (x * z - w * y), 0) * scale.x;
+  m[1] = glm::vec4(2 * (x * y - w * z), 1 - 2 * (x * x + z * z),
+                   2 * (y * z + w * x), 0) * scale.y;
+  m[2] = glm::vec4(2 * (x * z + w * y), 2 * (y * z - w * x),
+                   1 - 2 * (x * x + y * y), 0) * scale.z;
+  m[3] = glm::vec4(vec("translation", 0, 0), vec("translation", 1, 0),
+                   vec("translation", 2, 0), 1);
+  return m;
+}
+
+// A primitive waiting for its VAO; unused accessors stay empty.
+struct GlbDraw {
+  GlbAccessor position, color, normal, indices;
+  bool hasColor = false, hasNormal = false;
+  glm::mat4 transform;
+};
+
+inline bool loadGLB(const char *path, GlbScene &scene) {
+  auto start = std::chrono::steady_clock::now();
+  MappedFile file;
+  if (!file.open(path))
+    return false;
+  file.advise(MADV_SEQUENTIAL);
+  auto u32 = [&](size_t at) {
+    uint32_t v;
+    memcpy(&v, file.data + at, 4);
+    return v;
+  };
+  // 12-byte header, then chunks of (length, type, data padded to 4)
+  if (file.size < 20 || u32(0) != 0x46546c67 || u32(4) != 2 ||
+      u32(8) < 20 || u32(8) > file.size || u32(16) != 0x4e4f534a ||
+      (size_t)u32(12) > (size_t)u32(8) - 20) {
+    fprintf(stderr, "%s is not a glTF 2.0 binary\n", path);
+    return false;
+  }
+  size_t fileLength = u32(8), jsonLength = u32(12);
+  const char *jsonStart = file.data + 20;
+  const unsigned char *bin = nullptr;
+  size_t binSize = 0, binChunk = 20 + ((jsonLength + 3) & ~(size_t)3);
+  if (binChunk + 8 <= fileLength && u32(binChunk + 4) == 0x004e4942 &&
+      u32(binChunk) <= fileLength - binChunk - 8) {
+    bin = (const unsigned char *)file.data + binChunk + 8;
+    binSize = u32(binChunk);
+  }
+  JsonValue json;
+  JsonParser parser{jsonStart, jsonStart + jsonLength};
+  if (!parser.parse(json) || json.type != JsonValue::OBJECT) {
+    fprintf(stderr, "%s: malformed JSON chunk\n", path);
+    return false;
+  }
+
+  // Walk the default scene (or every root node) for triangle primitives.
+  std::vector<GlbDraw> draws;
+  int skipped = 0;
+  const JsonValue *nodes = json.get("nodes");
+  const JsonValue *meshes = json.get("meshes");
+  auto addMesh = [&](const JsonValue &mesh, const glm::mat4 &transform) {
+    const JsonValue *prims = mesh.get("primitives");
+    for (size_t i = 0; prims && i < prims->size(); i++) {
+      const JsonValue &prim = prims->items[i];
+      const JsonValue *attributes = prim.get("attributes");
+      GlbDraw draw;
+      draw.transform = transform;
+      bool ok = attributes && prim.num("mode", GL_TRIANGLES) == GL_TRIANGLES &&
+                glbAccessor(json, binSize, attributes->num("POSITION", -1),
+                            draw.position) &&
+                draw.position.components == 3 &&
+                glbAccessor(json, binSize, prim.num("indices", -1),
+                            draw.indices) &&
+                draw.indices.components == 1 &&
+                draw.indices.stride ==
+                    (size_t)glbComponentSize(draw.indices.componentType) &&
+                (draw.indices.componentType == GL_UNSIGNED_BYTE ||
+                 draw.indices.componentType == GL_UNSIGNED_SHORT ||
+                 draw.indices.componentType == GL_UNSIGNED_INT);
+      draw.hasColor = ok && glbAccessor(json, binSize,
+                                        attributes->num("COLOR_0", -1),
+                                        draw.color) &&
+                      draw.color.components >= 3;
+      draw.hasNormal = ok && !draw.hasColor &&
+                       glbAccessor(json, binSize,
+                                   attributes->num("NORMAL", -1),
+                                   draw.normal) &&
+                       draw.normal.components == 3;
+      if (!draw.hasColor)
+        draw.color = GlbAccessor();
+      if (!draw.hasNormal)
+        draw.normal = GlbAccessor();
+      for (const GlbAccessor *a : {&draw.position, &draw.color, &draw.normal})
+        if (a->componentType == GL_UNSIGNED_INT)
+          ok = false; // not a valid vertex attribute type in glTF
+      // Out-of-range indices would make the GPU read past the vertex buffer.
+      if (!ok || !bin ||
+          glbMaxIndex(json, bin, draw.indices) >= draw.position.count) {
+        skipped++;
+        continue;
+      }
+      draws.push_back(draw);
+    }
+  };
+  std::vector<char> visited(nodes ? nodes->size() : 0);
+  auto visit = [&](auto &self, double index, const glm::mat4 &parent,
+                   int depth) -> void {
+    const JsonValue *node = nodes ? nodes->at(index) : nullptr;
+    if (!node || depth > JSON_MAX_DEPTH || visited[(size_t)index])
+      return;
+    visited[(size_t)index] = 1; // nodes form a forest; guard against cycles
+    glm::mat4 world = parent * glbNodeMatrix(*node);
+    const JsonValue *mesh = meshes ? meshes->at(node->num("mesh", -1))
+                                    : nullptr;
+    if (mesh)
+      addMesh(*mesh, world);
+    if (const JsonValue *children = node->get("children"))
+      for (const JsonValue &child : children->items)
+        self(self, child.number, world, depth + 1);
+  };
+  const JsonValue *scenes = json.get("scenes");
+  const JsonValue *root = scenes ? scenes->at(json.num("scene", 0)) : nullptr;
+  if (root && root->get("nodes")) {
+    for (const JsonValue &index : root->get("nodes")->items)
+      visit(visit, index.number, glm::mat4(1.0f), 0);
+  } else if (meshes) { // no scene: each mesh once, untransformed
+    for (const JsonValue &mesh : meshes->items)
+      addMesh(mesh, glm::mat4(1.0f));
+  }
+  if (draws.empty()) {
+    fprintf(stderr, "%s has no indexed triangle meshes\n", path);
+    return false;
+  }
+
+  // Pack the used bufferViews into one buffer. The destination offsets are
+  // 16-byte aligned, which keeps every accessor as aligned as in the file.
+  const JsonValue &views = *json.get("bufferViews");
+  std::vector<size_t> viewOffset(views.size(), SIZE_MAX);
+  size_t total = 0;
+  for (GlbDraw &draw : draws)
+    for (GlbAccessor *a :
+         {&draw.position, &draw.color, &draw.normal, &draw.indices})
+      if (a->view >= 0 && viewOffset[a->view] == SIZE_MAX) {
+        viewOffset[a->view] = total;
+        total += (size_t)views.items[a->view].num("byteLength", 0);
+        total = (total + GLB_VIEW_ALIGN - 1) & ~(GLB_VIEW_ALIGN - 1);
+      }
+  glGenBuffers(1, &scene.buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, scene.buffer);
+  StagingUploader uploader;
+  uploader.init();
+  bool staged = uploader.mapped != nullptr;
+  uploader.allocate(total);
+  for (size_t v = 0; v < viewOffset.size(); v++)
+    if (viewOffset[v] != SIZE_MAX)
+      uploader.upload(viewOffset[v],
+                      bin + (size_t)views.items[v].num("byteOffset", 0),
+                      (size_t)views.items[v].num("byteLength", 0));
+  uploader.destroy();
+
+  for (const GlbDraw &draw : draws) {
+    GlbPrimitive prim;
+    glGenVertexArrays(1, &prim.vao);
+    glBindVertexArray(prim.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, scene.buffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene.buffer);
+    auto attribute = [&](int location, const GlbAccessor &a) {
+      glVertexAttribPointer(
+          location, a.components, a.componentType, a.normalized, a.stride,
+          (void *)(uintptr_t)(viewOffset[a.view] + a.offset));
+      glEnableVertexAttribArray(location);
+    };
+    attribute(GLB_POSITION_LOCATION, draw.position);
+    if (draw.hasColor)
+      attribute(GLB_COLOR_LOCATION, draw.color);
+    if (draw.hasNormal)
+      attribute(GLB_NORMAL_LOCATION, draw.normal);
+    prim.indexCount = (int)draw.indices.count;
+    prim.indexType = draw.indices.componentType;
+    prim.firstIndex = (unsigned int)((viewOffset[draw.indices.view] +
+                                      draw.indices.offset) /
+                                     draw.indices.stride);
+    prim.transform = draw.transform;
+
+    // Bounds from the accessor's min/max, or from the data if absent.
+    const GlbAccessor &a = draw.position;
+    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+    if (a.min && a.max && a.min->size() == 3 && a.max->size() == 3) {
+      for (int c = 0; c < 3; c++) {
+        float stored[2] = {(float)a.min->items[c].number,
+                           (float)a.max->items[c].number};
+        for (float s : stored) {
+          unsigned char raw[4];
+          if (a.componentType == GL_FLOAT) {
+            memcpy(raw, &s, 4);
+          } else {
+            int32_t i = (int32_t)s; // min/max hold the stored values
+            memcpy(raw, &i, 4); // little-endian, like the file
+          }
+          float v = glbComponentValue(raw, a.componentType, a.normalized);
+          lo[c] = std::min(lo[c], v);
+          hi[c] = std::max(hi[c], v);
+        }
+      }
+    } else {
+      const unsigned char *p =
+          bin + (size_t)views.items[a.view].num("byteOffset", 0) + a.offset;
+      int size = glbComponentSize(a.componentType);
+      for (size_t i = 0; i < a.count; i++, p += a.stride)
+        for (int c = 0; c < 3; c++) {
+          float v = glbComponentValue(p + c * size, a.componentType,
+                                      a.normalized);
+          lo[c] = std::min(lo[c], v);
+          hi[c] = std::max(hi[c], v);
+        }
+    }
+    prim.vertexLo = lo;
+    prim.vertexHi = hi;
+    prim.lo = glm::vec3(FLT_MAX);
+    prim.hi = glm::vec3(-FLT_MAX);
+    for (int corner = 0; corner < 8; corner++) {
+      glm::vec4 p(corner & 1 ? hi.x : lo.x, corner & 2 ? hi.y : lo.y,
+                  corner & 4 ? hi.z : lo.z, 1.0f);
+      glm::vec3 world(prim.transform * p);
+      prim.lo = glm::min(prim.lo, world);
+      prim.hi = glm::max(prim.hi, world);
+    }
+    scene.primitives.push_back(prim);
+  }
+  glBindVertexArray(0);
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  printf("GLB %s: %zu primitives, %.1f KB uploaded%s in %.1f ms\n", path,
+         scene.primitives.size(), total / 1024.0,
+         staged ? " (staged)" : "", ms);
+  if (skipped)
+    printf("Skipped %d primitives (not indexed triangles, sparse, "
+           "unsupported formats or out-of-range indices)\n",
+           skipped);
+  return true;
+}
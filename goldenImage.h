@@ -0,0 +1,214 @@
+#pragma once
+// Golden-image regression checks. A demo run with --golden <ref.ppm> draws one
+// frame at a fixed time into an offscreen 800x600 target, reads it back and
+// compares it with the reference using a per-pixel tolerance and a windowed
+// SSIM score on luma. On failure a diff image is written next to the
+// reference. --update rewrites the reference instead of comparing.
+#include "glad/glad.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+const int GOLDEN_CHANNEL_TOLERANCE = 24;  // per channel, 0-255
+const double GOLDEN_MAX_BAD_FRACTION = 0.005;
+const double GOLDEN_MIN_SSIM = 0.97;
+const int GOLDEN_SSIM_WINDOW = 8;
+
+struct Image {
+  int width = 0, height = 0;
+  std::vector<unsigned char> rgb; // top-down, tightly packed
+};
+
+inline bool writePPM(const char *path, const Image &image) {
+  FILE *f = fopen(path, "wb");
+  if (!f)
+    return false;
+  fprintf(f, "P6\n%d %d\n255\n", image.width, image.height);
+  fwrite(image.rgb.data(), 1, image.rgb.size(), f);
+  fclose(f);
+  return true;
+}
+
+inline bool readPPM(const char *path, Image &image) {
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  int header[3], n = 0;
+  char magic[3] = {};
+  bool ok = fread(magic, 1, 2, f) == 2 && magic[0] == 'P' && magic[1] == '6';
+  while (ok && n < 3) {
+    int c = fgetc(f);
+    if (c == '#') {
+      while (c != '\n' && c != EOF)
+        c = fgetc(f);
+    } else if (c >= '0' && c <= '9') {
+      ungetc(c, f);
+      ok = fscanf(f, "%d", &header[n++]) == 1;
+    } else if (c == EOF) {
+      ok = false;
+    }
+  }
+  ok = ok && fgetc(f) != EOF && header[2] == 255; // single whitespace byte
+  if (ok) {
+    image.width = header[0];
+    image.height = header[1];
+    image.rgb.resize((size_t)image.width * image.height * 3);
+    ok = fread(image.rgb.data(), 1, image.rgb.size(), f) == image.rgb.size();
+  }
+  fclose(f);
+  return ok;
+}
+
+struct ImageComparison {
+  long badPixels = 0;
+  double badFraction = 0;
+  int maxChannelDiff = 0;
+  double ssim = 1.0;
+  bool passed = false;
+};
+
+// Mean SSIM over non-overlapping windows of Rec. 601 luma.
+inline double lumaSSIM(const Image &a, const Image &b) {
+  auto luma = [](const Image &img, int x, int y) {
+    const unsigned char *p = &img.rgb[((size_t)y * img.width + x) * 3];
+    return 0.299 * p[0] + 0.587 * p[1] + 0.114 * p[2];
+  };
+  const double c1 = (0.01 * 255) * (0.01 * 255);
+  const double c2 = (0.03 * 255) * (0.03 * 255);
+  const int w = GOLDEN_SSIM_WINDOW;
+  double sum = 0;
+  int windows = 0;
+  for (int y0 = 0; y0 + w <= a.height; y0 += w)
+    for (int x0 = 0; x0 + w <= a.width; x0 += w) {
+      double ma = 0, mb = 0, va = 0, vb = 0, cov = 0;
+      for (int y = y0; y < y0 + w; y++)
+        for (int x = x0; x < x0 + w; x++) {
+          double la = luma(a, x, y), lb = luma(b, x, y);
+          ma += la;
+          mb += lb;
+          va += la * la;
+          vb += lb * lb;
+          cov += la * lb;
+        }
+      double n = w * w;
+      ma /= n;
+      mb /= n;
+      va = va / n - ma * ma;
+      vb = vb / n - mb * mb;
+      cov = cov / n - ma * mb;
+      sum += ((2 * ma * mb + c1) * (2 * cov + c2)) /
+             ((ma * ma + mb * mb + c1) * (va + vb + c2));
+      windows++;
+    }
+  return windows ? sum / windows : 1.0;
+}
+
+// Fills diff with the reference dimmed to gray and failing pixels in red.
+inline ImageComparison compareImages(const Image &reference, const Image &test,
+                                     Image &diff) {
+  ImageComparison result;
+  if (reference.width != test.width || reference.height != test.height) {
+    fprintf(stderr, "Golden size mismatch: %dx%d vs %dx%d\n", reference.width,
+            reference.height, test.width, test.height);
+    return result;
+  }
+  diff.width = reference.width;
+  diff.height = reference.height;
+  diff.rgb.resize(reference.rgb.size());
+  size_t pixels = (size_t)reference.width * reference.height;
+  for (size_t i = 0; i < pixels; i++) {
+    const unsigned char *r = &reference.rgb[i * 3], *t = &test.rgb[i * 3];
+    int d = 0;
+    for (int c = 0; c < 3; c++)
+      d = std::max(d, std::abs(r[c] - t[c]));
+    result.maxChannelDiff = std::max(result.maxChannelDiff, d);
+    unsigned char *out = &diff.rgb[i * 3];
+    if (d > GOLDEN_CHANNEL_TOLERANCE) {
+      result.badPixels++;
+      out[0] = 255;
+      out[1] = out[2] = 0;
+    } else {
+      unsigned char g = (unsigned char)((r[0] + r[1] + r[2]) / 9);
+      out[0] = out[1] = out[2] = g;
+    }
+  }
+  result.badFraction = pixels ? (double)result.badPixels / pixels : 0;
+  result.ssim = lumaSSIM(reference, test);
+  result.passed = result.badFraction <= GOLDEN_MAX_BAD_FRACTION &&
+                  result.ssim >= GOLDEN_MIN_SSIM;
+  return result;
+}
+
+// Offscreen color+depth target, so the capture does not depend on the
+// window's size, visibility or pixel ownership.
+struct GoldenCapture {
+  unsigned int fbo = 0, color = 0, depth = 0;
+  int width = 0, height = 0;
+
+  void begin(int w, int h) {
+    width = w;
+    height = h;
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &color);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+    glViewport(0, 0, w, h);
+  }
+
+  // Reads the frame back, then compares (or rewrites) the reference.
+  // Returns the process exit code.
+  int finish(const char *referencePath, bool update) {
+    Image frame;
+    frame.width = width;
+    frame.height = height;
+    std::vector<unsigned char> rows((size_t)width * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+    frame.rgb.resize(rows.size());
+    size_t stride = (size_t)width * 3;
+    for (int y = 0; y < height; y++) // GL rows are bottom-up
+      std::copy(&rows[(height - 1 - y) * stride],
+                &rows[(height - y) * stride], &frame.rgb[y * stride]);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteRenderbuffers(1, &depth);
+
+    if (update) {
+      if (!writePPM(referencePath, frame)) {
+        fprintf(stderr, "Failed to write %s\n", referencePath);
+        return 1;
+      }
+      printf("Golden: wrote %s\n", referencePath);
+      return 0;
+    }
+    Image reference, diff;
+    if (!readPPM(referencePath, reference)) {
+      fprintf(stderr, "Failed to read golden image %s\n", referencePath);
+      return 1;
+    }
+    ImageComparison result = compareImages(reference, frame, diff);
+    printf("Golden %s: %s (bad pixels %ld = %.3f%%, max diff %d, SSIM %.4f)\n",
+           referencePath, result.passed ? "PASS" : "FAIL", result.badPixels,
+           result.badFraction * 100.0, result.maxChannelDiff, result.ssim);
+    if (!result.passed && diff.width) {
+      std::string diffPath = std::string(referencePath) + ".diff.ppm";
+      writePPM(diffPath.c_str(), diff);
+      std::string actualPath = std::string(referencePath) + ".actual.ppm";
+      writePPM(actualPath.c_str(), frame);
+      printf("Golden: diff written to %s\n", diffPath.c_str());
+    }
+    return result.passed ? 0 : 1;
+  }
+};
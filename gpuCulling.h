@@ -0,0 +1,249 @@
+#pragma once
+// GPU-driven meshlet culling (GL 4.3). The meshlet table lives in a shader
+// storage buffer; a compute shader runs the same frustum, normal cone and
+// depth pyramid tests as cullMeshlets() and appends each survivor to an
+// indirect command buffer with an atomic counter. With GL 4.6 the counter is
+// the draw count of glMultiDrawElementsIndirectCount; before that every slot
+// is submitted and the unused ones, zeroed beforehand, draw nothing.
+#include "glad/glad.h"
+#include "commandBuffer.h"
+#include "frustum.h"
+#include "glDebug.h"
+#include "mesh.h"
+#include "occlusion.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <cstdint>
+#include <vector>
+
+const int GPU_CULL_GROUP_SIZE = 64;
+
+inline const char *gpuCullSource = R"(
+#version 430
+layout(local_size_x = 64) in;
+
+struct Meshlet { // std430 mirror of mesh.h's Meshlet
+  uint firstIndex, indexCount;
+  float center[3], radius;
+  float coneApex[3], coneAxis[3], coneCutoff;
+};
+struct DrawCommand {
+  uint count, instanceCount, firstIndex, baseVertex, baseInstance;
+};
+layout(std430, binding = 0) readonly buffer Meshlets { Meshlet meshlets[]; };
+layout(std430, binding = 1) writeonly buffer Draws { DrawCommand draws[]; };
+layout(std430, binding = 2) buffer DrawCount { uint drawCount; };
+
+uniform mat4 mvp;
+uniform vec4 planes[6]; // model space
+uniform vec3 eye;       // model space
+uniform uint first, count, indexBase;
+uniform bool occlusion;
+uniform sampler2D pyramid; // one mip per OcclusionBuffer level
+
+// OcclusionBuffer::boxVisible against the uploaded pyramid.
+bool pyramidVisible(vec3 lo, vec3 hi) {
+  vec2 size = vec2(textureSize(pyramid, 0));
+  vec2 minP = vec2(1e30), maxP = vec2(-1e30);
+  float nearest = 1e30;
+  for (int i = 0; i < 8; i++) {
+    vec4 c = mvp * vec4((i & 1) != 0 ? hi.x : lo.x, (i & 2) != 0 ? hi.y : lo.y,
+                        (i & 4) != 0 ? hi.z : lo.z, 1.0);
+    if (c.z < -c.w || c.w <= 0.0)
+      return true;
+    vec3 p = c.xyz / c.w * 0.5 + 0.5;
+    minP = min(minP, p.xy * size);
+    maxP = max(maxP, p.xy * size);
+    nearest = min(nearest, p.z);
+  }
+  if (any(lessThan(maxP, vec2(0.0))) || any(greaterThanEqual(minP, size)) ||
+      nearest > 1.0)
+    return false;
+  ivec2 p0 = max(ivec2(minP), ivec2(0));
+  ivec2 p1 = min(ivec2(maxP), ivec2(size) - 1);
+  int levels = textureQueryLevels(pyramid), l = 0;
+  while (l + 1 < levels && any(greaterThanEqual((p1 >> l) - (p0 >> l),
+                                                ivec2(4))))
+    l++;
+  ivec2 last = textureSize(pyramid, l) - 1;
+  ivec2 t0 = min(p0 >> l, last), t1 = min(p1 >> l, last);
+  for (int y = t0.y; y <= t1.y; y++)
+    for (int x = t0.x; x <= t1.x; x++)
+      if (nearest <= texelFetch(pyramid, ivec2(x, y), l).r)
+        return true;
+  return false;
+}
+
+void main() {
+  uint i = gl_GlobalInvocationID.x;
+  if (i >= count)
+    return;
+  Meshlet m = meshlets[first + i];
+  vec3 center = vec3(m.center[0], m.center[1], m.center[2]);
+  for (int p = 0; p < 6; p++)
+    if (dot(planes[p].xyz, center) + planes[p].w < -m.radius)
+      return;
+  vec3 view = vec3(m.coneApex[0], m.coneApex[1], m.coneApex[2]) - eye;
+  vec3 axis = vec3(m.coneAxis[0], m.coneAxis[1], m.coneAxis[2]);
+  if (dot(view, axis) >= m.coneCutoff * length(view))
+    return;
+  if (occlusion && !pyramidVisible(center - m.radius, center + m.radius))
+    return;
+  uint slot = atomicAdd(drawCount, 1u);
+  draws[slot] = DrawCommand(m.indexCount, 1u, indexBase + m.firstIndex, 0u,
+                            0u);
+}
+)";
+
+struct GpuMeshletCuller {
+  unsigned int program = 0;
+  unsigned int meshletBuffer = 0, drawBuffer = 0, countBuffer = 0;
+  unsigned int pyramid = 0; // R32F, mip l holds OcclusionBuffer level l
+  int meshletCount = 0;
+  int tested = 0; // meshlets in the last cull()
+  uint32_t indexBase = 0;
+  glm::mat4 space = glm::mat4(1.0f); // meshlet bounds to vertex space
+  int mvpLocation, planesLocation, eyeLocation, firstLocation, countLocation,
+      indexBaseLocation, occlusionLocation;
+
+  // Uploads the table once; false when the shader does not build.
+  bool init(const Meshlet *meshlets, int count, uint32_t base,
+            const glm::mat4 &boundsSpace) {
+    unsigned int shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, 1, &gpuCullSource, NULL);
+    glCompileShader(shader);
+    bool ok = checkShaderCompile(shader, "cull compute");
+    program = glCreateProgram();
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    ok = checkProgramLink(program) && ok;
+    glDeleteShader(shader);
+    if (!ok) {
+      destroy();
+      return false;
+    }
+    mvpLocation = glGetUniformLocation(program, "mvp");
+    planesLocation = glGetUniformLocation(program, "planes");
+    eyeLocation = glGetUniformLocation(program, "eye");
+    firstLocation = glGetUniformLocation(program, "first");
+    countLocation = glGetUniformLocation(program, "count");
+    indexBaseLocation = glGetUniformLocation(program, "indexBase");
+    occlusionLocation = glGetUniformLocation(program, "occlusion");
+
+    meshletCount = count;
+    indexBase = base;
+    space = boundsSpace;
+    glGenBuffers(1, &meshletBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, meshletBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(Meshlet), meshlets,
+                 GL_STATIC_DRAW);
+    glGenBuffers(1, &drawBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER,
+                 count * sizeof(DrawElementsIndirectCommand), nullptr,
+                 GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &countBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t), nullptr,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return true;
+  }
+
+  // depth is a copy of layout.depth, taken where the pyramid was built.
+  void uploadPyramid(const OcclusionBuffer &layout,
+                     const std::vector<float> &depth) {
+    if (!pyramid) {
+      glGenTextures(1, &pyramid);
+      glBindTexture(GL_TEXTURE_2D, pyramid);
+      glTexStorage2D(GL_TEXTURE_2D, layout.levelCount, GL_R32F,
+                     layout.widths[0], layout.heights[0]);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                      GL_NEAREST_MIPMAP_NEAREST);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    glBindTexture(GL_TEXTURE_2D, pyramid);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (int l = 0; l < layout.levelCount; l++)
+      glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, layout.widths[l],
+                      layout.heights[l], GL_RED, GL_FLOAT,
+                      depth.data() + layout.offsets[l]);
+  }
+
+  // Tests meshlets [first, first + count) and leaves the survivors in the
+  // command buffer for draw(). The caller's program stays bound.
+  void cull(int first, int count, const glm::mat4 &model,
+            const glm::mat4 &viewProjection, glm::vec3 eye, bool occlusion) {
+    tested = count;
+    glm::mat4 mvp = viewProjection * model * space;
+    Frustum frustum;
+    frustum.extract(mvp);
+    glm::vec3 localEye =
+        glm::vec3(glm::inverse(model * space) * glm::vec4(eye, 1.0f));
+    GLint previous = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    glUseProgram(program);
+    glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, glm::value_ptr(mvp));
+    glUniform4fv(planesLocation, 6, glm::value_ptr(frustum.planes[0]));
+    glUniform3fv(eyeLocation, 1, glm::value_ptr(localEye));
+    glUniform1ui(firstLocation, (GLuint)first);
+    glUniform1ui(countLocation, (GLuint)count);
+    glUniform1ui(indexBaseLocation, indexBase);
+    glUniform1i(occlusionLocation, occlusion && pyramid);
+    if (occlusion && pyramid) {
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, pyramid);
+    }
+    uint32_t zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER,
+                      GL_UNSIGNED_INT, &zero);
+    if (!GLAD_GL_VERSION_4_6) {
+      glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawBuffer);
+      glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0,
+                           count * sizeof(DrawElementsIndirectCommand),
+                           GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, meshletBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, drawBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, countBuffer);
+    glDispatchCompute((count + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE,
+                      1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    glUseProgram(previous);
+  }
+
+  // Draws what the last cull() kept; count is the range it tested.
+  void draw(int count, GLenum indexType) {
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawBuffer);
+    if (GLAD_GL_VERSION_4_6) {
+      glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+      glMultiDrawElementsIndirectCount(GL_TRIANGLES, indexType, nullptr, 0,
+                                       count, 0);
+      glBindBuffer(GL_PARAMETER_BUFFER, 0);
+    } else {
+      glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, nullptr, count, 0);
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  }
+
+  // Meshlets kept by the last cull(); waits for the GPU, so only for stats.
+  uint32_t lastDrawCount() {
+    uint32_t drawn = 0;
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(drawn), &drawn);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return drawn;
+  }
+
+  void destroy() {
+    if (program)
+      glDeleteProgram(program);
+    unsigned int buffers[] = {meshletBuffer, drawBuffer, countBuffer};
+    glDeleteBuffers(3, buffers);
+    if (pyramid)
+      glDeleteTextures(1, &pyramid);
+    program = meshletBuffer = drawBuffer = countBuffer = pyramid = 0;
+  }
+};
@@ -0,0 +1,234 @@
+#pragma once
+// Typed pools of GL object names. Each live object has a slot with a
+// generation count, and handles carry both, so a handle kept past destroy()
+// resolves to nothing instead of to whatever reuses the slot. Names and
+// metadata are packed densely for iteration. destroy() invalidates a handle
+// at once, but the glDelete* waits for a fence placed after the last frame
+// that could still draw with the name. shutdown() reports every object that
+// was never destroyed.
+#include "glad/glad.h"
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+enum ResourceKind {
+  RESOURCE_BUFFER,
+  RESOURCE_VERTEX_ARRAY,
+  RESOURCE_PROGRAM,
+  RESOURCE_TEXTURE,
+  RESOURCE_KIND_COUNT
+};
+
+inline const char *resourceKindNames[RESOURCE_KIND_COUNT] = {
+    "buffer", "vertex array", "program", "texture"};
+
+template <ResourceKind Kind> struct ResourceHandle {
+  uint32_t index = 0;
+  uint32_t generation = 0; // 0 is the null handle
+  explicit operator bool() const { return generation != 0; }
+};
+
+using BufferHandle = ResourceHandle<RESOURCE_BUFFER>;
+using VertexArrayHandle = ResourceHandle<RESOURCE_VERTEX_ARRAY>;
+using ProgramHandle = ResourceHandle<RESOURCE_PROGRAM>;
+using TextureHandle = ResourceHandle<RESOURCE_TEXTURE>;
+
+struct ResourceInfo {
+  unsigned int name;
+  const char *label; // static string, for the leak report
+  size_t bytes;      // 0 when unknown
+};
+
+const uint32_t RESOURCE_SLOT_FREE = UINT32_MAX;
+
+struct ResourcePool {
+  std::vector<uint32_t> generations; // per slot
+  std::vector<uint32_t> denseOf;     // slot to live entry, if not free
+  std::vector<uint32_t> slotOf;      // live entry to slot
+  std::vector<ResourceInfo> live;
+  std::vector<uint32_t> freeSlots;
+
+  void add(const ResourceInfo &info, uint32_t &index, uint32_t &generation) {
+    if (freeSlots.empty()) {
+      index = (uint32_t)generations.size();
+      generations.push_back(1);
+      denseOf.push_back(RESOURCE_SLOT_FREE);
+    } else {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    }
+    generation = generations[index];
+    denseOf[index] = (uint32_t)live.size();
+    slotOf.push_back(index);
+    live.push_back(info);
+  }
+
+  const ResourceInfo *find(uint32_t index, uint32_t generation) const {
+    if (index >= generations.size() || generations[index] != generation ||
+        denseOf[index] == RESOURCE_SLOT_FREE)
+      return nullptr;
+    return &live[denseOf[index]];
+  }
+
+  // Frees the slot; the last live entry moves into the hole.
+  bool remove(uint32_t index, uint32_t generation, ResourceInfo &info) {
+    if (!find(index, generation))
+      return false;
+    uint32_t entry = denseOf[index];
+    info = live[entry];
+    live[entry] = live.back();
+    slotOf[entry] = slotOf.back();
+    denseOf[slotOf[entry]] = entry;
+    live.pop_back();
+    slotOf.pop_back();
+    denseOf[index] = RESOURCE_SLOT_FREE;
+    if (++generations[index] == 0)
+      generations[index] = 1;
+    freeSlots.push_back(index);
+    return true;
+  }
+};
+
+inline void deleteGLName(ResourceKind kind, unsigned int name) {
+  switch (kind) {
+  case RESOURCE_BUFFER:
+    glDeleteBuffers(1, &name);
+    break;
+  case RESOURCE_VERTEX_ARRAY:
+    glDeleteVertexArrays(1, &name);
+    break;
+  case RESOURCE_PROGRAM:
+    glDeleteProgram(name);
+    break;
+  case RESOURCE_TEXTURE:
+    glDeleteTextures(1, &name);
+    break;
+  default:
+    break;
+  }
+}
+
+// Handles are made and destroyed on the thread that records frames; the GL
+// deletes run in endFrame() and shutdown() on the context thread.
+struct GpuResources {
+  struct Retired {
+    ResourceKind kind;
+    unsigned int name;
+    long frame; // last frame that may still use it
+  };
+  struct Batch {
+    GLsync fence;
+    std::vector<Retired> names;
+  };
+  ResourcePool pools[RESOURCE_KIND_COUNT];
+  std::vector<Retired> retired; // destroyed, not yet fenced
+  std::deque<Batch> fenced;     // oldest first
+  long recordingFrame = 0;
+  std::mutex mutex;
+
+  // Takes ownership of a name made with glGen* or glCreateProgram.
+  template <ResourceKind Kind>
+  ResourceHandle<Kind> add(unsigned int name, const char *label,
+                           size_t bytes = 0) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ResourceHandle<Kind> handle;
+    pools[Kind].add({name, label, bytes}, handle.index, handle.generation);
+    return handle;
+  }
+
+  // 0 for a null or destroyed handle.
+  template <ResourceKind Kind> unsigned int name(ResourceHandle<Kind> handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    const ResourceInfo *info =
+        pools[Kind].find(handle.index, handle.generation);
+    return info ? info->name : 0;
+  }
+
+  // Clears the handle; false if it was already stale.
+  template <ResourceKind Kind> bool destroy(ResourceHandle<Kind> &handle) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ResourceInfo info;
+    bool live = pools[Kind].remove(handle.index, handle.generation, info);
+    if (live)
+      retired.push_back({Kind, info.name, recordingFrame});
+    handle = ResourceHandle<Kind>();
+    return live;
+  }
+
+  // Recording thread: frame about to be recorded.
+  void beginFrame(long index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    recordingFrame = index;
+  }
+
+  // Context thread, after issuing frame index: fences the names that frame
+  // was the last to use, and deletes those whose fences have signalled.
+  void endFrame(long index) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Batch batch = {nullptr, {}};
+    size_t kept = 0;
+    for (const Retired &r : retired) {
+      if (r.frame <= index)
+        batch.names.push_back(r);
+      else
+        retired[kept++] = r;
+    }
+    retired.resize(kept);
+    if (!batch.names.empty()) {
+      batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      fenced.push_back(std::move(batch));
+    }
+    while (!fenced.empty() &&
+           glClientWaitSync(fenced.front().fence, 0, 0) !=
+               GL_TIMEOUT_EXPIRED)
+      releaseOldest();
+  }
+
+  size_t liveCount(ResourceKind kind) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pools[kind].live.size();
+  }
+
+  size_t liveBytes(ResourceKind kind) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (const ResourceInfo &info : pools[kind].live)
+      bytes += info.bytes;
+    return bytes;
+  }
+
+  // Context thread, once nothing draws any more: waits for every deferred
+  // delete, then reports and frees the objects still alive. Returns how
+  // many leaked.
+  int shutdown() {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!fenced.empty()) {
+      glClientWaitSync(fenced.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                       1000000000ull);
+      releaseOldest();
+    }
+    for (const Retired &r : retired)
+      deleteGLName(r.kind, r.name);
+    retired.clear();
+    int leaks = 0;
+    for (int kind = 0; kind < RESOURCE_KIND_COUNT; kind++) {
+      for (const ResourceInfo &info : pools[kind].live) {
+        fprintf(stderr, "Leaked %s %u (%s, %zu bytes)\n",
+                resourceKindNames[kind], info.name, info.label, info.bytes);
+        deleteGLName((ResourceKind)kind, info.name);
+        leaks++;
+      }
+      pools[kind] = ResourcePool();
+    }
+    return leaks;
+  }
+
+  void releaseOldest() {
+    glDeleteSync(fenced.front().fence);
+    for (const Retired &r : fenced.front().names)
+      deleteGLName(r.kind, r.name);
+    fenced.pop_front();
+  }
+};
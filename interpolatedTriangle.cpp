@@ -1,6 +1,12 @@
 // 1. including the libraries
 #include "glad/glad.h"
+#include "glDebug.h"
+#include "softRaster.h"
+#include "goldenImage.h"
+#include "frameRecorder.h"
+#include "perfHud.h"
 #include <GLFW/glfw3.h>
+#include <cstring>
 #include <iostream>
 
 // 2. defining the vertex shader code.
@@ -25,17 +31,61 @@ const char *fragmentShaderSource = R"glsl(
     }
 )glsl";
 
+// 9. vertices defined (at file scope so the --soft path can use them too)
+float vertices[] = {
+    -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, // bottom-left: red
+    0.5f,  -0.5f, 0.0f, 1.0f, 0.0f, // bottom-right: green
+    0.0f,  0.5f,  0.0f, 0.0f, 1.0f  // top-center: blue
+};
+
 // 4. for adjusting the screen the to resized viewport
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
   glViewport(0, 0, width, height);
 }
 
-int main() {
+// --soft <out.ppm>: draw the same triangle on the CPU rasterizer, no GPU
+int renderSoft(const char *path) {
+  WorkerPool workers;
+  SoftRasterizer raster(&workers);
+  raster.resize(800, 600);
+  raster.framebuffer.clear(0.15f, 0.15f, 0.15f, 1.0f);
+  const float identity[16] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
+  raster.draw(vertices, 3, {5, 2, 2}, nullptr, 0, identity);
+  raster.render();
+  if (!raster.framebuffer.writePPM(path)) {
+    std::cerr << "Failed to write " << path << "\n";
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *goldenPath = nullptr;
+  bool updateGolden = false;
+  const char *recordPath = nullptr;
+  bool showHud = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--soft") == 0 && i + 1 < argc)
+      return renderSoft(argv[i + 1]);
+    if (strcmp(argv[i], "--golden") == 0 && i + 1 < argc)
+      goldenPath = argv[++i];
+    else if (strcmp(argv[i], "--update") == 0)
+      updateGolden = true;
+    else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+      recordPath = argv[++i];
+    else if (strcmp(argv[i], "--hud") == 0)
+      showHud = true;
+  }
+
   // 5. glfw initialization and version setup
   glfwInit();
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+  // --golden renders a single frame offscreen, so keep the window hidden
+  if (goldenPath)
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
   // 6. window resulution and name setup
   GLFWwindow *window = glfwCreateWindow(
@@ -54,13 +104,8 @@ int main() {
     std::cerr << "Failed to initialize GLAD\n";
     return -1;
   }
-
-  // 9. vertices defined
-  float vertices[] = {
-      -0.5f, -0.5f, 1.0f, 0.0f, 0.0f, // bottom-left: red
-      0.5f,  -0.5f, 0.0f, 1.0f, 0.0f, // bottom-right: green
-      0.0f,  0.5f,  0.0f, 0.0f, 1.0f  // top-center: blue
-  };
+  // route driver debug output (errors, performance warnings) to stderr
+  installDebugOutput((GLADloadproc)glfwGetProcAddress);
 
   // 10. first vao then then vbo
   unsigned int VAO, VBO;
@@ -82,33 +127,77 @@ int main() {
   unsigned int vertexShader = glCreateShader(GL_VERTEX_SHADER);
   glShaderSource(vertexShader, 1, &vertexShaderSource, nullptr);
   glCompileShader(vertexShader);
+  checkShaderCompile(vertexShader, "vertex");
 
   unsigned int fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
   glShaderSource(fragmentShader, 1, &fragmentShaderSource, nullptr);
   glCompileShader(fragmentShader);
+  checkShaderCompile(fragmentShader, "fragment");
 
   unsigned int shaderProgram = glCreateProgram();
   glAttachShader(shaderProgram, vertexShader);
   glAttachShader(shaderProgram, fragmentShader);
   glLinkProgram(shaderProgram);
+  checkProgramLink(shaderProgram);
 
   glDeleteShader(vertexShader);
   glDeleteShader(fragmentShader);
 
+  GoldenCapture golden;
+  if (goldenPath)
+    golden.begin(800, 600);
+
+  // --record out.y4m|out.yuv|out.png: frames are read back through a PBO ring
+  // and encoded off the render loop
+  FrameReadback readback;
+  FrameRecorder recorder;
+  if (recordPath) {
+    if (!recorder.open(recordPath))
+      return -1;
+    readback.start([&recorder](ReadbackFrame &f) { recorder.encode(f); });
+  }
+  long frame = 0;
+  PerfHud hud;
+  if (showHud && !goldenPath)
+    hud.init();
+
   while (!glfwWindowShouldClose(window)) {
     glClearColor(0.15f, 0.15f, 0.15f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
+    int scene = gpuTimers.begin("scene");
     glUseProgram(shaderProgram);
     glBindVertexArray(VAO);
     glDrawArrays(GL_TRIANGLES, 0, 3);
+    gpuTimers.end(scene);
+    if (goldenPath)
+      break;
+    if (recordPath) {
+      int width, height;
+      glfwGetFramebufferSize(window, &width, &height);
+      readback.capture(frame++, width, height);
+      readback.poll();
+    }
+    if (hud.program) {
+      int width, height;
+      glfwGetFramebufferSize(window, &width, &height);
+      hud.draw(width, height);
+    }
+    gpuTimers.nextFrame();
 
     glfwSwapBuffers(window);
     glfwPollEvents();
+    flushDebugOutput();
   }
 
+  int result = goldenPath ? golden.finish(goldenPath, updateGolden) : 0;
+  readback.stop();
+  recorder.close();
+  hud.destroy();
+  gpuTimers.destroy();
   glDeleteVertexArrays(1, &VAO);
   glDeleteBuffers(1, &VBO);
+  shutdownDebugOutput();
   glfwTerminate();
-  return 0;
+  return result;
 }
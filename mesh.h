@@ -0,0 +1,120 @@
+#pragma once
+// Indexed triangle meshes in first3D's vertex layout (position xyz followed by
+// color rgb), shared by the mesh importers, plus a read-only file mapping.
+#include <algorithm>
+#include <cfloat>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+const int MESH_VERTEX_FLOATS = 6;
+
+// A range of the index buffer drawn at one level of detail.
+struct MeshLod {
+  uint32_t firstIndex, indexCount;
+  float error; // relative to the mesh extent; 0 for the full mesh
+};
+
+// A contiguous range of the index buffer with the bounds the meshlet culling
+// pass tests: a sphere, and a cone around the face normals whose apex lies
+// behind every face. coneCutoff is 1 when the normals spread too far to
+// ever be culled as back-facing.
+struct Meshlet {
+  uint32_t firstIndex, indexCount;
+  float center[3], radius;
+  float coneApex[3], coneAxis[3], coneCutoff;
+};
+
+const float LOD_PIXEL_ERROR = 1.0f;
+
+// The coarsest level whose error stays under LOD_PIXEL_ERROR pixels for a
+// mesh of the given world extent at distance from the eye. pixelsPerUnit is
+// the size in pixels of one world unit at distance 1: projection[1][1] times
+// half the viewport height.
+inline int selectLod(const MeshLod *lods, int count, float extent,
+                     float distance, float pixelsPerUnit) {
+  float scale = extent * pixelsPerUnit / std::max(distance, 1e-3f);
+  int level = 0;
+  for (int i = 1; i < count; i++)
+    if (lods[i].error * scale <= LOD_PIXEL_ERROR)
+      level = i;
+  return level;
+}
+
+struct Mesh {
+  std::vector<float> vertices; // MESH_VERTEX_FLOATS per vertex
+  std::vector<unsigned int> indices;
+  std::vector<MeshLod> lods; // empty: one level covering every index
+  std::vector<Meshlet> meshlets; // sorted by firstIndex; may be empty
+
+  size_t vertexCount() const { return vertices.size() / MESH_VERTEX_FLOATS; }
+
+  void bounds(float lo[3], float hi[3]) const {
+    for (int c = 0; c < 3; c++) {
+      lo[c] = FLT_MAX;
+      hi[c] = -FLT_MAX;
+    }
+    for (size_t i = 0; i < vertices.size(); i += MESH_VERTEX_FLOATS)
+      for (int c = 0; c < 3; c++) {
+        lo[c] = std::min(lo[c], vertices[i + c]);
+        hi[c] = std::max(hi[c], vertices[i + c]);
+      }
+  }
+
+  // Centers the mesh on the origin and scales its largest extent to size.
+  void fit(float size) {
+    float lo[3], hi[3];
+    bounds(lo, hi);
+    float extent = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]});
+    if (!(extent > 0))
+      return;
+    float scale = size / extent;
+    for (size_t i = 0; i < vertices.size(); i += MESH_VERTEX_FLOATS)
+      for (int c = 0; c < 3; c++)
+        vertices[i + c] = (vertices[i + c] - (lo[c] + hi[c]) * 0.5f) * scale;
+  }
+};
+
+// Whole-file read-only mapping; the pages are read in on first touch.
+struct MappedFile {
+  const char *data = nullptr;
+  size_t size = 0;
+
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+      if (fd >= 0)
+        ::close(fd);
+      fprintf(stderr, "Failed to open %s\n", path);
+      return false;
+    }
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps the file referenced
+    if (p == MAP_FAILED) {
+      fprintf(stderr, "Failed to map %s\n", path);
+      return false;
+    }
+    data = (const char *)p;
+    size = st.st_size;
+    return true;
+  }
+
+  void advise(int advice) const {
+    if (data)
+      madvise((void *)data, size, advice);
+  }
+
+  ~MappedFile() {
+    if (data)
+      munmap((void *)data, size);
+  }
+};
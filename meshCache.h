@@ -0,0 +1,308 @@
+#pragma once
+// Binary mesh cache (.mesh), written offline by meshConvert and loaded by
+// first3D --mesh. A fixed header (vertex layout, AABB, LOD table) is followed
+// by the vertex and index blobs, each starting on a 4 KiB boundary, so the
+// runtime maps the file and uploads both blobs with one sequential copy. The
+// meshlet table, kept on the CPU for culling, comes last.
+// Fields are little-endian; readers reject any other version.
+#include "glad/glad.h"
+#include "mesh.h"
+#include "stagingUpload.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+const uint32_t MESH_CACHE_MAGIC = 0x4853454d; // "MESH"
+const uint32_t MESH_CACHE_VERSION = 2; // 2: meshlet table
+const size_t MESH_CACHE_ALIGN = 4096;
+const int MESH_CACHE_MAX_ATTRIBUTES = 4;
+const int MESH_CACHE_MAX_LODS = 8;
+
+// Positions are unsigned normalized shorts spanning the AABB.
+const uint32_t MESH_CACHE_QUANTIZED = 1;
+
+struct MeshCacheAttribute {
+  uint32_t location, components, type, normalized, offset; // GL enums
+};
+
+struct MeshCacheHeader {
+  uint32_t magic, version, headerSize, flags;
+  uint32_t vertexCount, vertexStride, indexCount, indexType;
+  uint32_t attributeCount, lodCount;
+  MeshCacheAttribute attributes[MESH_CACHE_MAX_ATTRIBUTES];
+  MeshLod lods[MESH_CACHE_MAX_LODS];
+  float boundsMin[3], boundsMax[3];
+  uint64_t vertexOffset, vertexBytes, indexOffset, indexBytes;
+  uint64_t meshletOffset;
+  uint32_t meshletCount, meshletSize; // meshletSize: sizeof(Meshlet)
+};
+static_assert(sizeof(MeshCacheHeader) == 288, "cache header layout changed");
+
+inline uint64_t meshCacheAlign(uint64_t offset) {
+  return (offset + MESH_CACHE_ALIGN - 1) & ~(uint64_t)(MESH_CACHE_ALIGN - 1);
+}
+
+// Converts a Mesh to the cache layout: 24-byte float vertices, or with
+// quantize 12-byte ones (unorm16 position, unorm8 color). Indices are 16-bit
+// when every vertex fits.
+inline bool writeMeshCache(const char *path, const Mesh &mesh, bool quantize) {
+  MeshCacheHeader h = {};
+  h.magic = MESH_CACHE_MAGIC;
+  h.version = MESH_CACHE_VERSION;
+  h.headerSize = sizeof(h);
+  h.flags = quantize ? MESH_CACHE_QUANTIZED : 0;
+  h.vertexCount = (uint32_t)mesh.vertexCount();
+  h.indexCount = (uint32_t)mesh.indices.size();
+  h.indexType = h.vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+  mesh.bounds(h.boundsMin, h.boundsMax);
+  h.attributeCount = 2;
+  if (quantize) {
+    h.vertexStride = 12;
+    h.attributes[0] = {0, 3, GL_UNSIGNED_SHORT, 1, 0};
+    h.attributes[1] = {1, 3, GL_UNSIGNED_BYTE, 1, 8};
+  } else {
+    h.vertexStride = MESH_VERTEX_FLOATS * sizeof(float);
+    h.attributes[0] = {0, 3, GL_FLOAT, 0, 0};
+    h.attributes[1] = {1, 3, GL_FLOAT, 0, 3 * sizeof(float)};
+  }
+  h.lodCount = (uint32_t)std::min<size_t>(
+      std::max<size_t>(mesh.lods.size(), 1), MESH_CACHE_MAX_LODS);
+  if (mesh.lods.empty())
+    h.lods[0] = {0, h.indexCount, 0.0f};
+  else
+    std::copy(mesh.lods.begin(), mesh.lods.begin() + h.lodCount, h.lods);
+
+  std::vector<unsigned char> vertices((size_t)h.vertexCount * h.vertexStride);
+  for (size_t i = 0; i < h.vertexCount; i++) {
+    const float *v = &mesh.vertices[i * MESH_VERTEX_FLOATS];
+    unsigned char *out = &vertices[i * h.vertexStride];
+    if (!quantize) {
+      memcpy(out, v, h.vertexStride);
+      continue;
+    }
+    uint16_t q[4] = {0, 0, 0, 0};
+    for (int c = 0; c < 3; c++) {
+      float extent = h.boundsMax[c] - h.boundsMin[c];
+      float t = extent > 0 ? (v[c] - h.boundsMin[c]) / extent : 0.0f;
+      q[c] = (uint16_t)(std::min(std::max(t, 0.0f), 1.0f) * 65535.0f + 0.5f);
+    }
+    memcpy(out, q, 8);
+    for (int c = 0; c < 4; c++) {
+      float t = c < 3 ? std::min(std::max(v[3 + c], 0.0f), 1.0f) : 1.0f;
+      out[8 + c] = (unsigned char)(t * 255.0f + 0.5f);
+    }
+  }
+  std::vector<uint16_t> shortIndices;
+  const void *indexData = mesh.indices.data();
+  size_t indexSize = sizeof(uint32_t);
+  if (h.indexType == GL_UNSIGNED_SHORT) {
+    shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+    indexData = shortIndices.data();
+    indexSize = sizeof(uint16_t);
+  }
+  h.vertexOffset = meshCacheAlign(sizeof(h));
+  h.vertexBytes = vertices.size();
+  h.indexOffset = meshCacheAlign(h.vertexOffset + h.vertexBytes);
+  h.indexBytes = (uint64_t)h.indexCount * indexSize;
+  h.meshletCount = (uint32_t)mesh.meshlets.size();
+  h.meshletSize = sizeof(Meshlet);
+  if (h.meshletCount)
+    h.meshletOffset = meshCacheAlign(h.indexOffset + h.indexBytes);
+
+  FILE *f = fopen(path, "wb");
+  if (!f) {
+    fprintf(stderr, "Failed to open %s\n", path);
+    return false;
+  }
+  static const unsigned char zeros[MESH_CACHE_ALIGN] = {};
+  auto pad = [&](uint64_t to) {
+    long at = ftell(f);
+    return at >= 0 && fwrite(zeros, 1, to - at, f) == to - at;
+  };
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1 && pad(h.vertexOffset) &&
+            fwrite(vertices.data(), 1, h.vertexBytes, f) == h.vertexBytes &&
+            pad(h.indexOffset) &&
+            fwrite(indexData, 1, h.indexBytes, f) == h.indexBytes &&
+            (!h.meshletCount ||
+             (pad(h.meshletOffset) &&
+              fwrite(mesh.meshlets.data(), sizeof(Meshlet), h.meshletCount,
+                     f) == h.meshletCount));
+  ok &= fclose(f) == 0;
+  if (!ok)
+    fprintf(stderr, "Failed to write %s\n", path);
+  return ok;
+}
+
+// A cache uploaded to one GL buffer: vertices at 0, indices after them.
+struct MeshCacheGpu {
+  MeshCacheHeader header;
+  unsigned int vao = 0, buffer = 0;
+  unsigned int firstIndex = 0; // where the index blob starts, in indices
+  glm::mat4 dequantize;        // stored positions to model space
+  std::vector<Meshlet> meshlets; // bounds before dequantize
+  // The coarsest level, compacted, as float positions in vertex space.
+  std::vector<float> occluderPositions;
+  std::vector<unsigned int> occluderIndices;
+
+  void destroy() {
+    if (vao)
+      glDeleteVertexArrays(1, &vao);
+    if (buffer)
+      glDeleteBuffers(1, &buffer);
+    vao = buffer = 0;
+  }
+};
+
+inline bool validMeshCache(const MeshCacheHeader &h, uint64_t fileSize) {
+  size_t indexSize = h.indexType == GL_UNSIGNED_SHORT ? 2
+                     : h.indexType == GL_UNSIGNED_INT ? 4
+                                                      : 0;
+  bool ok = h.magic == MESH_CACHE_MAGIC && h.version == MESH_CACHE_VERSION &&
+            h.headerSize == sizeof(h) && indexSize && h.vertexCount &&
+            h.indexCount && h.indexCount % 3 == 0 &&
+            h.attributeCount >= 1 &&
+            h.attributeCount <= MESH_CACHE_MAX_ATTRIBUTES &&
+            h.lodCount >= 1 && h.lodCount <= MESH_CACHE_MAX_LODS &&
+            h.vertexBytes == (uint64_t)h.vertexCount * h.vertexStride &&
+            h.indexBytes == (uint64_t)h.indexCount * indexSize &&
+            h.vertexOffset % MESH_CACHE_ALIGN == 0 &&
+            h.indexOffset % MESH_CACHE_ALIGN == 0 &&
+            h.vertexOffset >= sizeof(h) &&
+            h.indexOffset >= h.vertexOffset + h.vertexBytes &&
+            h.indexOffset <= fileSize &&
+            h.indexBytes <= fileSize - h.indexOffset &&
+            h.meshletSize == sizeof(Meshlet) &&
+            (!h.meshletCount ||
+             (h.meshletOffset % MESH_CACHE_ALIGN == 0 &&
+              h.meshletOffset >= h.indexOffset + h.indexBytes &&
+              h.meshletOffset <= fileSize &&
+              (uint64_t)h.meshletCount * h.meshletSize <=
+                  fileSize - h.meshletOffset));
+  for (uint32_t i = 0; ok && i < h.attributeCount; i++) {
+    const MeshCacheAttribute &a = h.attributes[i];
+    int size = a.type == GL_FLOAT ? 4 : a.type == GL_UNSIGNED_SHORT ? 2 : 1;
+    ok = a.components >= 1 && a.components <= 4 &&
+         a.offset + a.components * size <= h.vertexStride;
+  }
+  for (uint32_t i = 0; ok && i < h.lodCount; i++)
+    ok = h.lods[i].firstIndex <= h.indexCount &&
+         h.lods[i].indexCount <= h.indexCount - h.lods[i].firstIndex;
+  return ok;
+}
+
+inline bool loadMeshCache(const char *path, MeshCacheGpu &out) {
+  auto start = std::chrono::steady_clock::now();
+  MappedFile file;
+  if (!file.open(path))
+    return false;
+  file.advise(MADV_SEQUENTIAL);
+  MeshCacheHeader &h = out.header;
+  if (file.size >= sizeof(h))
+    memcpy(&h, file.data, sizeof(h));
+  if (file.size < sizeof(h) || !validMeshCache(h, file.size)) {
+    fprintf(stderr, "%s is not a mesh cache (or has another version)\n",
+            path);
+    return false;
+  }
+  // Out-of-range indices would make the GPU read past the vertex buffer.
+  uint32_t maxIndex = 0;
+  const char *indices = file.data + h.indexOffset;
+  if (h.indexType == GL_UNSIGNED_SHORT)
+    for (uint32_t i = 0; i < h.indexCount; i++)
+      maxIndex = std::max<uint32_t>(maxIndex, ((const uint16_t *)indices)[i]);
+  else
+    for (uint32_t i = 0; i < h.indexCount; i++)
+      maxIndex = std::max(maxIndex, ((const uint32_t *)indices)[i]);
+  if (maxIndex >= h.vertexCount) {
+    fprintf(stderr, "%s: index %u out of range\n", path, maxIndex);
+    return false;
+  }
+
+  const Meshlet *meshlets = (const Meshlet *)(file.data + h.meshletOffset);
+  for (uint32_t i = 0; i < h.meshletCount; i++)
+    if (meshlets[i].firstIndex > h.indexCount ||
+        meshlets[i].indexCount > h.indexCount - meshlets[i].firstIndex ||
+        meshlets[i].indexCount % 3 != 0) {
+      fprintf(stderr, "%s: meshlet %u out of range\n", path, i);
+      return false;
+    }
+  out.meshlets.assign(meshlets, meshlets + h.meshletCount);
+
+  // A CPU copy of the coarsest level to rasterize for occlusion culling.
+  const MeshCacheAttribute *position = nullptr;
+  for (uint32_t i = 0; i < h.attributeCount; i++)
+    if (h.attributes[i].location == 0)
+      position = &h.attributes[i];
+  out.occluderPositions.clear();
+  out.occluderIndices.clear();
+  if (position && position->components == 3 &&
+      (position->type == GL_FLOAT || position->type == GL_UNSIGNED_SHORT)) {
+    const MeshLod &lod = h.lods[h.lodCount - 1];
+    std::vector<uint32_t> remap(h.vertexCount, ~0u);
+    for (uint32_t i = lod.firstIndex; i < lod.firstIndex + lod.indexCount;
+         i++) {
+      uint32_t v = h.indexType == GL_UNSIGNED_SHORT
+                       ? ((const uint16_t *)indices)[i]
+                       : ((const uint32_t *)indices)[i];
+      if (remap[v] == ~0u) {
+        remap[v] = (uint32_t)(out.occluderPositions.size() / 3);
+        const char *p = file.data + h.vertexOffset +
+                        (size_t)v * h.vertexStride + position->offset;
+        for (int c = 0; c < 3; c++) {
+          float value;
+          if (position->type == GL_FLOAT) {
+            memcpy(&value, p + c * 4, 4);
+          } else {
+            uint16_t stored;
+            memcpy(&stored, p + c * 2, 2);
+            value = position->normalized ? stored / 65535.0f : stored;
+          }
+          out.occluderPositions.push_back(value);
+        }
+      }
+      out.occluderIndices.push_back(remap[v]);
+    }
+  }
+
+  // Both blobs, and the padding between them, in one copy.
+  uint64_t span = h.indexOffset + h.indexBytes - h.vertexOffset;
+  glGenBuffers(1, &out.buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, out.buffer);
+  StagingUploader uploader;
+  uploader.init();
+  uploader.allocate(span);
+  uploader.upload(0, file.data + h.vertexOffset, span);
+  uploader.destroy();
+
+  glGenVertexArrays(1, &out.vao);
+  glBindVertexArray(out.vao);
+  glBindBuffer(GL_ARRAY_BUFFER, out.buffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, out.buffer);
+  for (uint32_t i = 0; i < h.attributeCount; i++) {
+    const MeshCacheAttribute &a = h.attributes[i];
+    glVertexAttribPointer(a.location, a.components, a.type, a.normalized,
+                          h.vertexStride, (void *)(uintptr_t)a.offset);
+    glEnableVertexAttribArray(a.location);
+  }
+  glBindVertexArray(0);
+  out.firstIndex = (unsigned int)((h.indexOffset - h.vertexOffset) /
+                                  (h.indexBytes / h.indexCount));
+
+  glm::vec3 lo(h.boundsMin[0], h.boundsMin[1], h.boundsMin[2]);
+  glm::vec3 hi(h.boundsMax[0], h.boundsMax[1], h.boundsMax[2]);
+  out.dequantize = glm::mat4(1.0f);
+  if (h.flags & MESH_CACHE_QUANTIZED)
+    out.dequantize = glm::scale(glm::translate(glm::mat4(1.0f), lo), hi - lo);
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  printf("Mesh cache %s: %u vertices, %u triangles, %u LODs, %u meshlets in "
+         "%.1f ms\n",
+         path, h.vertexCount, h.indexCount / 3, h.lodCount, h.meshletCount, ms);
+  return true;
+}
@@ -0,0 +1,412 @@
+#pragma once
+// Offline index and vertex reordering for meshConvert. Triangles are
+// reordered for the post-transform vertex cache with Tom Forsyth's linear-
+// speed algorithm (a scored LRU cache model), then vertices are renumbered in
+// first-use order so fetches walk the vertex buffer forwards. The report uses
+// a FIFO cache like most current hardware. Between the two, an overdraw pass
+// (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced
+// Overdraw") sorts clusters of the cache order so likely occluders come first.
+#include "mesh.h"
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <glm/glm.hpp>
+#include <vector>
+
+const int VCACHE_LRU_SIZE = 32;     // Forsyth's scoring model
+const int VCACHE_MAX_VALENCE = 64;  // larger valences share the last score
+const int VCACHE_FIFO_SIZE = 16;    // for ACMR/ATVR reports
+const float OVERDRAW_THRESHOLD = 1.05f; // ACMR loss allowed for overdraw
+const int OVERDRAW_RESOLUTION = 256;    // per view of the overdraw estimate
+
+struct VertexCacheStats {
+  double acmr; // transformed vertices per triangle; 0.5 is the ideal
+  double atvr; // transformed vertices per used vertex; 1.0 is the ideal
+};
+
+inline VertexCacheStats analyzeVertexCache(const unsigned int *indices,
+                                           size_t indexCount,
+                                           size_t vertexCount,
+                                           int cacheSize = VCACHE_FIFO_SIZE) {
+  // A vertex is cached while fewer than cacheSize misses followed its own.
+  std::vector<uint32_t> insertedAt(vertexCount, 0);
+  std::vector<char> used(vertexCount, 0);
+  uint32_t misses = 0, clock = cacheSize + 1;
+  size_t usedCount = 0;
+  for (size_t i = 0; i < indexCount; i++) {
+    unsigned int v = indices[i];
+    if (clock - insertedAt[v] > (uint32_t)cacheSize) {
+      insertedAt[v] = clock++;
+      misses++;
+    }
+    usedCount += !used[v];
+    used[v] = 1;
+  }
+  VertexCacheStats stats;
+  stats.acmr = indexCount ? misses / (indexCount / 3.0) : 0.0;
+  stats.atvr = usedCount ? (double)misses / usedCount : 0.0;
+  return stats;
+}
+
+// Shaded fragments per covered pixel with depth testing and back faces
+// culled, over orthographic views from the six axes and eight diagonals
+// around the mesh's bounds. Drawing likely occluders first brings it
+// towards 1.
+inline double estimateOverdraw(const unsigned int *indices, size_t indexCount,
+                               const float *vertices, size_t vertexCount) {
+  auto position = [&](unsigned int v) {
+    const float *p = &vertices[(size_t)v * MESH_VERTEX_FLOATS];
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+  glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+  for (size_t v = 0; v < vertexCount; v++) {
+    lo = glm::min(lo, position((unsigned int)v));
+    hi = glm::max(hi, position((unsigned int)v));
+  }
+  glm::vec3 center = (lo + hi) * 0.5f;
+  float radius = glm::length(hi - lo) * 0.5f;
+  if (!indexCount || radius <= 0)
+    return 0.0;
+  const int n = OVERDRAW_RESOLUTION;
+  float scale = n * 0.5f / radius;
+  std::vector<float> depth(n * n);
+  std::vector<glm::vec3> projected(vertexCount);
+  uint64_t shaded = 0, covered = 0;
+  for (int view = 0; view < 14; view++) {
+    glm::vec3 dir(0.0f); // towards the viewer
+    if (view < 6) {
+      dir[view / 2] = view % 2 ? -1.0f : 1.0f;
+    } else {
+      int corner = view - 6;
+      dir = glm::normalize(glm::vec3(corner & 1 ? -1 : 1, corner & 2 ? -1 : 1,
+                                     corner & 4 ? -1 : 1));
+    }
+    glm::vec3 up =
+        fabsf(dir.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+    glm::vec3 right = glm::normalize(glm::cross(up, dir));
+    up = glm::cross(dir, right);
+    for (size_t v = 0; v < vertexCount; v++) {
+      glm::vec3 d = position((unsigned int)v) - center;
+      projected[v] = glm::vec3(glm::dot(d, right) * scale + n * 0.5f,
+                               glm::dot(d, up) * scale + n * 0.5f,
+                               -glm::dot(d, dir));
+    }
+    std::fill(depth.begin(), depth.end(), FLT_MAX);
+    for (size_t i = 0; i + 2 < indexCount; i += 3) {
+      glm::vec3 a = projected[indices[i]], b = projected[indices[i + 1]],
+                c = projected[indices[i + 2]];
+      float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+      if (area <= 0)
+        continue; // back-facing or degenerate
+      int x0 = std::max((int)std::min({a.x, b.x, c.x}), 0);
+      int x1 = std::min((int)std::max({a.x, b.x, c.x}), n - 1);
+      int y0 = std::max((int)std::min({a.y, b.y, c.y}), 0);
+      int y1 = std::min((int)std::max({a.y, b.y, c.y}), n - 1);
+      for (int y = y0; y <= y1; y++)
+        for (int x = x0; x <= x1; x++) {
+          float px = x + 0.5f, py = y + 0.5f;
+          float w0 = (c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x);
+          float w1 = (a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x);
+          float w2 = (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+          if (w0 < 0 || w1 < 0 || w2 < 0)
+            continue;
+          float z = (w0 * a.z + w1 * b.z + w2 * c.z) / area;
+          float &d = depth[y * n + x];
+          if (z < d) {
+            covered += d == FLT_MAX;
+            d = z;
+            shaded++;
+          }
+        }
+    }
+  }
+  return covered ? (double)shaded / covered : 0.0;
+}
+
+// How far each cluster of triangles faces out from the area-weighted
+// centroid of all of them: the distance of its own centroid from that point
+// along its mean normal. clusters holds the first triangle of each cluster,
+// then the end.
+inline std::vector<float> outwardFacingKeys(const unsigned int *indices,
+                                            const std::vector<size_t> &clusters,
+                                            const float *vertices) {
+  auto position = [&](unsigned int v) {
+    const float *p = &vertices[(size_t)v * MESH_VERTEX_FLOATS];
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+  size_t count = clusters.size() - 1;
+  glm::vec3 meshCenter(0.0f);
+  float meshArea = 0.0f;
+  std::vector<glm::vec3> centers(count), normals(count);
+  for (size_t c = 0; c < count; c++) {
+    glm::vec3 center(0.0f), normal(0.0f);
+    float area = 0.0f;
+    for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+      glm::vec3 a = position(indices[t * 3]), b = position(indices[t * 3 + 1]),
+                d = position(indices[t * 3 + 2]);
+      glm::vec3 n = glm::cross(b - a, d - a); // length is twice the area
+      float w = glm::length(n);
+      center += (a + b + d) * (w / 3.0f);
+      normal += n;
+      area += w;
+    }
+    meshCenter += center;
+    meshArea += area;
+    centers[c] = area > 0 ? center / area : position(indices[clusters[c] * 3]);
+    normals[c] = normal;
+  }
+  if (meshArea > 0)
+    meshCenter /= meshArea;
+  std::vector<float> keys(count);
+  for (size_t c = 0; c < count; c++) {
+    float length = glm::length(normals[c]);
+    keys[c] = length > 0 ? glm::dot(centers[c] - meshCenter,
+                                    normals[c] / length)
+                         : 0.0f;
+  }
+  return keys;
+}
+
+// Reorders the triangles of indices[0, indexCount) in place.
+inline void optimizeVertexCache(unsigned int *indices, size_t indexCount,
+                                size_t vertexCount) {
+  size_t triangleCount = indexCount / 3;
+  if (triangleCount < 2)
+    return;
+  float cacheScore[VCACHE_LRU_SIZE], valenceScore[VCACHE_MAX_VALENCE] = {};
+  for (int i = 0; i < VCACHE_LRU_SIZE; i++)
+    cacheScore[i] = i < 3 ? 0.75f // the last triangle's vertices
+                          : powf(1.0f - (i - 3) / (VCACHE_LRU_SIZE - 3.0f),
+                                 1.5f);
+  for (int i = 1; i < VCACHE_MAX_VALENCE; i++)
+    valenceScore[i] = 2.0f / sqrtf((float)i); // finish off lone vertices
+
+  // Live (not yet emitted) triangles of every vertex, as CSR lists.
+  std::vector<uint32_t> live(vertexCount, 0), first(vertexCount + 1, 0);
+  for (size_t i = 0; i < indexCount; i++)
+    live[indices[i]]++;
+  for (size_t v = 0; v < vertexCount; v++)
+    first[v + 1] = first[v] + live[v];
+  std::vector<uint32_t> adjacency(indexCount), fill(first.begin(),
+                                                    first.end() - 1);
+  for (size_t i = 0; i < indexCount; i++)
+    adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+
+  std::vector<int> cachePosition(vertexCount, -1);
+  std::vector<float> vertexScore(vertexCount);
+  auto score = [&](uint32_t v) {
+    if (!live[v])
+      return -1.0f;
+    float s = cachePosition[v] >= 0 ? cacheScore[cachePosition[v]] : 0.0f;
+    return s + valenceScore[std::min<uint32_t>(live[v],
+                                               VCACHE_MAX_VALENCE - 1)];
+  };
+  for (size_t v = 0; v < vertexCount; v++)
+    vertexScore[v] = score((uint32_t)v);
+  auto triangleScore = [&](size_t t) {
+    return vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] +
+           vertexScore[indices[t * 3 + 2]];
+  };
+
+  std::vector<unsigned int> out;
+  out.reserve(indexCount);
+  std::vector<char> emitted(triangleCount, 0);
+  uint32_t cache[VCACHE_LRU_SIZE + 3], next[VCACHE_LRU_SIZE + 3];
+  int cacheCount = 0;
+  size_t scan = 0; // fallback when no cached vertex has live triangles
+  long best = 0;
+  for (size_t t = 1; t < triangleCount; t++)
+    if (triangleScore(t) > triangleScore(best))
+      best = (long)t;
+  while (out.size() < indexCount) {
+    if (best < 0) {
+      while (emitted[scan])
+        scan++;
+      best = (long)scan;
+    }
+    const unsigned int *tri = &indices[best * 3];
+    emitted[best] = 1;
+    int nextCount = 0;
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = tri[k];
+      out.push_back(v);
+      // drop the triangle from the vertex's live list
+      uint32_t *list = &adjacency[first[v]];
+      for (uint32_t j = 0; j < live[v]; j++)
+        if (list[j] == (uint32_t)best) {
+          list[j] = list[--live[v]];
+          break;
+        }
+      bool seen = false;
+      for (int j = 0; j < nextCount; j++)
+        seen |= next[j] == v;
+      if (!seen)
+        next[nextCount++] = v;
+    }
+    for (int j = 0; j < cacheCount; j++) {
+      uint32_t v = cache[j];
+      if (v != tri[0] && v != tri[1] && v != tri[2])
+        next[nextCount++] = v;
+    }
+    // Rescore everything that moved, including vertices pushed out.
+    for (int j = 0; j < nextCount; j++) {
+      cachePosition[next[j]] = j < VCACHE_LRU_SIZE ? j : -1;
+      vertexScore[next[j]] = score(next[j]);
+    }
+    best = -1;
+    float bestScore = -1.0f;
+    for (int j = 0; j < nextCount; j++) {
+      uint32_t v = next[j];
+      for (uint32_t k = 0; k < live[v]; k++) {
+        uint32_t t = adjacency[first[v] + k];
+        float s = triangleScore(t);
+        if (s > bestScore) {
+          bestScore = s;
+          best = (long)t;
+        }
+      }
+    }
+    cacheCount = std::min(nextCount, VCACHE_LRU_SIZE);
+    std::copy(next, next + cacheCount, cache);
+  }
+  std::copy(out.begin(), out.end(), indices);
+}
+
+// Splits a cache-ordered range into clusters and draws them outermost-facing
+// first. Hard boundaries fall where the FIFO cache would miss all three
+// vertices, so moving those clusters costs nothing; each hard cluster is cut
+// further wherever its running ACMR is within threshold times its own, which
+// bounds the cache loss. Clusters are sorted by how far they face out from
+// the mesh centroid. Returns the cluster count.
+inline size_t optimizeOverdraw(unsigned int *indices, size_t indexCount,
+                               const float *vertices, size_t vertexCount,
+                               float threshold) {
+  size_t triangleCount = indexCount / 3;
+  std::vector<uint32_t> insertedAt(vertexCount, 0);
+  uint32_t clock = VCACHE_FIFO_SIZE + 1;
+  auto misses = [&](size_t t) {
+    int n = 0;
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[t * 3 + k];
+      if (clock - insertedAt[v] > (uint32_t)VCACHE_FIFO_SIZE) {
+        insertedAt[v] = clock++;
+        n++;
+      }
+    }
+    return n;
+  };
+  std::vector<size_t> hard;
+  for (size_t t = 0; t < triangleCount; t++)
+    if (misses(t) == 3 || t == 0)
+      hard.push_back(t);
+  hard.push_back(triangleCount);
+
+  std::vector<size_t> clusters; // first triangle of each, then the end
+  for (size_t h = 0; h + 1 < hard.size(); h++) {
+    size_t begin = hard[h], end = hard[h + 1];
+    clock += VCACHE_FIFO_SIZE + 1; // flush
+    size_t total = 0;
+    for (size_t t = begin; t < end; t++)
+      total += misses(t);
+    float limit = (float)total / (end - begin) * threshold;
+    clock += VCACHE_FIFO_SIZE + 1;
+    size_t start = begin, running = 0;
+    clusters.push_back(begin);
+    for (size_t t = begin; t < end; t++) {
+      running += misses(t);
+      if (t + 1 < end && (float)running / (t + 1 - start) <= limit) {
+        clusters.push_back(t + 1);
+        start = t + 1;
+        running = 0;
+        clock += VCACHE_FIFO_SIZE + 1;
+      }
+    }
+  }
+  clusters.push_back(triangleCount);
+
+  struct Cluster {
+    size_t begin, end;
+    float key;
+  };
+  std::vector<float> keys = outwardFacingKeys(indices, clusters, vertices);
+  std::vector<Cluster> sorted(keys.size());
+  for (size_t c = 0; c < sorted.size(); c++)
+    sorted[c] = {clusters[c], clusters[c + 1], keys[c]};
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Cluster &a, const Cluster &b) {
+                     return a.key > b.key;
+                   });
+  std::vector<unsigned int> out;
+  out.reserve(indexCount);
+  for (const Cluster &c : sorted)
+    out.insert(out.end(), indices + c.begin * 3, indices + c.end * 3);
+  std::copy(out.begin(), out.end(), indices);
+  return sorted.size();
+}
+
+// Renumbers vertices in the order the index buffer first uses them and
+// drops unreferenced ones. Returns the new vertex count.
+inline size_t optimizeVertexFetch(Mesh &mesh) {
+  std::vector<uint32_t> remap(mesh.vertexCount(), UINT32_MAX);
+  std::vector<float> vertices;
+  vertices.reserve(mesh.vertices.size());
+  uint32_t count = 0;
+  for (unsigned int &index : mesh.indices) {
+    if (remap[index] == UINT32_MAX) {
+      remap[index] = count++;
+      const float *v = &mesh.vertices[(size_t)index * MESH_VERTEX_FLOATS];
+      vertices.insert(vertices.end(), v, v + MESH_VERTEX_FLOATS);
+    }
+    index = remap[index];
+  }
+  mesh.vertices.swap(vertices);
+  return count;
+}
+
+// Cache and overdraw order per LOD range (each is drawn on its own), then
+// fetch order over the whole index buffer. Prints FIFO statistics before and
+// after. A threshold of 0 skips the overdraw pass.
+inline void optimizeMesh(Mesh &mesh,
+                         float overdrawThreshold = OVERDRAW_THRESHOLD) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<MeshLod> ranges = mesh.lods;
+  if (ranges.empty())
+    ranges.push_back({0, (uint32_t)mesh.indices.size(), 0.0f});
+  VertexCacheStats before = analyzeVertexCache(
+      mesh.indices.data() + ranges[0].firstIndex, ranges[0].indexCount,
+      mesh.vertexCount());
+  for (const MeshLod &lod : ranges)
+    optimizeVertexCache(mesh.indices.data() + lod.firstIndex, lod.indexCount,
+                        mesh.vertexCount());
+  VertexCacheStats cacheOrder = analyzeVertexCache(
+      mesh.indices.data() + ranges[0].firstIndex, ranges[0].indexCount,
+      mesh.vertexCount());
+  size_t clusters = 0;
+  if (overdrawThreshold > 0)
+    for (const MeshLod &lod : ranges)
+      clusters += optimizeOverdraw(mesh.indices.data() + lod.firstIndex,
+                                   lod.indexCount, mesh.vertices.data(),
+                                   mesh.vertexCount(), overdrawThreshold);
+  size_t oldVertexCount = mesh.vertexCount();
+  optimizeVertexFetch(mesh);
+  VertexCacheStats after = analyzeVertexCache(
+      mesh.indices.data() + ranges[0].firstIndex, ranges[0].indexCount,
+      mesh.vertexCount());
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  printf("Vertex cache (FIFO %d): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f "
+         "in %.0f ms\n",
+         VCACHE_FIFO_SIZE, before.acmr, after.acmr, before.atvr, after.atvr,
+         ms);
+  if (clusters)
+    printf("Overdraw order: %zu clusters, ACMR %.3f before clustering "
+           "(threshold %.2f)\n",
+           clusters, cacheOrder.acmr, overdrawThreshold);
+  if (mesh.vertexCount() != oldVertexCount)
+    printf("Dropped %zu unreferenced vertices\n",
+           oldVertexCount - mesh.vertexCount());
+}
@@ -0,0 +1,473 @@
+#pragma once
+// Level-of-detail generation for meshConvert: edge collapse ordered by
+// quadric error metrics (Garland and Heckbert, "Surface Simplification Using
+// Quadric Error Metrics"). A vertex only ever collapses onto a neighbour, so
+// every level indexes the original vertex buffer and the chain is stored as
+// consecutive ranges of one index buffer. Vertices sharing a position but not
+// a color form an attribute seam; a seam vertex may only slide along its seam,
+// together with its twin on the other side, and open borders are kept the
+// same way.
+#include "mesh.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <glm/glm.hpp>
+#include <vector>
+
+const float LOD_REDUCTION = 0.5f;     // triangle ratio between levels
+const float LOD_MAX_ERROR = 0.05f;    // relative to the mesh extent
+const size_t LOD_MIN_TRIANGLES = 64;  // no level is simplified below this
+const float LOD_EDGE_WEIGHT = 10.0f;  // border and seam planes vs. faces
+
+enum SimplifyVertexKind : unsigned char {
+  SIMPLIFY_MANIFOLD, // interior, one color: collapses onto any neighbour
+  SIMPLIFY_BORDER,   // on one open border: slides along it
+  SIMPLIFY_SEAM,     // two colors along one seam: slides along it
+  SIMPLIFY_LOCKED    // corners, seam junctions, non-manifold: stays
+};
+
+// Sum of squared distances to a set of weighted planes.
+struct Quadric {
+  double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+  double b0 = 0, b1 = 0, b2 = 0, c = 0, weight = 0;
+
+  // The plane dot(n, p) + d = 0, with n of unit length.
+  void addPlane(glm::vec3 n, float d, float w) {
+    a00 += w * n.x * n.x;
+    a11 += w * n.y * n.y;
+    a22 += w * n.z * n.z;
+    a01 += w * n.x * n.y;
+    a02 += w * n.x * n.z;
+    a12 += w * n.y * n.z;
+    b0 += w * n.x * d;
+    b1 += w * n.y * d;
+    b2 += w * n.z * d;
+    c += w * d * d;
+    weight += w;
+  }
+
+  void add(const Quadric &q) {
+    a00 += q.a00, a11 += q.a11, a22 += q.a22;
+    a01 += q.a01, a02 += q.a02, a12 += q.a12;
+    b0 += q.b0, b1 += q.b1, b2 += q.b2;
+    c += q.c, weight += q.weight;
+  }
+
+  // Weighted mean squared distance from p to the planes.
+  double error(glm::vec3 p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double e = a00 * x * x + a11 * y * y + a22 * z * z +
+               2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+               2 * (b0 * x + b1 * y + b2 * z) + c;
+    return weight > 0 ? std::max(e, 0.0) / weight : 0.0;
+  }
+};
+
+// remap[v] is the first vertex with v's position.
+inline std::vector<unsigned int> positionRemap(const Mesh &mesh) {
+  size_t vertexCount = mesh.vertexCount(), capacity = 16;
+  while (capacity < vertexCount * 2)
+    capacity *= 2;
+  std::vector<unsigned int> table(capacity, ~0u), remap(vertexCount);
+  const float *v = mesh.vertices.data();
+  for (size_t i = 0; i < vertexCount; i++) {
+    const float *p = &v[i * MESH_VERTEX_FLOATS];
+    uint32_t bits[3];
+    for (int c = 0; c < 3; c++) {
+      float f = p[c] + 0.0f; // -0 hashes as +0
+      memcpy(&bits[c], &f, sizeof(f));
+    }
+    size_t slot = (bits[0] * 73856093u ^ bits[1] * 19349663u ^
+                   bits[2] * 83492791u) & (capacity - 1);
+    for (;; slot = (slot + 1) & (capacity - 1)) {
+      if (table[slot] == ~0u) {
+        table[slot] = (unsigned int)i;
+        remap[i] = (unsigned int)i;
+        break;
+      }
+      const float *q = &v[table[slot] * MESH_VERTEX_FLOATS];
+      if (p[0] == q[0] && p[1] == q[1] && p[2] == q[2]) {
+        remap[i] = table[slot];
+        break;
+      }
+    }
+  }
+  return remap;
+}
+
+// Connectivity of the current triangles, rebuilt before every pass.
+struct SimplifyAdjacency {
+  const std::vector<unsigned int> *indices = nullptr, *remap = nullptr;
+  std::vector<uint32_t> offsets, triangles; // triangles around each vertex
+  std::vector<unsigned int> wedge; // next live vertex at the same position
+  std::vector<unsigned int> openOut, openIn; // across the last open edge
+  std::vector<unsigned char> kind;
+
+  // Whether a triangle around from has the directed edge from -> to.
+  bool hasEdge(unsigned int from, unsigned int to) const {
+    const std::vector<unsigned int> &ix = *indices;
+    for (uint32_t i = offsets[from]; i < offsets[from + 1]; i++) {
+      uint32_t t = triangles[i] * 3;
+      for (int k = 0; k < 3; k++)
+        if (ix[t + k] == from && ix[t + (k + 1) % 3] == to)
+          return true;
+    }
+    return false;
+  }
+
+  // The same, between any vertices at the two positions.
+  bool hasPositionEdge(unsigned int from, unsigned int to) const {
+    const std::vector<unsigned int> &ix = *indices, &rm = *remap;
+    unsigned int w = from;
+    do {
+      for (uint32_t i = offsets[w]; i < offsets[w + 1]; i++) {
+        uint32_t t = triangles[i] * 3;
+        for (int k = 0; k < 3; k++)
+          if (ix[t + k] == w && rm[ix[t + (k + 1) % 3]] == rm[to])
+            return true;
+      }
+      w = wedge[w];
+    } while (w != from);
+    return false;
+  }
+
+  // Calls edge(a, b, seam) for each directed edge without an opposite
+  // twin; seam is set when the twin exists between other colors.
+  template <typename F> void forOpenEdges(F edge) const {
+    const std::vector<unsigned int> &ix = *indices;
+    for (size_t t = 0; t < ix.size(); t += 3)
+      for (int k = 0; k < 3; k++) {
+        unsigned int a = ix[t + k], b = ix[t + (k + 1) % 3];
+        if (!hasEdge(b, a))
+          edge(a, b, hasPositionEdge(b, a));
+      }
+  }
+
+  void build(const std::vector<unsigned int> &ix,
+             const std::vector<unsigned int> &rm) {
+    indices = &ix;
+    remap = &rm;
+    size_t vertexCount = rm.size();
+    offsets.assign(vertexCount + 1, 0);
+    for (unsigned int v : ix)
+      offsets[v + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+      offsets[v + 1] += offsets[v];
+    triangles.resize(ix.size());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < ix.size(); i++)
+      triangles[fill[ix[i]]++] = (uint32_t)(i / 3);
+
+    // Rings of the live vertices at each position.
+    std::vector<unsigned int> head(vertexCount, ~0u);
+    wedge.resize(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+      if (offsets[v] == offsets[v + 1])
+        continue;
+      unsigned int &h = head[rm[v]];
+      if (h == ~0u) {
+        h = (unsigned int)v;
+        wedge[v] = (unsigned int)v;
+      } else {
+        wedge[v] = wedge[h];
+        wedge[h] = (unsigned int)v;
+      }
+    }
+
+    std::vector<unsigned char> outCount(vertexCount, 0),
+        inCount(vertexCount, 0), seams(vertexCount, 0),
+        borders(vertexCount, 0);
+    openOut.assign(vertexCount, ~0u);
+    openIn.assign(vertexCount, ~0u);
+    forOpenEdges([&](unsigned int a, unsigned int b, bool seam) {
+      outCount[a] = (unsigned char)std::min(outCount[a] + 1, 2);
+      inCount[b] = (unsigned char)std::min(inCount[b] + 1, 2);
+      openOut[a] = b;
+      openIn[b] = a;
+      (seam ? seams : borders)[a] = 1;
+      (seam ? seams : borders)[b] = 1;
+    });
+
+    kind.assign(vertexCount, SIMPLIFY_LOCKED);
+    for (size_t v = 0; v < vertexCount; v++) {
+      if (offsets[v] == offsets[v + 1])
+        continue;
+      unsigned int twin = wedge[v];
+      bool chain = outCount[v] == 1 && inCount[v] == 1;
+      if (twin == v) {
+        if (!outCount[v] && !inCount[v])
+          kind[v] = SIMPLIFY_MANIFOLD;
+        else if (chain && !seams[v])
+          kind[v] = SIMPLIFY_BORDER;
+      } else if (wedge[twin] == v && chain && !borders[v] &&
+                 outCount[twin] == 1 && inCount[twin] == 1 &&
+                 !borders[twin]) {
+        kind[v] = SIMPLIFY_SEAM;
+      }
+    }
+  }
+};
+
+// Simplifies the triangles in indices towards targetIndexCount, stopping
+// early before any collapse whose error exceeds maxError (in mesh units).
+// error receives the largest error of the collapses taken.
+inline std::vector<unsigned int>
+simplifyMesh(const Mesh &mesh, const std::vector<unsigned int> &indices,
+             size_t targetIndexCount, float maxError, float &error) {
+  size_t vertexCount = mesh.vertexCount();
+  auto position = [&](unsigned int v) {
+    const float *p = &mesh.vertices[(size_t)v * MESH_VERTEX_FLOATS];
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+  std::vector<unsigned int> remap = positionRemap(mesh);
+  std::vector<unsigned int> result = indices;
+  SimplifyAdjacency adjacency;
+  adjacency.build(result, remap);
+
+  // Quadrics live at each position's first vertex: the area-weighted face
+  // planes, plus planes through every border and seam edge perpendicular to
+  // its face so those edges keep their shape.
+  std::vector<Quadric> quadrics(vertexCount);
+  std::vector<glm::vec3> normals(vertexCount, glm::vec3(0.0f));
+  for (size_t t = 0; t < result.size(); t += 3) {
+    glm::vec3 p0 = position(result[t]), p1 = position(result[t + 1]),
+              p2 = position(result[t + 2]);
+    glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+    float length = glm::length(n);
+    if (!(length > 0))
+      continue;
+    for (int k = 0; k < 3; k++)
+      normals[remap[result[t + k]]] += n;
+    n = n / length;
+    for (int k = 0; k < 3; k++)
+      quadrics[remap[result[t + k]]].addPlane(n, -glm::dot(n, p0),
+                                              length * 0.5f);
+  }
+  adjacency.forOpenEdges([&](unsigned int a, unsigned int b, bool) {
+    // The face normal of the triangle owning a -> b.
+    glm::vec3 normal(0.0f);
+    for (uint32_t i = adjacency.offsets[a]; i < adjacency.offsets[a + 1];
+         i++) {
+      uint32_t t = adjacency.triangles[i] * 3;
+      for (int k = 0; k < 3; k++)
+        if (result[t + k] == a && result[t + (k + 1) % 3] == b)
+          normal = glm::cross(position(result[t + 1]) - position(result[t]),
+                              position(result[t + 2]) - position(result[t]));
+    }
+    glm::vec3 pa = position(a), edge = position(b) - pa;
+    glm::vec3 n = glm::cross(edge, normal);
+    float length = glm::length(n);
+    if (!(length > 0))
+      return;
+    n = n / length;
+    float weight = glm::dot(edge, edge) * LOD_EDGE_WEIGHT;
+    quadrics[remap[a]].addPlane(n, -glm::dot(n, pa), weight);
+    quadrics[remap[b]].addPlane(n, -glm::dot(n, pa), weight);
+  });
+
+  // Seam vertices move with their twin onto the target's matching wedge.
+  auto twinTarget = [&](unsigned int v, unsigned int target) {
+    unsigned int twin = adjacency.wedge[v];
+    for (unsigned int u : {adjacency.openOut[twin], adjacency.openIn[twin]})
+      if (u != ~0u && remap[u] == remap[target])
+        return u;
+    return ~0u;
+  };
+  auto canCollapse = [&](unsigned int v, unsigned int target) {
+    unsigned char from = adjacency.kind[v], to = adjacency.kind[target];
+    if (from == SIMPLIFY_MANIFOLD)
+      return true;
+    if (from == SIMPLIFY_LOCKED || (to != from && to != SIMPLIFY_LOCKED))
+      return false;
+    if (adjacency.openOut[v] != target && adjacency.openIn[v] != target)
+      return false;
+    return from == SIMPLIFY_BORDER || twinTarget(v, target) != ~0u;
+  };
+  // Rejects collapses that would turn a remaining face more than ~75
+  // degrees, or away from the area-weighted normal of everything already
+  // merged into v, so repeated small turns cannot fold the surface either.
+  auto flips = [&](unsigned int v, unsigned int target) {
+    glm::vec3 from = position(v), to = position(target);
+    for (uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1];
+         i++) {
+      uint32_t t = adjacency.triangles[i] * 3;
+      int k = result[t] == v ? 0 : result[t + 1] == v ? 1 : 2;
+      unsigned int b = result[t + (k + 1) % 3], c = result[t + (k + 2) % 3];
+      if (remap[b] == remap[target] || remap[c] == remap[target])
+        continue; // collapses away
+      glm::vec3 pb = position(b), pc = position(c);
+      glm::vec3 before = glm::cross(pb - from, pc - from);
+      glm::vec3 after = glm::cross(pb - to, pc - to);
+      if (glm::dot(before, after) <
+              0.25f * glm::length(before) * glm::length(after) ||
+          glm::dot(after, normals[remap[v]]) <= 0)
+        return true;
+    }
+    return false;
+  };
+
+  // The link condition: the two positions may have no common neighbours
+  // besides the far corners of the triangles on their edge, or the collapse
+  // would pinch the surface into a non-manifold edge.
+  std::vector<unsigned int> around[2];
+  auto pinches = [&](unsigned int v, unsigned int target) {
+    size_t shared = 0;
+    for (int side = 0; side < 2; side++) {
+      unsigned int start = side ? target : v, w = start;
+      around[side].clear();
+      do {
+        for (uint32_t i = adjacency.offsets[w]; i < adjacency.offsets[w + 1];
+             i++) {
+          uint32_t t = adjacency.triangles[i] * 3;
+          bool onEdge = false;
+          for (int k = 0; k < 3; k++) {
+            unsigned int p = remap[result[t + k]];
+            if (p == remap[side ? v : target])
+              onEdge = true;
+            else if (p != remap[start])
+              around[side].push_back(p);
+          }
+          shared += side == 0 && onEdge;
+        }
+        w = adjacency.wedge[w];
+      } while (w != start);
+      std::sort(around[side].begin(), around[side].end());
+      around[side].erase(
+          std::unique(around[side].begin(), around[side].end()),
+          around[side].end());
+    }
+    size_t common = 0;
+    for (unsigned int p : around[0])
+      common += std::binary_search(around[1].begin(), around[1].end(), p);
+    return common > shared;
+  };
+
+  struct Collapse {
+    unsigned int v, target;
+    double error;
+  };
+  std::vector<Collapse> collapses;
+  std::vector<unsigned int> collapseTo(vertexCount);
+  std::vector<char> locked(vertexCount);
+  double limit = (double)maxError * maxError, worst = 0;
+  targetIndexCount -= targetIndexCount % 3;
+  while (result.size() > targetIndexCount) {
+    // The cheapest allowed collapse of every vertex.
+    collapses.clear();
+    std::vector<Collapse> best(vertexCount, {0, ~0u, 0.0});
+    for (size_t t = 0; t < result.size(); t += 3)
+      for (int k = 0; k < 6; k++) {
+        unsigned int v = result[t + k % 3];
+        unsigned int target = result[t + (k + 1 + k / 3) % 3];
+        if (!canCollapse(v, target))
+          continue;
+        double e = quadrics[remap[v]].error(position(target));
+        if (best[v].target == ~0u || e < best[v].error)
+          best[v] = {v, target, e};
+      }
+    for (const Collapse &c : best)
+      if (c.target != ~0u && c.error <= limit)
+        collapses.push_back(c);
+    std::sort(collapses.begin(), collapses.end(),
+              [](const Collapse &a, const Collapse &b) {
+                return a.error < b.error;
+              });
+
+    // Independent collapses in error order, about as many as the target
+    // needs: a collapse removes two triangles inside the mesh.
+    size_t budget = (result.size() - targetIndexCount) / 6 + 1, taken = 0;
+    for (size_t v = 0; v < vertexCount; v++)
+      collapseTo[v] = (unsigned int)v;
+    std::fill(locked.begin(), locked.end(), 0);
+    for (const Collapse &c : collapses) {
+      if (taken >= budget)
+        break;
+      if (locked[remap[c.v]] || locked[remap[c.target]] ||
+          flips(c.v, c.target) || pinches(c.v, c.target))
+        continue;
+      if (adjacency.kind[c.v] == SIMPLIFY_SEAM) {
+        unsigned int twin = adjacency.wedge[c.v];
+        unsigned int twinTo = twinTarget(c.v, c.target);
+        if (flips(twin, twinTo))
+          continue;
+        collapseTo[twin] = twinTo;
+      }
+      collapseTo[c.v] = c.target;
+      quadrics[remap[c.target]].add(quadrics[remap[c.v]]);
+      normals[remap[c.target]] += normals[remap[c.v]];
+      // The flip test assumed the ring around v stays put this pass.
+      for (unsigned int w : {c.v, adjacency.wedge[c.v]})
+        for (uint32_t i = adjacency.offsets[w]; i < adjacency.offsets[w + 1];
+             i++)
+          for (int k = 0; k < 3; k++)
+            locked[remap[result[adjacency.triangles[i] * 3 + k]]] = 1;
+      worst = std::max(worst, c.error);
+      taken++;
+    }
+    // Passes that find almost nothing left to take would only repeat the
+    // full rebuild for a handful of triangles.
+    if (!taken || taken * 64 < budget)
+      break;
+
+    size_t kept = 0;
+    for (size_t t = 0; t < result.size(); t += 3) {
+      unsigned int a = collapseTo[result[t]], b = collapseTo[result[t + 1]],
+                   c = collapseTo[result[t + 2]];
+      if (remap[a] == remap[b] || remap[b] == remap[c] || remap[a] == remap[c])
+        continue;
+      result[kept++] = a;
+      result[kept++] = b;
+      result[kept++] = c;
+    }
+    result.resize(kept);
+    adjacency.build(result, remap);
+  }
+  error = (float)sqrt(worst);
+  return result;
+}
+
+// Appends simplified levels after the full mesh in mesh.indices, each about
+// LOD_REDUCTION of the one before, and records them in mesh.lods. Stops at
+// maxLevels (counting the full mesh), when the relative error would pass
+// maxError, or when a level no longer shrinks.
+inline void buildLodChain(Mesh &mesh, int maxLevels,
+                          float maxError = LOD_MAX_ERROR) {
+  auto start = std::chrono::steady_clock::now();
+  float lo[3], hi[3];
+  mesh.bounds(lo, hi);
+  float extent = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]});
+  mesh.lods.assign(1, {0, (uint32_t)mesh.indices.size(), 0.0f});
+  if (!(extent > 0))
+    return;
+  std::vector<unsigned int> level(mesh.indices);
+  float total = 0.0f;
+  while ((int)mesh.lods.size() < maxLevels &&
+         level.size() / 3 > LOD_MIN_TRIANGLES) {
+    size_t target = std::max<size_t>((size_t)(level.size() * LOD_REDUCTION),
+                                     LOD_MIN_TRIANGLES * 3);
+    float error = 0.0f;
+    std::vector<unsigned int> next = simplifyMesh(
+        mesh, level, target, (maxError - total) * extent, error);
+    // Each level is measured against the previous one, so the sum bounds
+    // the distance from the full mesh.
+    if (next.empty() || next.size() > level.size() * 0.9)
+      break;
+    total += error / extent;
+    mesh.lods.push_back({(uint32_t)mesh.indices.size(),
+                         (uint32_t)next.size(), total});
+    mesh.indices.insert(mesh.indices.end(), next.begin(), next.end());
+    level.swap(next);
+  }
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  for (size_t i = 1; i < mesh.lods.size(); i++)
+    printf("LOD %zu: %u triangles (%.1f%%), error %.3f%% of extent\n", i,
+           mesh.lods[i].indexCount / 3,
+           100.0 * mesh.lods[i].indexCount / mesh.lods[0].indexCount,
+           100.0 * mesh.lods[i].error);
+  printf("Built %zu LODs in %.0f ms\n", mesh.lods.size(), ms);
+}
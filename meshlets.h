@@ -0,0 +1,395 @@
+#pragma once
+// Meshlets: the index buffer regrouped into short contiguous ranges of at
+// most MESHLET_MAX_VERTICES unique vertices and MESHLET_MAX_TRIANGLES
+// triangles, each with a bounding sphere and normal cone. At draw time each
+// sphere is tested against the frustum, each cone against the eye and,
+// given an occlusion buffer, each sphere against its depth pyramid; the
+// survivors become an indirect draw list with neighbouring ranges merged.
+#include "glad/glad.h"
+#include "commandBuffer.h"
+#include "frustum.h"
+#include "mesh.h"
+#include "meshOptimize.h"
+#include "occlusion.h"
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+const int MESHLET_MAX_VERTICES = 64;
+const int MESHLET_MAX_TRIANGLES = 124;
+const float MESHLET_MIN_CONE_DOT = 0.1f; // wider cones are never culled
+
+// Sphere and normal cone for triangles [first, first + count) of indices.
+inline Meshlet meshletBounds(const Mesh &mesh, uint32_t first,
+                             uint32_t count) {
+  auto position = [&](uint32_t i) {
+    const float *p = &mesh.vertices[(size_t)mesh.indices[i] *
+                                    MESH_VERTEX_FLOATS];
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+  Meshlet m = {};
+  m.firstIndex = first;
+  m.indexCount = count;
+  glm::vec3 lo = position(first), hi = lo;
+  for (uint32_t i = first; i < first + count; i++) {
+    lo = glm::min(lo, position(i));
+    hi = glm::max(hi, position(i));
+  }
+  glm::vec3 center = (lo + hi) * 0.5f;
+  float radius = 0.0f;
+  for (uint32_t i = first; i < first + count; i++)
+    radius = std::max(radius, glm::length(position(i) - center));
+  for (int c = 0; c < 3; c++)
+    m.center[c] = center[c];
+  m.radius = radius;
+
+  std::vector<glm::vec3> normals;
+  glm::vec3 sum(0.0f);
+  for (uint32_t i = first; i < first + count; i += 3) {
+    glm::vec3 p0 = position(i);
+    glm::vec3 n = glm::cross(position(i + 1) - p0, position(i + 2) - p0);
+    float length = glm::length(n);
+    if (length > 0) {
+      normals.push_back(n / length);
+      sum += n / length;
+    }
+  }
+  m.coneCutoff = 1.0f;
+  float sumLength = glm::length(sum);
+  if (!(sumLength > 0))
+    return m;
+  glm::vec3 axis = sum / sumLength;
+  float minDot = 1.0f;
+  for (const glm::vec3 &n : normals)
+    minDot = std::min(minDot, glm::dot(n, axis));
+  if (minDot <= MESHLET_MIN_CONE_DOT)
+    return m;
+  // Move the apex back along the axis until it is behind every face: from
+  // there, a direction within 90 degrees minus the cone angle of the axis
+  // sees all the faces from behind.
+  float back = 0.0f;
+  for (uint32_t i = first, t = 0; i < first + count; i += 3) {
+    glm::vec3 p0 = position(i);
+    glm::vec3 n = glm::cross(position(i + 1) - p0, position(i + 2) - p0);
+    if (!(glm::length(n) > 0))
+      continue;
+    const glm::vec3 &unit = normals[t++];
+    back = std::max(back,
+                    glm::dot(center - p0, unit) / glm::dot(axis, unit));
+  }
+  glm::vec3 apex = center - axis * back;
+  for (int c = 0; c < 3; c++) {
+    m.coneApex[c] = apex[c];
+    m.coneAxis[c] = axis[c];
+  }
+  m.coneCutoff = sqrtf(1.0f - minDot * minDot);
+  return m;
+}
+
+// Regroups the triangles of every LOD range (or of all indices) into
+// meshlets and records them in mesh.meshlets. Each meshlet grows over shared
+// vertices from a seed next to the previous one, preferring triangles that
+// add no vertex, then ones close to its centroid and facing its way, so
+// spheres and cones stay tight. Inside a meshlet the triangles are reordered
+// for the vertex cache on its own vertices. Returns the meshlet count.
+inline size_t buildMeshlets(Mesh &mesh) {
+  std::vector<MeshLod> ranges = mesh.lods;
+  if (ranges.empty())
+    ranges.push_back({0, (uint32_t)mesh.indices.size(), 0.0f});
+  std::sort(ranges.begin(), ranges.end(),
+            [](const MeshLod &a, const MeshLod &b) {
+              return a.firstIndex < b.firstIndex;
+            });
+  auto position = [&](unsigned int v) {
+    const float *p = &mesh.vertices[(size_t)v * MESH_VERTEX_FLOATS];
+    return glm::vec3(p[0], p[1], p[2]);
+  };
+  size_t vertexCount = mesh.vertexCount();
+  mesh.meshlets.clear();
+  std::vector<uint32_t> offsets, triangles, inMeshlet(vertexCount, ~0u);
+  std::vector<uint32_t> members, candidates;
+  std::vector<unsigned int> local; // a meshlet's vertices
+  std::vector<unsigned int> regrouped;
+  for (const MeshLod &range : ranges) {
+    const unsigned int *indices = mesh.indices.data() + range.firstIndex;
+    size_t triangleCount = range.indexCount / 3;
+    // Triangles around each vertex, and each triangle's centroid and normal.
+    offsets.assign(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+      offsets[indices[i] + 1]++;
+    for (size_t v = 0; v < vertexCount; v++)
+      offsets[v + 1] += offsets[v];
+    triangles.resize(triangleCount * 3);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < triangleCount * 3; i++)
+      triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+    std::vector<glm::vec3> centroids(triangleCount), normals(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+      glm::vec3 p0 = position(indices[t * 3]);
+      glm::vec3 p1 = position(indices[t * 3 + 1]);
+      glm::vec3 p2 = position(indices[t * 3 + 2]);
+      centroids[t] = (p0 + p1 + p2) / 3.0f;
+      glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+      float length = glm::length(n);
+      normals[t] = length > 0 ? n / length : glm::vec3(0.0f);
+    }
+
+    std::vector<char> used(triangleCount, 0);
+    std::vector<uint32_t> live(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+      live[v] = offsets[v + 1] - offsets[v];
+    regrouped.clear();
+    uint32_t meshletId = 0, seed = ~0u;
+    size_t scan = 0;
+    for (;;) {
+      if (seed == ~0u) {
+        while (scan < triangleCount && used[scan])
+          scan++;
+        if (scan == triangleCount)
+          break;
+        seed = (uint32_t)scan;
+      }
+      members.clear();
+      candidates.clear();
+      int vertices = 0;
+      glm::vec3 centroidSum(0.0f), normalSum(0.0f);
+      uint32_t next = seed;
+      while (next != ~0u) {
+        used[next] = 1;
+        for (int k = 0; k < 3; k++)
+          live[indices[next * 3 + k]]--;
+        members.push_back(next);
+        centroidSum += centroids[next];
+        normalSum += normals[next];
+        for (int k = 0; k < 3; k++) {
+          unsigned int v = indices[next * 3 + k];
+          if (inMeshlet[v] == meshletId)
+            continue;
+          inMeshlet[v] = meshletId;
+          vertices++;
+          for (uint32_t i = offsets[v]; i < offsets[v + 1]; i++)
+            if (!used[triangles[i]])
+              candidates.push_back(triangles[i]);
+        }
+        if (members.size() == (size_t)MESHLET_MAX_TRIANGLES)
+          break;
+        // The best neighbour that still fits.
+        glm::vec3 center = centroidSum / (float)members.size();
+        float normalLength = glm::length(normalSum);
+        glm::vec3 axis =
+            normalLength > 0 ? normalSum / normalLength : glm::vec3(0.0f);
+        next = ~0u;
+        int bestExtra = 4;
+        float bestScore = 0.0f;
+        size_t kept = 0;
+        for (uint32_t t : candidates) {
+          if (used[t])
+            continue;
+          candidates[kept++] = t;
+          int extra = 0;
+          for (int k = 0; k < 3; k++)
+            extra += inMeshlet[indices[t * 3 + k]] != meshletId;
+          if (vertices + extra > MESHLET_MAX_VERTICES || extra > bestExtra)
+            continue;
+          glm::vec3 d = centroids[t] - center;
+          float score = glm::dot(d, d) * (2.0f - glm::dot(normals[t], axis));
+          if (extra < bestExtra || score < bestScore) {
+            next = t;
+            bestExtra = extra;
+            bestScore = score;
+          }
+        }
+        candidates.resize(kept);
+      }
+      // The next meshlet starts beside this one, on the neighbour with the
+      // fewest unused triangles left around it, so growth eats into corners
+      // instead of leaving islands behind to become small meshlets later.
+      seed = ~0u;
+      uint32_t seedLive = ~0u;
+      for (uint32_t t : candidates) {
+        if (used[t])
+          continue;
+        uint32_t l = live[indices[t * 3]] + live[indices[t * 3 + 1]] +
+                     live[indices[t * 3 + 2]];
+        if (l < seedLive || (l == seedLive && t < seed)) {
+          seed = t;
+          seedLive = l;
+        }
+      }
+
+      // Emitted in cache order, on vertices renumbered within the meshlet.
+      std::sort(members.begin(), members.end());
+      uint32_t first = range.firstIndex + (uint32_t)regrouped.size();
+      local.clear();
+      for (uint32_t t : members)
+        for (int k = 0; k < 3; k++) {
+          unsigned int v = indices[t * 3 + k];
+          size_t slot =
+              std::find(local.begin(), local.end(), v) - local.begin();
+          if (slot == local.size())
+            local.push_back(v);
+          regrouped.push_back((unsigned int)slot);
+        }
+      optimizeVertexCache(&regrouped[first - range.firstIndex],
+                          members.size() * 3, local.size());
+      for (size_t i = first - range.firstIndex; i < regrouped.size(); i++)
+        regrouped[i] = local[regrouped[i]];
+      mesh.meshlets.push_back(
+          {first, (uint32_t)members.size() * 3, {}, 0.0f, {}, {}, 1.0f});
+      meshletId++;
+    }
+    std::copy(regrouped.begin(), regrouped.end(),
+              mesh.indices.begin() + range.firstIndex);
+    std::fill(inMeshlet.begin(), inMeshlet.end(), ~0u);
+  }
+  for (Meshlet &m : mesh.meshlets)
+    m = meshletBounds(mesh, m.firstIndex, m.indexCount);
+  return mesh.meshlets.size();
+}
+
+// Sorts the meshlets of every LOD range outermost-facing first, by the key
+// optimizeOverdraw() sorts its clusters with; buildMeshlets() regroups
+// triangles by adjacency and would otherwise undo that order. Whole meshlets
+// move, so each keeps its cache order and bounds. Returns how many moved.
+inline size_t orderMeshletsForOverdraw(Mesh &mesh) {
+  std::vector<MeshLod> ranges = mesh.lods;
+  if (ranges.empty())
+    ranges.push_back({0, (uint32_t)mesh.indices.size(), 0.0f});
+  size_t moved = 0;
+  std::vector<size_t> clusters, order;
+  std::vector<unsigned int> sortedIndices;
+  for (const MeshLod &range : ranges) {
+    auto inRange = [&](const Meshlet &m) {
+      return m.firstIndex >= range.firstIndex &&
+             m.firstIndex < range.firstIndex + range.indexCount;
+    };
+    Meshlet *first = std::find_if(mesh.meshlets.data(),
+                                  mesh.meshlets.data() + mesh.meshlets.size(),
+                                  inRange);
+    Meshlet *last = first;
+    while (last < mesh.meshlets.data() + mesh.meshlets.size() &&
+           inRange(*last))
+      last++;
+    size_t count = last - first;
+    if (count < 2)
+      continue;
+    unsigned int *indices = mesh.indices.data() + range.firstIndex;
+    clusters.clear();
+    for (Meshlet *m = first; m < last; m++)
+      clusters.push_back((m->firstIndex - range.firstIndex) / 3);
+    clusters.push_back(range.indexCount / 3);
+    std::vector<float> keys =
+        outwardFacingKeys(indices, clusters, mesh.vertices.data());
+    order.resize(count);
+    for (size_t i = 0; i < count; i++)
+      order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+    sortedIndices.clear();
+    std::vector<Meshlet> sorted(count);
+    for (size_t i = 0; i < count; i++) {
+      Meshlet m = first[order[i]];
+      moved += order[i] != i;
+      m.firstIndex = range.firstIndex + (uint32_t)sortedIndices.size();
+      sortedIndices.insert(sortedIndices.end(),
+                           indices + clusters[order[i]] * 3,
+                           indices + clusters[order[i] + 1] * 3);
+      sorted[i] = m;
+    }
+    std::copy(sortedIndices.begin(), sortedIndices.end(), indices);
+    std::copy(sorted.begin(), sorted.end(), first);
+  }
+  return moved;
+}
+
+struct MeshletCullStats {
+  long tested = 0, outside = 0, backFacing = 0, occluded = 0;
+};
+
+// Appends the meshlets that survive to draws, offsetting their ranges by
+// indexBase. model maps meshlet bounds to world space, eye is in world space.
+// draws is a vector of DrawElementsIndirectCommand with any allocator.
+template <class Draws>
+inline void cullMeshlets(const Meshlet *meshlets, size_t count,
+                         const glm::mat4 &model,
+                         const glm::mat4 &viewProjection, glm::vec3 eye,
+                         uint32_t indexBase, Draws &draws,
+                         MeshletCullStats &stats,
+                         const OcclusionBuffer *occlusion = nullptr) {
+  // The frustum and cone tests run in model space, which needs the model's
+  // scale uniform.
+  glm::mat4 mvp = viewProjection * model;
+  Frustum frustum;
+  frustum.extract(mvp);
+  glm::vec3 localEye = glm::vec3(glm::inverse(model) * glm::vec4(eye, 1.0f));
+  size_t start = draws.size();
+  for (size_t i = 0; i < count; i++) {
+    const Meshlet &m = meshlets[i];
+    stats.tested++;
+    glm::vec3 center(m.center[0], m.center[1], m.center[2]);
+    if (!frustum.sphereVisible(center, m.radius)) {
+      stats.outside++;
+      continue;
+    }
+    glm::vec3 view = glm::vec3(m.coneApex[0], m.coneApex[1], m.coneApex[2]) -
+                     localEye;
+    glm::vec3 axis(m.coneAxis[0], m.coneAxis[1], m.coneAxis[2]);
+    if (glm::dot(view, axis) >= m.coneCutoff * glm::length(view)) {
+      stats.backFacing++;
+      continue;
+    }
+    if (occlusion && !occlusion->sphereVisible(center, m.radius, mvp)) {
+      stats.occluded++;
+      continue;
+    }
+    uint32_t first = indexBase + m.firstIndex;
+    if (draws.size() > start &&
+        draws.back().firstIndex + draws.back().count == first)
+      draws.back().count += m.indexCount;
+    else
+      draws.push_back({m.indexCount, 1, first, 0, 0});
+  }
+}
+
+// Submits a draw list for the bound VAO: one glMultiDrawElementsIndirect
+// from a streamed buffer on GL 4.3, or glMultiDrawElements from the same
+// list on the 3.3 context first3D asks for.
+struct IndirectDrawer {
+  unsigned int buffer = 0;
+  std::vector<GLsizei> counts;
+  std::vector<const void *> offsets;
+
+  void draw(const DrawElementsIndirectCommand *draws, size_t count,
+            GLenum indexType) {
+    if (!count)
+      return;
+    if (GLAD_GL_VERSION_4_3) {
+      if (!buffer)
+        glGenBuffers(1, &buffer);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+      glBufferData(GL_DRAW_INDIRECT_BUFFER, count * sizeof(*draws), draws,
+                   GL_STREAM_DRAW);
+      glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, nullptr,
+                                  (GLsizei)count, 0);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+      return;
+    }
+    counts.resize(count);
+    offsets.resize(count);
+    for (size_t i = 0; i < count; i++) {
+      counts[i] = (GLsizei)draws[i].count;
+      offsets[i] = (const void *)(uintptr_t)(draws[i].firstIndex *
+                                             indexTypeSize(indexType));
+    }
+    glMultiDrawElements(GL_TRIANGLES, counts.data(), indexType, offsets.data(),
+                        (GLsizei)count);
+  }
+
+  void destroy() {
+    if (buffer)
+      glDeleteBuffers(1, &buffer);
+    buffer = 0;
+  }
+};
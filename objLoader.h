@@ -0,0 +1,385 @@
+#pragma once
+// Wavefront OBJ import. The file is mapped and cut into chunks at line
+// boundaries that are parsed in parallel (v, vn, f; everything else is
+// skipped) with a locale-free number parser. Relative face indices are
+// resolved once every chunk's element counts are known, then (position,
+// normal) pairs are deduplicated into an indexed Mesh. Vertex colors come
+// from "v x y z r g b" when present, else from the normal, else from the
+// position within the bounding box.
+#include "mesh.h"
+#include "workerPool.h"
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+const size_t OBJ_MIN_CHUNK = 1 << 20;
+const int OBJ_CHUNKS_PER_WORKER = 4; // for load balance
+
+// Parses [+-]digits[.digits][(e|E)[+-]digits] starting at p. Returns the
+// position after the number, or p if there is none.
+inline const char *parseObjFloat(const char *p, const char *end, float &out) {
+  static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+  const char *s = p;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+'))
+    negative = *s++ == '-';
+  uint64_t mantissa = 0;
+  int exponent = 0, digits = 0;
+  const char *first = s;
+  for (; s < end && *s >= '0' && *s <= '9'; s++)
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*s - '0');
+      digits += mantissa != 0;
+    } else {
+      exponent++;
+    }
+  if (s < end && *s == '.')
+    for (s++; s < end && *s >= '0' && *s <= '9'; s++)
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*s - '0');
+        digits += mantissa != 0;
+        exponent--;
+      }
+  if (s == first || (s == first + 1 && *first == '.'))
+    return p;
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    const char *e = s + 1;
+    bool negativeExp = false;
+    if (e < end && (*e == '-' || *e == '+'))
+      negativeExp = *e++ == '-';
+    int value = 0;
+    const char *digitsStart = e;
+    for (; e < end && *e >= '0' && *e <= '9'; e++)
+      value = std::min(value * 10 + (*e - '0'), 10000);
+    if (e != digitsStart) {
+      exponent += negativeExp ? -value : value;
+      s = e;
+    }
+  }
+  double v = (double)mantissa;
+  if (exponent < 0)
+    v = exponent >= -22 ? v / powers[-exponent] : v * std::pow(10.0, exponent);
+  else if (exponent > 0)
+    v = exponent <= 22 ? v * powers[exponent] : v * std::pow(10.0, exponent);
+  out = (float)(negative ? -v : v);
+  return s;
+}
+
+inline const char *parseObjInt(const char *p, const char *end, int &out) {
+  const char *s = p;
+  bool negative = s < end && *s == '-';
+  if (s < end && (*s == '-' || *s == '+'))
+    s++;
+  const char *first = s;
+  long value = 0;
+  for (; s < end && *s >= '0' && *s <= '9'; s++)
+    value = std::min(value * 10 + (*s - '0'), (long)INT32_MAX);
+  if (s == first)
+    return p;
+  out = (int)(negative ? -value : value);
+  return s;
+}
+
+// Face corner as parsed; relative (negative) indices are kept relative to
+// the chunk's own element counts until the chunk bases are known.
+struct ObjCorner {
+  int position, normal;
+  uint8_t flags;
+};
+const uint8_t OBJ_POSITION_RELATIVE = 1, OBJ_NORMAL_RELATIVE = 2,
+              OBJ_NO_NORMAL = 4;
+
+struct ObjChunk {
+  const char *begin, *end;
+  std::vector<float> positions; // x y z r g b, r < 0 when no color given
+  std::vector<float> normals;
+  std::vector<ObjCorner> corners; // triangles, fan-triangulated
+  bool hasColor = false;
+  long badLines = 0;
+
+  static const char *skipSpace(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+      p++;
+    return p;
+  }
+
+  void parse() {
+    std::vector<ObjCorner> polygon; // reused by every face, of any size
+    for (const char *p = begin; p < end;) {
+      const char *eol = (const char *)memchr(p, '\n', end - p);
+      if (!eol)
+        eol = end;
+      const char *s = skipSpace(p, eol);
+      if (eol - s >= 2 && s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+        float v[6] = {0, 0, 0, -1, -1, -1};
+        int n = 0;
+        for (s += 2; n < 6; n++) {
+          s = skipSpace(s, eol);
+          const char *next = parseObjFloat(s, eol, v[n]);
+          if (next == s)
+            break;
+          s = next;
+        }
+        badLines += n < 3;
+        hasColor |= n == 6;
+        positions.insert(positions.end(), v, v + 6);
+      } else if (eol - s >= 3 && s[0] == 'v' && s[1] == 'n' &&
+                 (s[2] == ' ' || s[2] == '\t')) {
+        float v[3] = {0, 0, 0};
+        int n = 0;
+        for (s += 3; n < 3; n++) {
+          s = skipSpace(s, eol);
+          const char *next = parseObjFloat(s, eol, v[n]);
+          if (next == s)
+            break;
+          s = next;
+        }
+        badLines += n < 3;
+        normals.insert(normals.end(), v, v + 3);
+      } else if (eol - s >= 2 && s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+        polygon.clear();
+        for (s += 2;;) {
+          s = skipSpace(s, eol);
+          int v = 0, vt = 0, vn = 0;
+          const char *next = parseObjInt(s, eol, v);
+          if (next == s || v == 0)
+            break;
+          s = next;
+          ObjCorner &c = polygon.emplace_back();
+          c.flags = OBJ_NO_NORMAL;
+          if (s < eol && *s == '/') {
+            s = parseObjInt(s + 1, eol, vt); // texture coordinates unused
+            if (s < eol && *s == '/') {
+              next = parseObjInt(s + 1, eol, vn);
+              if (next != s + 1 && vn != 0)
+                c.flags = 0;
+              s = next;
+            }
+          }
+          // absolute indices are 1-based; relative ones count back from the
+          // elements seen so far in this chunk
+          int positionCount = (int)(positions.size() / 6);
+          int normalCount = (int)(normals.size() / 3);
+          c.position = v > 0 ? v - 1 : positionCount + v;
+          c.flags |= v > 0 ? 0 : OBJ_POSITION_RELATIVE;
+          if (!(c.flags & OBJ_NO_NORMAL)) {
+            c.normal = vn > 0 ? vn - 1 : normalCount + vn;
+            c.flags |= vn > 0 ? 0 : OBJ_NORMAL_RELATIVE;
+          } else {
+            c.normal = -1;
+          }
+        }
+        badLines += polygon.size() < 3;
+        for (size_t i = 2; i < polygon.size(); i++) {
+          corners.push_back(polygon[0]);
+          corners.push_back(polygon[i - 1]);
+          corners.push_back(polygon[i]);
+        }
+      }
+      p = eol < end ? eol + 1 : end;
+    }
+  }
+};
+
+// Open-addressing map from a (position, normal) key to an output vertex.
+struct ObjVertexMap {
+  std::vector<uint64_t> keys; // ~0 marks an empty slot
+  std::vector<uint32_t> values;
+  size_t used = 0, mask = 0;
+  int shift = 64;
+
+  void reserve(size_t count) {
+    size_t capacity = 1024;
+    for (shift = 54; capacity < count * 2; shift--)
+      capacity *= 2;
+    keys.assign(capacity, ~0ull);
+    values.resize(capacity);
+    mask = capacity - 1;
+    used = 0;
+  }
+
+  // Returns the existing value, or inserts next and returns it.
+  uint32_t findOrInsert(uint64_t key, uint32_t next) {
+    if ((used + 1) * 2 > keys.size())
+      grow();
+    // Fibonacci hashing: the top bits of the product mix all key bits
+    size_t slot = (size_t)((key * 0x9e3779b97f4a7c15ull) >> shift);
+    for (;; slot = (slot + 1) & mask) {
+      if (keys[slot] == key)
+        return values[slot];
+      if (keys[slot] == ~0ull) {
+        keys[slot] = key;
+        values[slot] = next;
+        used++;
+        return next;
+      }
+    }
+  }
+
+  void grow() {
+    std::vector<uint64_t> oldKeys;
+    std::vector<uint32_t> oldValues;
+    oldKeys.swap(keys);
+    oldValues.swap(values);
+    reserve(oldKeys.size());
+    for (size_t i = 0; i < oldKeys.size(); i++)
+      if (oldKeys[i] != ~0ull)
+        findOrInsert(oldKeys[i], oldValues[i]);
+  }
+};
+
+inline bool loadOBJ(const char *path, Mesh &mesh, WorkerPool &pool) {
+  auto start = std::chrono::steady_clock::now();
+  MappedFile file;
+  if (!file.open(path))
+    return false;
+  file.advise(MADV_SEQUENTIAL);
+  const char *data = file.data, *end = data + file.size;
+
+  size_t target = std::max(
+      OBJ_MIN_CHUNK,
+      file.size / (pool.workerCount() * OBJ_CHUNKS_PER_WORKER) + 1);
+  std::vector<ObjChunk> chunks;
+  for (const char *p = data; p < end;) {
+    const char *q = p + std::min(target, (size_t)(end - p));
+    if (q < end) {
+      const char *eol = (const char *)memchr(q, '\n', end - q);
+      q = eol ? eol + 1 : end;
+    }
+    chunks.emplace_back();
+    chunks.back().begin = p;
+    chunks.back().end = q;
+    p = q;
+  }
+  pool.parallelFor((int)chunks.size(),
+                   [&](int i, int) { chunks[i].parse(); });
+
+  // element offsets of each chunk, then global element and index arrays
+  std::vector<size_t> positionBase(chunks.size()), normalBase(chunks.size()),
+      cornerBase(chunks.size());
+  size_t positionCount = 0, normalCount = 0, cornerCount = 0;
+  bool hasColor = false;
+  long badLines = 0;
+  for (size_t i = 0; i < chunks.size(); i++) {
+    positionBase[i] = positionCount;
+    normalBase[i] = normalCount;
+    cornerBase[i] = cornerCount;
+    positionCount += chunks[i].positions.size() / 6;
+    normalCount += chunks[i].normals.size() / 3;
+    cornerCount += chunks[i].corners.size();
+    hasColor |= chunks[i].hasColor;
+    badLines += chunks[i].badLines;
+  }
+  std::vector<float> positions(positionCount * 6), normals(normalCount * 3);
+  std::vector<ObjCorner> corners(cornerCount);
+  std::vector<long> badIndices(chunks.size());
+  pool.parallelFor((int)chunks.size(), [&](int i, int) {
+    ObjChunk &chunk = chunks[i];
+    std::copy(chunk.positions.begin(), chunk.positions.end(),
+              positions.begin() + positionBase[i] * 6);
+    std::copy(chunk.normals.begin(), chunk.normals.end(),
+              normals.begin() + normalBase[i] * 3);
+    ObjCorner *out = &corners[cornerBase[i]];
+    for (const ObjCorner &c : chunk.corners) {
+      ObjCorner r = c;
+      if (r.flags & OBJ_POSITION_RELATIVE)
+        r.position += (int)positionBase[i];
+      if (r.flags & OBJ_NORMAL_RELATIVE)
+        r.normal += (int)normalBase[i];
+      bool ok = r.position >= 0 && (size_t)r.position < positionCount &&
+                ((r.flags & OBJ_NO_NORMAL) ||
+                 (r.normal >= 0 && (size_t)r.normal < normalCount));
+      if (!ok) {
+        badIndices[i]++;
+        r.position = 0;
+        r.flags = OBJ_NO_NORMAL;
+      }
+      *out++ = r;
+    }
+    std::vector<float>().swap(chunk.positions);
+    std::vector<float>().swap(chunk.normals);
+    std::vector<ObjCorner>().swap(chunk.corners);
+  });
+  long bad = 0;
+  for (long b : badIndices)
+    bad += b;
+  if (bad || positionCount == 0 || cornerCount == 0) {
+    fprintf(stderr, "OBJ %s: %s (%ld bad face indices)\n", path,
+            cornerCount ? "invalid" : "no faces", bad);
+    return false;
+  }
+
+  // Deduplicate (position, normal) pairs. Without normals every position is
+  // its own vertex, so a direct remap replaces the hash table.
+  std::vector<uint32_t> sourcePosition, sourceNormal;
+  mesh.indices.resize(cornerCount);
+  if (normalCount == 0) {
+    std::vector<uint32_t> remap(positionCount, UINT32_MAX);
+    for (size_t i = 0; i < cornerCount; i++) {
+      uint32_t &v = remap[corners[i].position];
+      if (v == UINT32_MAX) {
+        v = (uint32_t)sourcePosition.size();
+        sourcePosition.push_back(corners[i].position);
+      }
+      mesh.indices[i] = v;
+    }
+    sourceNormal.assign(sourcePosition.size(), UINT32_MAX);
+  } else {
+    ObjVertexMap map;
+    map.reserve(positionCount + positionCount / 2);
+    for (size_t i = 0; i < cornerCount; i++) {
+      const ObjCorner &c = corners[i];
+      uint32_t n = c.flags & OBJ_NO_NORMAL ? UINT32_MAX : (uint32_t)c.normal;
+      uint64_t key = (uint64_t)c.position << 32 | n;
+      uint32_t next = (uint32_t)sourcePosition.size();
+      uint32_t v = map.findOrInsert(key, next);
+      if (v == next) {
+        sourcePosition.push_back(c.position);
+        sourceNormal.push_back(n);
+      }
+      mesh.indices[i] = v;
+    }
+  }
+
+  float lo[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+  float hi[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+  for (size_t i = 0; i < positionCount; i++)
+    for (int c = 0; c < 3; c++) {
+      lo[c] = std::min(lo[c], positions[i * 6 + c]);
+      hi[c] = std::max(hi[c], positions[i * 6 + c]);
+    }
+  size_t vertexCount = sourcePosition.size();
+  mesh.vertices.resize(vertexCount * MESH_VERTEX_FLOATS);
+  const int batch = 65536;
+  pool.parallelFor((int)((vertexCount + batch - 1) / batch), [&](int b, int) {
+    size_t last = std::min(vertexCount, (size_t)(b + 1) * batch);
+    for (size_t v = (size_t)b * batch; v < last; v++) {
+      const float *p = &positions[sourcePosition[v] * 6];
+      float *out = &mesh.vertices[v * MESH_VERTEX_FLOATS];
+      out[0] = p[0];
+      out[1] = p[1];
+      out[2] = p[2];
+      for (int c = 0; c < 3; c++) {
+        if (hasColor && p[3] >= 0)
+          out[3 + c] = p[3 + c];
+        else if (sourceNormal[v] != UINT32_MAX)
+          out[3 + c] = normals[sourceNormal[v] * 3 + c] * 0.5f + 0.5f;
+        else
+          out[3 + c] = hi[c] > lo[c] ? (p[c] - lo[c]) / (hi[c] - lo[c]) : 1;
+      }
+    }
+  });
+
+  double ms = std::chrono::duration<double, std::milli>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+  printf("OBJ %s: %zu vertices, %zu triangles (%zu chunks) in %.1f ms\n",
+         path, vertexCount, cornerCount / 3, chunks.size(), ms);
+  if (badLines)
+    fprintf(stderr, "OBJ %s: %ld malformed lines skipped\n", path, badLines);
+  return true;
+}
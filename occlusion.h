@@ -0,0 +1,294 @@
+#pragma once
+// CPU occlusion culling. A few large occluders are rasterized each frame into
+// a small depth buffer, four pixels at a time, which is then reduced into a
+// hierarchical-Z pyramid whose texels hold the furthest depth beneath them.
+// A box is hidden when its nearest point lies behind that depth on every
+// texel its screen rectangle touches, at the level where that is at most 4x4
+// texels. Occluder coverage is sampled at pixel centers, and each pixel
+// stores the furthest depth the triangle reaches within it, so occluders
+// never move forward; a silhouette can still grow by up to half a pixel.
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const int OCCLUSION_WIDTH = 256; // a multiple of 4
+const int OCCLUSION_HEIGHT = 192;
+const int OCCLUSION_MAX_LEVELS = 16;
+const int OCCLUSION_MAX_TRIANGLES = 32768; // occluder budget per frame
+
+// Occluder triangles; positions are the first three floats of each vertex.
+struct OccluderMesh {
+  const float *positions = nullptr;
+  int stride = 3, vertexCount = 0; // stride in floats
+  const unsigned int *indices = nullptr;
+  int indexCount = 0;
+};
+
+struct OcclusionStats {
+  long frames = 0, triangles = 0; // rasterized occluder triangles
+  long tested = 0, outside = 0, occluded = 0;
+  double seconds = 0; // rasterizing and building the pyramid
+};
+
+struct OcclusionBuffer {
+  int levelCount = 0;
+  int widths[OCCLUSION_MAX_LEVELS], heights[OCCLUSION_MAX_LEVELS];
+  size_t offsets[OCCLUSION_MAX_LEVELS];
+  std::vector<float> depth; // every level, finest first; window z, 1 is far
+  std::vector<glm::vec4> clip;
+  long triangles = 0; // drawn since clear()
+
+  OcclusionBuffer() {
+    int w = OCCLUSION_WIDTH, h = OCCLUSION_HEIGHT;
+    size_t size = 0;
+    for (;;) {
+      widths[levelCount] = w;
+      heights[levelCount] = h;
+      offsets[levelCount++] = size;
+      size += (size_t)w * h;
+      if (w == 1 && h == 1)
+        break;
+      w = std::max(1, w / 2); // an odd row or column joins the last texel
+      h = std::max(1, h / 2);
+    }
+    depth.assign(size, 1.0f);
+  }
+
+  void clear() {
+    std::fill(depth.begin(), depth.begin() + offsets[1], 1.0f);
+    triangles = 0;
+  }
+
+  // Rasterizes the front faces of a mesh; mvp maps positions to clip space.
+  // Call buildPyramid() once all occluders are in.
+  void drawOccluder(const OccluderMesh &mesh, const glm::mat4 &mvp) {
+    clip.resize(mesh.vertexCount);
+    for (int i = 0; i < mesh.vertexCount; i++) {
+      const float *p = mesh.positions + (size_t)i * mesh.stride;
+      clip[i] = mvp * glm::vec4(p[0], p[1], p[2], 1.0f);
+    }
+    for (int i = 0; i + 2 < mesh.indexCount; i += 3) {
+      const glm::vec4 in[3] = {clip[mesh.indices[i]],
+                               clip[mesh.indices[i + 1]],
+                               clip[mesh.indices[i + 2]]};
+      // Sutherland-Hodgman against the near plane (z >= -w), then fan.
+      glm::vec4 out[4];
+      int n = 0;
+      for (int k = 0; k < 3; k++) {
+        const glm::vec4 &p = in[k], &q = in[(k + 1) % 3];
+        float dp = p.z + p.w, dq = q.z + q.w;
+        if (dp >= 0)
+          out[n++] = p;
+        if ((dp >= 0) != (dq >= 0))
+          out[n++] = p + (q - p) * (dp / (dp - dq));
+      }
+      for (int k = 1; k + 1 < n; k++)
+        fill(out[0], out[k], out[k + 1]);
+      triangles++;
+    }
+  }
+
+  void fill(const glm::vec4 &c0, const glm::vec4 &c1, const glm::vec4 &c2) {
+    const glm::vec4 *c[3] = {&c0, &c1, &c2};
+    float x[3], y[3], z[3];
+    for (int i = 0; i < 3; i++) {
+      float invW = 1.0f / c[i]->w;
+      x[i] = (c[i]->x * invW * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+      y[i] = (c[i]->y * invW * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+      z[i] = c[i]->z * invW * 0.5f + 0.5f;
+    }
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+    // Back faces, clockwise on screen as with GL_CULL_FACE, are skipped: on
+    // a closed mesh they lie behind its front faces, and on an open one
+    // leaving them out only loses occlusion.
+    if (!(area > 0) || !std::isfinite(area))
+      return;
+    // Pixels whose centers lie within the bounds. Clamping to the screen
+    // first keeps the values small enough to round by truncation.
+    auto firstCenter = [](float lo, int size) {
+      float v = std::min(std::max(lo, 0.0f), (float)size) - 0.5f;
+      int t = (int)v;
+      return t + (v > t);
+    };
+    auto lastCenter = [](float hi, int size) {
+      return (int)(std::min(std::max(hi, 0.0f), (float)size) + 0.5f) - 1;
+    };
+    int minX = firstCenter(std::min({x[0], x[1], x[2]}), OCCLUSION_WIDTH);
+    int minY = firstCenter(std::min({y[0], y[1], y[2]}), OCCLUSION_HEIGHT);
+    int maxX = std::min(OCCLUSION_WIDTH - 1,
+                        lastCenter(std::max({x[0], x[1], x[2]}),
+                                   OCCLUSION_WIDTH));
+    int maxY = std::min(OCCLUSION_HEIGHT - 1,
+                        lastCenter(std::max({y[0], y[1], y[2]}),
+                                   OCCLUSION_HEIGHT));
+    if (minX > maxX || minY > maxY)
+      return;
+    // Edge i is opposite vertex i; all three are >= 0 inside. Depth is
+    // affine in window space, so its plane comes from the same functions.
+    float A[3], B[3], C[3], invA[3];
+    float zA = 0, zB = 0, zC = 0;
+    for (int i = 0; i < 3; i++) {
+      int j = (i + 1) % 3, k = (i + 2) % 3;
+      A[i] = y[j] - y[k];
+      invA[i] = A[i] != 0 ? 1.0f / A[i] : 0.0f;
+      B[i] = x[k] - x[j];
+      C[i] = -(A[i] * x[j] + B[i] * y[j]);
+      zA += A[i] * z[i] / area;
+      zB += B[i] * z[i] / area;
+      zC += C[i] * z[i] / area;
+    }
+    zC += 0.5f * (std::fabs(zA) + std::fabs(zB)); // furthest in the pixel
+    // Narrow triangles cover their few 4-pixel groups without a span.
+    bool spans = maxX - (minX & ~3) >= 8;
+#ifdef __SSE2__
+    const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 a[3], step[3];
+    for (int i = 0; i < 3; i++) {
+      a[i] = _mm_set1_ps(A[i]);
+      step[i] = _mm_set1_ps(A[i] * 4.0f);
+    }
+    const __m128 za = _mm_set1_ps(zA), zStep = _mm_set1_ps(zA * 4.0f);
+#endif
+    for (int py = minY; py <= maxY; py++) {
+      float cy = py + 0.5f;
+      float *row = &depth[(size_t)py * OCCLUSION_WIDTH];
+      // The row's span from where each edge crosses it, a pixel wider
+      // either way for rounding; the edge tests below are exact.
+      int spanMin = minX, spanMax = maxX;
+      for (int i = 0; spans && i < 3; i++) {
+        if (A[i] == 0)
+          continue;
+        // clamped so the truncation below rounds down
+        float cross = std::min(std::max(-(B[i] * cy + C[i]) * invA[i], -2.0f),
+                               OCCLUSION_WIDTH + 2.0f);
+        if (A[i] > 0)
+          spanMin = std::max(spanMin, (int)(cross + 2.0f) - 3);
+        else
+          spanMax = std::min(spanMax, (int)(cross + 2.0f));
+      }
+      if (spanMin > spanMax)
+        continue;
+#ifdef __SSE2__
+      // Lanes outside the span are still on screen, and fail the edge
+      // tests unless the triangle covers them anyway.
+      int x0 = spanMin & ~3;
+      const __m128 cx = _mm_add_ps(_mm_set1_ps((float)x0), lane);
+      __m128 e[3];
+      for (int i = 0; i < 3; i++)
+        e[i] = _mm_add_ps(_mm_mul_ps(a[i], cx), _mm_set1_ps(B[i] * cy + C[i]));
+      __m128 zv = _mm_add_ps(_mm_mul_ps(za, cx), _mm_set1_ps(zB * cy + zC));
+      for (int px = x0; px <= spanMax; px += 4) {
+        __m128 inside = _mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(e[0], zero), _mm_cmpge_ps(e[1], zero)),
+            _mm_cmpge_ps(e[2], zero));
+        if (_mm_movemask_ps(inside)) {
+          __m128 old = _mm_loadu_ps(row + px);
+          __m128 nearer = _mm_min_ps(old, zv);
+          _mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, nearer),
+                                            _mm_andnot_ps(inside, old)));
+        }
+        for (int i = 0; i < 3; i++)
+          e[i] = _mm_add_ps(e[i], step[i]);
+        zv = _mm_add_ps(zv, zStep);
+      }
+#else
+      for (int px = spanMin; px <= spanMax; px++) {
+        float cx = px + 0.5f;
+        if (A[0] * cx + B[0] * cy + C[0] >= 0 &&
+            A[1] * cx + B[1] * cy + C[1] >= 0 &&
+            A[2] * cx + B[2] * cy + C[2] >= 0)
+          row[px] = std::min(row[px], zA * cx + zB * cy + zC);
+      }
+#endif
+    }
+  }
+
+  // Each texel takes the furthest of the 2x2 (or, on an odd edge, up to
+  // 3x3) texels below it.
+  void buildPyramid() {
+    for (int l = 1; l < levelCount; l++) {
+      const float *src = &depth[offsets[l - 1]];
+      float *dst = &depth[offsets[l]];
+      int sw = widths[l - 1], sh = heights[l - 1];
+      int w = widths[l], h = heights[l];
+      for (int y = 0; y < h; y++) {
+        int y0 = y * 2, y1 = y == h - 1 ? sh - 1 : y * 2 + 1;
+        int x = 0;
+#ifdef __SSE2__
+        for (; x + 4 <= w - (sw & 1); x += 4) {
+          __m128 a = _mm_loadu_ps(src + (size_t)y0 * sw + x * 2);
+          __m128 b = _mm_loadu_ps(src + (size_t)y0 * sw + x * 2 + 4);
+          for (int sy = y0 + 1; sy <= y1; sy++) {
+            a = _mm_max_ps(a, _mm_loadu_ps(src + (size_t)sy * sw + x * 2));
+            b = _mm_max_ps(b, _mm_loadu_ps(src + (size_t)sy * sw + x * 2 + 4));
+          }
+          __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+          __m128 odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+          _mm_storeu_ps(dst + (size_t)y * w + x, _mm_max_ps(even, odd));
+        }
+#endif
+        for (; x < w; x++) {
+          int x1 = x == w - 1 ? sw - 1 : x * 2 + 1;
+          float furthest = 0.0f;
+          for (int sy = y0; sy <= y1; sy++)
+            for (int sx = x * 2; sx <= x1; sx++)
+              furthest = std::max(furthest, src[(size_t)sy * sw + sx]);
+          dst[(size_t)y * w + x] = furthest;
+        }
+      }
+    }
+  }
+
+  // False when the box is hidden behind the occluders or off screen; a box
+  // that reaches in front of the near plane always counts as visible.
+  bool boxVisible(glm::vec3 lo, glm::vec3 hi, const glm::mat4 &mvp) const {
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+    float nearest = FLT_MAX;
+    for (int corner = 0; corner < 8; corner++) {
+      glm::vec4 c = mvp * glm::vec4(corner & 1 ? hi.x : lo.x,
+                                    corner & 2 ? hi.y : lo.y,
+                                    corner & 4 ? hi.z : lo.z, 1.0f);
+      if (c.z < -c.w || c.w <= 0)
+        return true;
+      float invW = 1.0f / c.w;
+      float x = (c.x * invW * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+      float y = (c.y * invW * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+      minX = std::min(minX, x);
+      maxX = std::max(maxX, x);
+      minY = std::min(minY, y);
+      maxY = std::max(maxY, y);
+      nearest = std::min(nearest, c.z * invW * 0.5f + 0.5f);
+    }
+    if (maxX < 0 || maxY < 0 || minX >= OCCLUSION_WIDTH ||
+        minY >= OCCLUSION_HEIGHT || nearest > 1.0f)
+      return false;
+    int x0 = std::max(0, (int)minX), y0 = std::max(0, (int)minY);
+    int x1 = std::min(OCCLUSION_WIDTH - 1, (int)maxX);
+    int y1 = std::min(OCCLUSION_HEIGHT - 1, (int)maxY);
+    int l = 0;
+    while (l + 1 < levelCount &&
+           ((x1 >> l) - (x0 >> l) >= 4 || (y1 >> l) - (y0 >> l) >= 4))
+      l++;
+    // Pixel p lies under texel p >> l, clamped for the odd edges.
+    const float *level = &depth[offsets[l]];
+    int w = widths[l], h = heights[l];
+    for (int y = std::min(y0 >> l, h - 1); y <= std::min(y1 >> l, h - 1); y++)
+      for (int x = std::min(x0 >> l, w - 1); x <= std::min(x1 >> l, w - 1);
+           x++)
+        if (nearest <= level[(size_t)y * w + x])
+          return true;
+    return false;
+  }
+
+  bool sphereVisible(glm::vec3 center, float radius,
+                     const glm::mat4 &mvp) const {
+    return boxVisible(center - glm::vec3(radius), center + glm::vec3(radius),
+                      mvp);
+  }
+};
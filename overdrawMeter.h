@@ -0,0 +1,84 @@
+#pragma once
+// Headless fragment overdraw measurement. The scene is drawn from viewpoints
+// spread over a sphere into an offscreen depth/stencil target, with the
+// stencil incremented by every fragment that passes the depth test. Each
+// pixel's stencil value is then the number of times it was shaded, and the
+// overdraw is the shaded total over the covered pixels.
+#include "glad/glad.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+const int OVERDRAW_SIZE = 512;
+const int OVERDRAW_VIEWS = 16;
+
+struct OverdrawStats {
+  long covered = 0, shaded = 0;
+  double ratio() const { return covered ? (double)shaded / covered : 0.0; }
+};
+
+// draw(view, projection) issues the scene's draws with the caller's program;
+// the camera orbits the origin at distance. GL state other than the
+// framebuffer, viewport and stencil test is left to the caller.
+inline OverdrawStats measureOverdraw(
+    float distance,
+    const std::function<void(const glm::mat4 &, const glm::mat4 &)> &draw) {
+  GLuint fbo, color, depthStencil;
+  glGenFramebuffers(1, &fbo);
+  glGenRenderbuffers(1, &color);
+  glGenRenderbuffers(1, &depthStencil);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glBindRenderbuffer(GL_RENDERBUFFER, color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, OVERDRAW_SIZE,
+                        OVERDRAW_SIZE);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color);
+  glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, OVERDRAW_SIZE,
+                        OVERDRAW_SIZE);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                            GL_RENDERBUFFER, depthStencil);
+  OverdrawStats stats;
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    fprintf(stderr, "Overdraw target is incomplete\n");
+  } else {
+    glViewport(0, 0, OVERDRAW_SIZE, OVERDRAW_SIZE);
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 0, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_INCR); // saturates at 255
+    glStencilMask(0xff);
+    glm::mat4 projection =
+        glm::perspective(glm::radians(45.0f), 1.0f, 0.1f, distance * 4.0f);
+    std::vector<unsigned char> stencil((size_t)OVERDRAW_SIZE * OVERDRAW_SIZE);
+    for (int i = 0; i < OVERDRAW_VIEWS; i++) {
+      // Fibonacci sphere: evenly spread directions without clustering at
+      // the poles.
+      float y = 1.0f - (i + 0.5f) * 2.0f / OVERDRAW_VIEWS;
+      float r = sqrtf(1.0f - y * y), angle = i * 2.39996323f;
+      glm::vec3 eye = glm::vec3(r * cosf(angle), y, r * sinf(angle)) *
+                      distance;
+      glm::vec3 up = fabsf(y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                      : glm::vec3(0.0f, 1.0f, 0.0f);
+      glClearStencil(0);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT |
+              GL_STENCIL_BUFFER_BIT);
+      draw(glm::lookAt(eye, glm::vec3(0.0f), up), projection);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glReadPixels(0, 0, OVERDRAW_SIZE, OVERDRAW_SIZE, GL_STENCIL_INDEX,
+                   GL_UNSIGNED_BYTE, stencil.data());
+      for (unsigned char count : stencil) {
+        stats.covered += count != 0;
+        stats.shaded += count;
+      }
+    }
+    glDisable(GL_STENCIL_TEST);
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glDeleteRenderbuffers(1, &color);
+  glDeleteRenderbuffers(1, &depthStencil);
+  glDeleteFramebuffers(1, &fbo);
+  return stats;
+}
@@ -0,0 +1,565 @@
+#pragma once
+// Performance overlay. Draw calls, triangles, compute dispatches, state
+// changes and uploaded bytes are counted by hooking the glad entry points (as
+// glTrace.h does). A multi-draw counts as one call; an indirect one adds no
+// triangles, since its counts are in a GPU buffer the hooks never read. GPU
+// scopes are timed with GL_TIMESTAMP queries read a few frames later so they
+// never stall. The overlay itself is one batched draw: glyph and graph quads
+// from a 3x5 bitmap font atlas, written into an orphaned streaming buffer.
+#include "glad/glad.h"
+#include "glDebug.h"
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+struct PerfCounters {
+  long drawCalls = 0, triangles = 0, dispatches = 0, stateChanges = 0;
+  long long bytesUploaded = 0;
+  bool paused = false; // set while the HUD draws itself
+};
+
+inline PerfCounters perfCounters;
+
+// Driver entry points (or the trace thunks) that the counting hooks wrap.
+struct PerfRealGL {
+  PFNGLDRAWARRAYSPROC drawArrays;
+  PFNGLDRAWELEMENTSPROC drawElements;
+  PFNGLDRAWELEMENTSBASEVERTEXPROC drawElementsBaseVertex;
+  PFNGLMULTIDRAWELEMENTSPROC multiDrawElements;
+  PFNGLMULTIDRAWELEMENTSINDIRECTPROC multiDrawElementsIndirect;
+  PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTPROC multiDrawElementsIndirectCount;
+  PFNGLDISPATCHCOMPUTEPROC dispatchCompute;
+  PFNGLBINDVERTEXARRAYPROC bindVertexArray;
+  PFNGLUSEPROGRAMPROC useProgram;
+  PFNGLBINDBUFFERPROC bindBuffer;
+  PFNGLBINDBUFFERRANGEPROC bindBufferRange;
+  PFNGLBINDTEXTUREPROC bindTexture;
+  PFNGLENABLEPROC enable;
+  PFNGLDISABLEPROC disable;
+  PFNGLBUFFERDATAPROC bufferData;
+  PFNGLBUFFERSUBDATAPROC bufferSubData;
+};
+
+inline PerfRealGL perfReal;
+inline bool perfHooked = false;
+
+inline long primitiveTriangles(GLenum mode, GLsizei count) {
+  if (mode == GL_TRIANGLES)
+    return count / 3;
+  if (mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN)
+    return count > 2 ? count - 2 : 0;
+  return 0;
+}
+inline void countDraw(GLenum mode, GLsizei count) {
+  if (perfCounters.paused)
+    return;
+  perfCounters.drawCalls++;
+  perfCounters.triangles += primitiveTriangles(mode, count);
+}
+inline void countState() {
+  if (!perfCounters.paused)
+    perfCounters.stateChanges++;
+}
+inline void countUpload(GLsizeiptr size, const void *data) {
+  if (!perfCounters.paused && data)
+    perfCounters.bytesUploaded += size;
+}
+
+inline void APIENTRY perfDrawArrays(GLenum mode, GLint first, GLsizei count) {
+  countDraw(mode, count);
+  perfReal.drawArrays(mode, first, count);
+}
+inline void APIENTRY perfDrawElements(GLenum mode, GLsizei count, GLenum type,
+                                      const void *indices) {
+  countDraw(mode, count);
+  perfReal.drawElements(mode, count, type, indices);
+}
+inline void APIENTRY perfDrawElementsBaseVertex(GLenum mode, GLsizei count,
+                                                GLenum type,
+                                                const void *indices,
+                                                GLint baseVertex) {
+  countDraw(mode, count);
+  perfReal.drawElementsBaseVertex(mode, count, type, indices, baseVertex);
+}
+inline void APIENTRY perfMultiDrawElements(GLenum mode, const GLsizei *count,
+                                           GLenum type,
+                                           const void *const *indices,
+                                           GLsizei drawCount) {
+  countDraw(mode, 0);
+  for (GLsizei i = 0; i < drawCount && !perfCounters.paused; i++)
+    perfCounters.triangles += primitiveTriangles(mode, count[i]);
+  perfReal.multiDrawElements(mode, count, type, indices, drawCount);
+}
+inline void APIENTRY perfMultiDrawElementsIndirect(GLenum mode, GLenum type,
+                                                   const void *indirect,
+                                                   GLsizei drawCount,
+                                                   GLsizei stride) {
+  countDraw(mode, 0);
+  perfReal.multiDrawElementsIndirect(mode, type, indirect, drawCount, stride);
+}
+inline void APIENTRY perfMultiDrawElementsIndirectCount(
+    GLenum mode, GLenum type, const void *indirect, GLintptr drawCount,
+    GLsizei maxDrawCount, GLsizei stride) {
+  countDraw(mode, 0);
+  perfReal.multiDrawElementsIndirectCount(mode, type, indirect, drawCount,
+                                          maxDrawCount, stride);
+}
+inline void APIENTRY perfDispatchCompute(GLuint x, GLuint y, GLuint z) {
+  if (!perfCounters.paused)
+    perfCounters.dispatches++;
+  perfReal.dispatchCompute(x, y, z);
+}
+inline void APIENTRY perfBindVertexArray(GLuint array) {
+  countState();
+  perfReal.bindVertexArray(array);
+}
+inline void APIENTRY perfUseProgram(GLuint program) {
+  countState();
+  perfReal.useProgram(program);
+}
+inline void APIENTRY perfBindBuffer(GLenum target, GLuint buffer) {
+  countState();
+  perfReal.bindBuffer(target, buffer);
+}
+inline void APIENTRY perfBindBufferRange(GLenum target, GLuint index,
+                                         GLuint buffer, GLintptr offset,
+                                         GLsizeiptr size) {
+  countState();
+  perfReal.bindBufferRange(target, index, buffer, offset, size);
+}
+inline void APIENTRY perfBindTexture(GLenum target, GLuint texture) {
+  countState();
+  perfReal.bindTexture(target, texture);
+}
+inline void APIENTRY perfEnable(GLenum cap) {
+  countState();
+  perfReal.enable(cap);
+}
+inline void APIENTRY perfDisable(GLenum cap) {
+  countState();
+  perfReal.disable(cap);
+}
+inline void APIENTRY perfBufferData(GLenum target, GLsizeiptr size,
+                                    const void *data, GLenum usage) {
+  countUpload(size, data);
+  perfReal.bufferData(target, size, data, usage);
+}
+inline void APIENTRY perfBufferSubData(GLenum target, GLintptr offset,
+                                       GLsizeiptr size, const void *data) {
+  countUpload(size, data);
+  perfReal.bufferSubData(target, offset, size, data);
+}
+
+#define PERF_HOOKS(X)                                                          \
+  X(drawArrays, glDrawArrays, perfDrawArrays)                                  \
+  X(drawElements, glDrawElements, perfDrawElements)                            \
+  X(drawElementsBaseVertex, glDrawElementsBaseVertex,                          \
+    perfDrawElementsBaseVertex)                                                \
+  X(multiDrawElements, glMultiDrawElements, perfMultiDrawElements)             \
+  X(multiDrawElementsIndirect, glMultiDrawElementsIndirect,                    \
+    perfMultiDrawElementsIndirect)                                             \
+  X(multiDrawElementsIndirectCount, glMultiDrawElementsIndirectCount,          \
+    perfMultiDrawElementsIndirectCount)                                        \
+  X(dispatchCompute, glDispatchCompute, perfDispatchCompute)                   \
+  X(bindVertexArray, glBindVertexArray, perfBindVertexArray)                   \
+  X(useProgram, glUseProgram, perfUseProgram)                                  \
+  X(bindBuffer, glBindBuffer, perfBindBuffer)                                  \
+  X(bindBufferRange, glBindBufferRange, perfBindBufferRange)                   \
+  X(bindTexture, glBindTexture, perfBindTexture)                               \
+  X(enable, glEnable, perfEnable)                                              \
+  X(disable, glDisable, perfDisable)                                           \
+  X(bufferData, glBufferData, perfBufferData)                                  \
+  X(bufferSubData, glBufferSubData, perfBufferSubData)
+
+// Install after startGLTrace (the hooks then wrap the trace thunks) and
+// remove before stopGLTrace.
+inline void installPerfCounters() {
+  if (perfHooked)
+    return;
+#define PERF_HOOK(field, name, thunk)                                          \
+  perfReal.field = glad_##name;                                                \
+  glad_##name = thunk;
+  PERF_HOOKS(PERF_HOOK)
+#undef PERF_HOOK
+  perfHooked = true;
+}
+
+inline void removePerfCounters() {
+  if (!perfHooked)
+    return;
+#define PERF_UNHOOK(field, name, thunk) glad_##name = perfReal.field;
+  PERF_HOOKS(PERF_UNHOOK)
+#undef PERF_UNHOOK
+  perfHooked = false;
+}
+
+const int GPU_TIMER_LATENCY = 4; // frames in flight before a result is read
+const int GPU_TIMER_MAX_SCOPES = 8;
+
+// GPU scopes as pairs of GL_TIMESTAMP queries, so they may nest or overlap.
+// Results lag by GPU_TIMER_LATENCY frames.
+struct GpuTimers {
+  struct Frame {
+    unsigned int queries[GPU_TIMER_MAX_SCOPES * 2];
+    const char *names[GPU_TIMER_MAX_SCOPES];
+    int count = 0;
+  };
+  Frame frames[GPU_TIMER_LATENCY];
+  int current = 0;
+  bool enabled = false;
+  // last collected frame
+  const char *names[GPU_TIMER_MAX_SCOPES];
+  uint64_t begins[GPU_TIMER_MAX_SCOPES], ends[GPU_TIMER_MAX_SCOPES];
+  int resultCount = 0;
+  void (*collected)(const GpuTimers &) = nullptr; // e.g. the profiler
+
+  void init() {
+    for (Frame &f : frames)
+      glGenQueries(GPU_TIMER_MAX_SCOPES * 2, f.queries);
+    enabled = true;
+  }
+
+  int begin(const char *name) {
+    Frame &f = frames[current];
+    if (!enabled || f.count == GPU_TIMER_MAX_SCOPES)
+      return -1;
+    glQueryCounter(f.queries[f.count * 2], GL_TIMESTAMP);
+    f.names[f.count] = name;
+    return f.count++;
+  }
+
+  void end(int scope) {
+    if (scope >= 0)
+      glQueryCounter(frames[current].queries[scope * 2 + 1], GL_TIMESTAMP);
+  }
+
+  double milliseconds(int i) const { return (ends[i] - begins[i]) * 1e-6; }
+
+  // Call once per frame after the last scope (and after the HUD); reads the
+  // oldest frame.
+  void nextFrame() {
+    if (!enabled)
+      return;
+    current = (current + 1) % GPU_TIMER_LATENCY;
+    Frame &f = frames[current];
+    if (f.count) {
+      GLuint available = 0;
+      glGetQueryObjectuiv(f.queries[f.count * 2 - 1],
+                          GL_QUERY_RESULT_AVAILABLE, &available);
+      if (available) {
+        for (int i = 0; i < f.count; i++) {
+          GLuint64 t0, t1;
+          glGetQueryObjectui64v(f.queries[i * 2], GL_QUERY_RESULT, &t0);
+          glGetQueryObjectui64v(f.queries[i * 2 + 1], GL_QUERY_RESULT, &t1);
+          names[i] = f.names[i];
+          begins[i] = t0;
+          ends[i] = t1;
+        }
+        resultCount = f.count;
+        if (collected)
+          collected(*this);
+      }
+    }
+    f.count = 0;
+  }
+
+  void destroy() {
+    if (!enabled)
+      return;
+    for (Frame &f : frames)
+      glDeleteQueries(GPU_TIMER_MAX_SCOPES * 2, f.queries);
+    enabled = false;
+  }
+};
+
+inline GpuTimers gpuTimers;
+
+// 3x5 glyphs for ' ' to '_', one bit per pixel, top row in the high bits.
+// Lowercase is drawn as uppercase.
+const uint16_t HUD_GLYPHS[64] = {
+    0b000'000'000'000'000, 0b010'010'010'000'010, 0b101'101'000'000'000,
+    0b101'111'101'111'101, 0b011'110'010'011'110, 0b101'001'010'100'101,
+    0b010'101'010'101'011, 0b010'010'000'000'000, 0b001'010'010'010'001,
+    0b100'010'010'010'100, 0b000'101'010'101'000, 0b000'010'111'010'000,
+    0b000'000'000'010'100, 0b000'000'111'000'000, 0b000'000'000'000'010,
+    0b001'001'010'100'100, 0b111'101'101'101'111, 0b010'110'010'010'111,
+    0b111'001'111'100'111, 0b111'001'111'001'111, 0b101'101'111'001'001,
+    0b111'100'111'001'111, 0b111'100'111'101'111, 0b111'001'001'001'001,
+    0b111'101'111'101'111, 0b111'101'111'001'111, 0b000'010'000'010'000,
+    0b000'010'000'010'100, 0b001'010'100'010'001, 0b000'111'000'111'000,
+    0b100'010'001'010'100, 0b111'001'010'000'010, 0b010'101'111'100'011,
+    0b010'101'111'101'101, 0b110'101'110'101'110, 0b011'100'100'100'011,
+    0b110'101'101'101'110, 0b111'100'110'100'111, 0b111'100'110'100'100,
+    0b011'100'101'101'011, 0b101'101'111'101'101, 0b111'010'010'010'111,
+    0b001'001'001'101'010, 0b101'101'110'101'101, 0b100'100'100'100'111,
+    0b101'111'111'101'101, 0b110'101'101'101'101, 0b010'101'101'101'010,
+    0b110'101'110'100'100, 0b010'101'101'110'011, 0b110'101'110'101'101,
+    0b011'100'010'001'110, 0b111'010'010'010'010, 0b101'101'101'101'111,
+    0b101'101'101'101'010, 0b101'101'111'111'101, 0b101'101'010'101'101,
+    0b101'101'010'010'010, 0b111'001'010'100'111, 0b011'010'010'010'011,
+    0b100'100'010'001'001, 0b110'010'010'010'110, 0b010'101'000'000'000,
+    0b000'000'000'000'111};
+
+const int HUD_CELL_W = 4, HUD_CELL_H = 6; // glyph plus one pixel of spacing
+const int HUD_ATLAS_W = 64, HUD_ATLAS_H = 32;
+const int HUD_SOLID_CELL = 64; // fully lit cell for bars and panels
+const int HUD_SCALE = 2;
+const int HUD_MAX_QUADS = 4096;
+const int HUD_GRAPH_FRAMES = 120;
+const float HUD_GRAPH_MS = 33.3f; // full graph height
+
+struct HudVertex {
+  float x, y, u, v;
+  uint32_t color; // RGBA8, r in the low byte
+};
+
+inline const char *hudVertexShaderSrc = R"(
+#version 330 core
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aUV;
+layout (location = 2) in vec4 aColor;
+uniform vec2 screen;
+out vec2 uv;
+out vec4 color;
+void main() {
+  gl_Position = vec4(aPos / screen * vec2(2.0, -2.0) + vec2(-1.0, 1.0), 0.0,
+                     1.0);
+  uv = aUV;
+  color = aColor;
+}
+)";
+
+inline const char *hudFragmentShaderSrc = R"(
+#version 330 core
+in vec2 uv;
+in vec4 color;
+out vec4 FragColor;
+uniform sampler2D atlas;
+void main() {
+  FragColor = vec4(color.rgb, color.a * texture(atlas, uv).r);
+}
+)";
+
+struct PerfHud {
+  unsigned int program = 0, vao = 0, vbo = 0, ebo = 0, atlas = 0;
+  int screenLocation = -1;
+  std::vector<HudVertex> vertices;
+  float frameMs[HUD_GRAPH_FRAMES] = {};
+  int graphHead = 0;
+  std::chrono::steady_clock::time_point lastFrame;
+  PerfCounters shown; // previous frame's counts
+  double cpuMs = 0;   // cost of the last draw() call
+
+  void init() {
+    installPerfCounters();
+    if (!gpuTimers.enabled)
+      gpuTimers.init();
+    perfCounters.paused = true;
+
+    std::vector<unsigned char> pixels(HUD_ATLAS_W * HUD_ATLAS_H, 0);
+    for (int g = 0; g <= HUD_SOLID_CELL; g++) {
+      int cx = g % 16 * HUD_CELL_W, cy = g / 16 * HUD_CELL_H;
+      for (int y = 0; y < HUD_CELL_H; y++)
+        for (int x = 0; x < HUD_CELL_W; x++) {
+          bool lit = g == HUD_SOLID_CELL ||
+                     (x < 3 && y < 5 &&
+                      (HUD_GLYPHS[g] >> (14 - y * 3 - x) & 1));
+          pixels[(cy + y) * HUD_ATLAS_W + cx + x] = lit ? 255 : 0;
+        }
+    }
+    glGenTextures(1, &atlas);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, HUD_ATLAS_W, HUD_ATLAS_H, 0, GL_RED,
+                 GL_UNSIGNED_BYTE, pixels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    unsigned int vs = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vs, 1, &hudVertexShaderSrc, nullptr);
+    glCompileShader(vs);
+    checkShaderCompile(vs, "hud vertex");
+    unsigned int fs = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fs, 1, &hudFragmentShaderSrc, nullptr);
+    glCompileShader(fs);
+    checkShaderCompile(fs, "hud fragment");
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    checkProgramLink(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    screenLocation = glGetUniformLocation(program, "screen");
+
+    // Quads share a static index buffer; only vertices are streamed.
+    std::vector<uint16_t> indices(HUD_MAX_QUADS * 6);
+    for (int q = 0; q < HUD_MAX_QUADS; q++) {
+      const uint16_t corner[6] = {0, 1, 2, 0, 2, 3};
+      for (int i = 0; i < 6; i++)
+        indices[q * 6 + i] = (uint16_t)(q * 4 + corner[i]);
+    }
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, HUD_MAX_QUADS * 4 * sizeof(HudVertex),
+                 nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t),
+                 indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex),
+                          (void *)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex),
+                          (void *)(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex),
+                          (void *)(4 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glBindVertexArray(0);
+    vertices.reserve(HUD_MAX_QUADS * 4);
+    lastFrame = std::chrono::steady_clock::now();
+    perfCounters.paused = false;
+  }
+
+  void quad(float x, float y, float w, float h, int cell, uint32_t color) {
+    if (vertices.size() >= HUD_MAX_QUADS * 4)
+      return;
+    float u0 = (float)(cell % 16 * HUD_CELL_W) / HUD_ATLAS_W;
+    float v0 = (float)(cell / 16 * HUD_CELL_H) / HUD_ATLAS_H;
+    float u1 = u0 + 3.0f / HUD_ATLAS_W, v1 = v0 + 5.0f / HUD_ATLAS_H;
+    if (cell == HUD_SOLID_CELL) // sample the middle of the lit cell
+      u0 = u1 = u0 + 2.0f / HUD_ATLAS_W, v0 = v1 = v0 + 3.0f / HUD_ATLAS_H;
+    vertices.push_back({x, y, u0, v0, color});
+    vertices.push_back({x + w, y, u1, v0, color});
+    vertices.push_back({x + w, y + h, u1, v1, color});
+    vertices.push_back({x, y + h, u0, v1, color});
+  }
+
+  void text(float x, float y, const char *s, uint32_t color) {
+    for (; *s; s++, x += HUD_CELL_W * HUD_SCALE) {
+      int c = *s >= 'a' && *s <= 'z' ? *s - 32 : *s;
+      if (c > ' ' && c <= '_')
+        quad(x, y, 3 * HUD_SCALE, 5 * HUD_SCALE, c - ' ', color);
+    }
+  }
+
+  // Call last in the frame, on the GL thread. Takes the counters gathered
+  // since the previous call, then resets them.
+  void draw(int width, int height) {
+    auto start = std::chrono::steady_clock::now();
+    float ms = std::chrono::duration<float, std::milli>(start - lastFrame)
+                   .count();
+    lastFrame = start;
+    frameMs[graphHead] = ms;
+    graphHead = (graphHead + 1) % HUD_GRAPH_FRAMES;
+    shown = perfCounters;
+    perfCounters = PerfCounters();
+    perfCounters.paused = true;
+
+    float minMs = 1e9f, maxMs = 0, sumMs = 0;
+    for (float f : frameMs) {
+      minMs = f < minMs ? f : minMs;
+      maxMs = f > maxMs ? f : maxMs;
+      sumMs += f;
+    }
+    float avgMs = sumMs / HUD_GRAPH_FRAMES;
+
+    vertices.clear();
+    const float pad = 4.0f * HUD_SCALE, line = (HUD_CELL_H + 1) * HUD_SCALE;
+    const float graphH = 30.0f * HUD_SCALE, panelW = 170.0f * HUD_SCALE;
+    int lines = 7 + gpuTimers.resultCount;
+    quad(0, 0, panelW, pad * 3 + graphH + lines * line, HUD_SOLID_CELL,
+         0xb0000000);
+
+    // frame time graph, oldest on the left
+    float barW = (panelW - 2 * pad) / HUD_GRAPH_FRAMES, baseY = pad + graphH;
+    for (int i = 0; i < HUD_GRAPH_FRAMES; i++) {
+      float f = frameMs[(graphHead + i) % HUD_GRAPH_FRAMES];
+      float h = (f < HUD_GRAPH_MS ? f : HUD_GRAPH_MS) / HUD_GRAPH_MS * graphH;
+      uint32_t color = f <= 16.7f ? 0xff40d040 : f <= 33.4f ? 0xff30c0e0
+                                                             : 0xff4040e0;
+      quad(pad + i * barW, baseY - h, barW, h, HUD_SOLID_CELL, color);
+    }
+    float sixtyY = baseY - 16.7f / HUD_GRAPH_MS * graphH;
+    quad(pad, sixtyY, panelW - 2 * pad, 1, HUD_SOLID_CELL, 0x80ffffff);
+
+    char buf[96];
+    float y = baseY + pad;
+    const uint32_t white = 0xffffffff, gray = 0xffc0c0c0;
+    snprintf(buf, sizeof(buf), "FRAME %.2f MS (%.0f FPS)", ms,
+             ms > 0 ? 1000.0f / ms : 0.0f);
+    text(pad, y, buf, white);
+    snprintf(buf, sizeof(buf), "MIN %.2f AVG %.2f MAX %.2f", minMs, avgMs,
+             maxMs);
+    text(pad, y += line, buf, gray);
+    snprintf(buf, sizeof(buf), "DRAWS %ld TRIS %ld", shown.drawCalls,
+             shown.triangles);
+    text(pad, y += line, buf, white);
+    snprintf(buf, sizeof(buf), "DISPATCHES %ld", shown.dispatches);
+    text(pad, y += line, buf, white);
+    snprintf(buf, sizeof(buf), "STATE CHANGES %ld", shown.stateChanges);
+    text(pad, y += line, buf, white);
+    snprintf(buf, sizeof(buf), "UPLOAD %.1f KB",
+             shown.bytesUploaded / 1024.0);
+    text(pad, y += line, buf, white);
+    for (int i = 0; i < gpuTimers.resultCount; i++) {
+      snprintf(buf, sizeof(buf), "GPU %s %.3f MS", gpuTimers.names[i],
+               gpuTimers.milliseconds(i));
+      text(pad, y += line, buf, gray);
+    }
+    snprintf(buf, sizeof(buf), "HUD CPU %.3f MS", cpuMs);
+    text(pad, y += line, buf, gray);
+
+    int scope = gpuTimers.begin("hud");
+    GLint previousProgram, previousVAO;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVAO);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    GLboolean cullFace = glIsEnabled(GL_CULL_FACE); // quads wind clockwise
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(program);
+    glUniform2f(screenLocation, (float)width, (float)height);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    size_t bytes = vertices.size() * sizeof(HudVertex);
+    glBufferData(GL_ARRAY_BUFFER, HUD_MAX_QUADS * 4 * sizeof(HudVertex),
+                 nullptr, GL_STREAM_DRAW); // orphan: no wait on last frame
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, vertices.data());
+    glDrawElements(GL_TRIANGLES, (GLsizei)(vertices.size() / 4 * 6),
+                   GL_UNSIGNED_SHORT, nullptr);
+    glDisable(GL_BLEND);
+    if (depthTest)
+      glEnable(GL_DEPTH_TEST);
+    if (cullFace)
+      glEnable(GL_CULL_FACE);
+    glBindVertexArray(previousVAO);
+    glUseProgram(previousProgram);
+    gpuTimers.end(scope);
+    perfCounters.paused = false;
+    cpuMs = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  }
+
+  // Removes the counting hooks too, so call before stopGLTrace.
+  void destroy() {
+    if (!program)
+      return;
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+    glDeleteTextures(1, &atlas);
+    glDeleteProgram(program);
+    program = 0;
+    removePerfCounters();
+  }
+};
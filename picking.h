@@ -0,0 +1,268 @@
+#pragma once
+// Picking: the object and triangle under the cursor. On the CPU the cursor
+// is unprojected into a ray that walks the scene BVH and then the BVH over
+// the hit object's own triangles, built on first use. On the GPU the scene
+// is drawn with object and primitive IDs into a one-pixel scissor of an
+// integer framebuffer; the pixel is read into a pixel pack buffer behind a
+// fence and collected by poll() once the GPU is done, so neither path waits.
+#include "glad/glad.h"
+#include "bvh.h"
+#include "commandBuffer.h"
+#include "glDebug.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <cfloat>
+#include <cstdint>
+#include <vector>
+
+struct PickRay {
+  glm::vec3 origin, dir;
+};
+
+// x and y in normalized device coordinates; the ray starts on the near
+// plane and dir is unit length.
+inline PickRay unprojectCursor(float x, float y,
+                               const glm::mat4 &viewProjection) {
+  glm::mat4 inverse = glm::inverse(viewProjection);
+  glm::vec4 nearPoint = inverse * glm::vec4(x, y, -1.0f, 1.0f);
+  glm::vec4 farPoint = inverse * glm::vec4(x, y, 1.0f, 1.0f);
+  PickRay ray;
+  ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+  ray.dir = glm::normalize(glm::vec3(farPoint) / farPoint.w - ray.origin);
+  return ray;
+}
+
+struct PickHit {
+  int object = -1;
+  int triangle = -1;        // -1 when the object has no triangles on the CPU
+  float distance = FLT_MAX; // along the ray; not known to the GPU path
+};
+
+// Moller and Trumbore, "Fast, Minimum Storage Ray/Triangle Intersection",
+// 1997. Both sides count. FLT_MAX when the ray misses within [0, tMax].
+inline float rayTriangleDistance(glm::vec3 origin, glm::vec3 dir, glm::vec3 p0,
+                                 glm::vec3 p1, glm::vec3 p2, float tMax) {
+  glm::vec3 e1 = p1 - p0, e2 = p2 - p0;
+  glm::vec3 p = glm::cross(dir, e2);
+  float det = glm::dot(e1, p);
+  if (det == 0.0f)
+    return FLT_MAX;
+  float invDet = 1.0f / det;
+  glm::vec3 s = origin - p0;
+  float u = glm::dot(s, p) * invDet;
+  if (u < 0.0f || u > 1.0f)
+    return FLT_MAX;
+  glm::vec3 q = glm::cross(s, e1);
+  float v = glm::dot(dir, q) * invDet;
+  if (v < 0.0f || u + v > 1.0f)
+    return FLT_MAX;
+  float t = glm::dot(e2, q) * invDet;
+  return t >= 0.0f && t < tMax ? t : FLT_MAX;
+}
+
+// The triangles of one indexed mesh, in a BVH over their boxes.
+struct TriangleBvh {
+  Bvh bvh;
+  std::vector<glm::vec3> lo, hi;
+  const float *positions = nullptr;
+  int stride = 3; // floats per vertex
+  const unsigned int *indices = nullptr;
+
+  bool built() const { return indices != nullptr; }
+
+  void build(const float *p, int floatsPerVertex, const unsigned int *index,
+             int indexCount) {
+    positions = p;
+    stride = floatsPerVertex;
+    indices = index;
+    int count = indexCount / 3;
+    lo.resize(count);
+    hi.resize(count);
+    for (int t = 0; t < count; t++) {
+      lo[t] = hi[t] = vertex(t, 0);
+      for (int c = 1; c < 3; c++) {
+        lo[t] = glm::min(lo[t], vertex(t, c));
+        hi[t] = glm::max(hi[t], vertex(t, c));
+      }
+    }
+    bvh.build(lo.data(), hi.data(), count);
+  }
+
+  glm::vec3 vertex(int triangle, int corner) const {
+    const float *v =
+        positions + (size_t)indices[triangle * 3 + corner] * stride;
+    return glm::vec3(v[0], v[1], v[2]);
+  }
+
+  // Nearest triangle along the ray within tMax, which becomes its distance;
+  // -1 on a miss. Distances are in units of dir, so a ray transformed into
+  // model space without renormalizing keeps world distances.
+  int raycast(glm::vec3 origin, glm::vec3 dir, float &tMax) const {
+    return bvh.raycast(origin, dir, tMax, [&](int t, float limit) {
+      return rayTriangleDistance(origin, dir, vertex(t, 0), vertex(t, 1),
+                                 vertex(t, 2), limit);
+    });
+  }
+};
+
+inline const char *pickVertexSrc = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+void main() {
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+})";
+
+inline const char *pickFragmentSrc = R"(
+#version 330 core
+uniform uint object;
+uniform uint firstTriangle;
+out uvec2 id; // object + 1 (0 is empty), triangle
+void main() {
+    id = uvec2(object + 1u, firstTriangle + uint(gl_PrimitiveID));
+})";
+
+struct IdBufferPicker {
+  unsigned int program = 0;
+  unsigned int framebuffer = 0, idBuffer = 0, depthBuffer = 0, pbo = 0;
+  int width = 0, height = 0;
+  int pixelX = 0, pixelY = 0;
+  GLsync fence = nullptr; // set while a pick is in flight
+  int modelLocation, viewLocation, projectionLocation, objectLocation,
+      firstTriangleLocation;
+  GLint previousProgram = 0;
+
+  void init() {
+    unsigned int vs = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vs, 1, &pickVertexSrc, nullptr);
+    glCompileShader(vs);
+    checkShaderCompile(vs, "pick vertex");
+    unsigned int fs = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fs, 1, &pickFragmentSrc, nullptr);
+    glCompileShader(fs);
+    checkShaderCompile(fs, "pick fragment");
+    program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    checkProgramLink(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    modelLocation = glGetUniformLocation(program, "model");
+    viewLocation = glGetUniformLocation(program, "view");
+    projectionLocation = glGetUniformLocation(program, "projection");
+    objectLocation = glGetUniformLocation(program, "object");
+    firstTriangleLocation = glGetUniformLocation(program, "firstTriangle");
+
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &idBuffer);
+    glGenRenderbuffers(1, &depthBuffer);
+    glGenBuffers(1, &pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, 2 * sizeof(uint32_t), nullptr,
+                 GL_STREAM_READ);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+
+  // Starts an ID pass for framebuffer pixel (x, y), counted from the bottom
+  // left. A pick still in flight is dropped.
+  void begin(int w, int h, int x, int y, const glm::mat4 &view,
+             const glm::mat4 &projection) {
+    if (!program)
+      init();
+    if (fence) {
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if (w != width || h != height) {
+      width = w;
+      height = h;
+      glBindRenderbuffer(GL_RENDERBUFFER, idBuffer);
+      glRenderbufferStorage(GL_RENDERBUFFER, GL_RG32UI, width, height);
+      glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+      glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+                            height);
+      glBindRenderbuffer(GL_RENDERBUFFER, 0);
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                GL_RENDERBUFFER, idBuffer);
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                GL_RENDERBUFFER, depthBuffer);
+    }
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(x, y, 1, 1);
+    const GLuint empty[4] = {0, 0, 0, 0};
+    glClearBufferuiv(GL_COLOR, 0, empty);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+    glUseProgram(program);
+    glUniformMatrix4fv(viewLocation, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(projectionLocation, 1, GL_FALSE,
+                       glm::value_ptr(projection));
+    pixelX = x;
+    pixelY = y;
+  }
+
+  // firstTriangle numbers the draw's first triangle within the object.
+  void draw(unsigned int vao, const glm::mat4 &model, int object,
+            int firstTriangle, unsigned int indexType, unsigned int firstIndex,
+            int indexCount, int baseVertex = 0) {
+    glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(model));
+    glUniform1ui(objectLocation, (GLuint)object);
+    glUniform1ui(firstTriangleLocation, (GLuint)firstTriangle);
+    glBindVertexArray(vao);
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES, indexCount, indexType,
+        (void *)(uintptr_t)(firstIndex * indexTypeSize(indexType)),
+        baseVertex);
+  }
+
+  // Queues the readback and puts the default framebuffer back.
+  void end() {
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(pixelX, pixelY, 1, 1, GL_RG_INTEGER, GL_UNSIGNED_INT,
+                 nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glUseProgram(previousProgram);
+  }
+
+  // True once the pending pick has been read back; never waits.
+  bool poll(PickHit &hit) {
+    if (!fence || glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) ==
+                      GL_TIMEOUT_EXPIRED)
+      return false;
+    glDeleteSync(fence);
+    fence = nullptr;
+    uint32_t id[2] = {0, 0};
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(id), id);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    hit = PickHit();
+    if (id[0]) {
+      hit.object = (int)id[0] - 1;
+      hit.triangle = (int)id[1];
+    }
+    return true;
+  }
+
+  void destroy() {
+    if (fence)
+      glDeleteSync(fence);
+    if (program)
+      glDeleteProgram(program);
+    glDeleteFramebuffers(1, &framebuffer);
+    unsigned int renderbuffers[] = {idBuffer, depthBuffer};
+    glDeleteRenderbuffers(2, renderbuffers);
+    glDeleteBuffers(1, &pbo);
+    fence = nullptr;
+    program = framebuffer = idBuffer = depthBuffer = pbo = 0;
+    width = height = 0;
+  }
+};
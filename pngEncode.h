@@ -0,0 +1,333 @@
+#pragma once
+// Small PNG encoder for frame dumps. Rows are filtered (None/Sub/Up, whichever
+// gives the smallest sum) and deflated with fixed Huffman codes and a greedy
+// single-probe LZ77. The image is cut into bands of rows that are compressed
+// independently on a worker pool; every band but the last ends on a byte
+// boundary with an empty stored block, so the pieces concatenate into one
+// valid zlib stream and their Adler-32 sums are combined.
+#include "workerPool.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+const int PNG_BAND_ROWS = 32;
+const int DEFLATE_WINDOW = 32768;
+const int DEFLATE_HASH_BITS = 15;
+const int DEFLATE_MAX_MATCH = 258;
+
+struct DeflateTables {
+  uint16_t litCode[288]; // fixed Huffman codes, bit-reversed for LSB-first
+  uint8_t litBits[288];
+  uint8_t distCode[30];
+  uint8_t lengthSymbol[DEFLATE_MAX_MATCH + 1]; // match length -> code - 257
+  uint8_t distSymbol[512];                     // see distanceSymbol()
+  uint16_t lengthBase[29], distBase[30];
+  uint8_t lengthExtra[29], distExtra[30];
+  uint32_t crc[256];
+
+  DeflateTables() {
+    auto reverse = [](unsigned code, int bits) {
+      unsigned r = 0;
+      for (int i = 0; i < bits; i++, code >>= 1)
+        r = (r << 1) | (code & 1);
+      return (uint16_t)r;
+    };
+    for (int v = 0; v < 288; v++) {
+      unsigned code;
+      int bits;
+      if (v < 144)
+        code = 0x30 + v, bits = 8;
+      else if (v < 256)
+        code = 0x190 + v - 144, bits = 9;
+      else if (v < 280)
+        code = v - 256, bits = 7;
+      else
+        code = 0xc0 + v - 280, bits = 8;
+      litCode[v] = reverse(code, bits);
+      litBits[v] = (uint8_t)bits;
+    }
+    for (int d = 0; d < 30; d++)
+      distCode[d] = (uint8_t)reverse(d, 5);
+
+    int length = 3;
+    for (int s = 0; s < 28; s++) {
+      lengthExtra[s] = (uint8_t)(s < 8 ? 0 : (s - 4) / 4);
+      lengthBase[s] = (uint16_t)length;
+      for (int i = 0; i < (1 << lengthExtra[s]); i++)
+        lengthSymbol[length++] = (uint8_t)s;
+    }
+    lengthExtra[28] = 0;
+    lengthBase[28] = 258;
+    lengthSymbol[258] = 28;
+
+    int dist = 1;
+    for (int s = 0; s < 30; s++) {
+      distExtra[s] = (uint8_t)(s < 4 ? 0 : (s - 2) / 2);
+      distBase[s] = (uint16_t)dist;
+      for (int i = 0; i < (1 << distExtra[s]); i++, dist++)
+        distSymbol[dist <= 256 ? dist - 1 : 256 + ((dist - 1) >> 7)] =
+            (uint8_t)s;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      crc[n] = c;
+    }
+  }
+
+  int distanceSymbol(int dist) const {
+    return dist <= 256 ? distSymbol[dist - 1]
+                       : distSymbol[256 + ((dist - 1) >> 7)];
+  }
+};
+
+inline const DeflateTables &deflateTables() {
+  static const DeflateTables tables;
+  return tables;
+}
+
+inline uint32_t crc32Update(uint32_t crc, const unsigned char *data,
+                            size_t size) {
+  const DeflateTables &t = deflateTables();
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++)
+    crc = t.crc[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+inline uint32_t adler32(const unsigned char *data, size_t size) {
+  const uint32_t mod = 65521;
+  uint32_t a = 1, b = 0;
+  while (size) {
+    size_t n = std::min<size_t>(size, 5552); // largest run without overflow
+    size -= n;
+    while (n--) {
+      a += *data++;
+      b += a;
+    }
+    a %= mod;
+    b %= mod;
+  }
+  return (b << 16) | a;
+}
+
+// Adler-32 of A followed by B, from adler(A), adler(B) and B's length.
+inline uint32_t adler32Combine(uint32_t a1, uint32_t a2, size_t length2) {
+  const uint32_t mod = 65521;
+  uint32_t rem = (uint32_t)(length2 % mod);
+  uint32_t sum1 = a1 & 0xffff;
+  uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % mod);
+  sum1 += (a2 & 0xffff) + mod - 1;
+  sum2 += (a1 >> 16) + (a2 >> 16) + mod - rem;
+  if (sum1 >= mod)
+    sum1 -= mod;
+  if (sum1 >= mod)
+    sum1 -= mod;
+  if (sum2 >= 2 * mod)
+    sum2 -= 2 * mod;
+  if (sum2 >= mod)
+    sum2 -= mod;
+  return sum1 | (sum2 << 16);
+}
+
+struct BitWriter {
+  std::vector<unsigned char> &out;
+  uint64_t bits = 0;
+  int count = 0;
+
+  void put(uint32_t value, int n) {
+    bits |= (uint64_t)value << count;
+    count += n;
+    while (count >= 8) {
+      out.push_back((unsigned char)bits);
+      bits >>= 8;
+      count -= 8;
+    }
+  }
+  void align() {
+    if (count)
+      put(0, 8 - count);
+  }
+};
+
+// One fixed-Huffman block over data. Matches never reach before data, so
+// bands compress independently. head is scratch for the hash table.
+inline void deflateBand(const unsigned char *data, size_t size, bool last,
+                        std::vector<unsigned char> &out,
+                        std::vector<int> &head) {
+  const DeflateTables &t = deflateTables();
+  out.clear();
+  BitWriter bw{out};
+  bw.put(last ? 1 : 0, 1);
+  bw.put(1, 2); // fixed Huffman
+  head.assign((size_t)1 << DEFLATE_HASH_BITS, -1);
+  auto hash = [&](size_t i) {
+    uint32_t v = data[i] | data[i + 1] << 8 | data[i + 2] << 16;
+    return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+  };
+  size_t i = 0;
+  while (i < size) {
+    size_t length = 0, dist = 0;
+    if (i + 3 <= size) {
+      uint32_t h = hash(i);
+      int candidate = head[h];
+      head[h] = (int)i;
+      if (candidate >= 0 && i - candidate <= (size_t)DEFLATE_WINDOW) {
+        size_t limit = std::min<size_t>(DEFLATE_MAX_MATCH, size - i);
+        const unsigned char *a = data + candidate, *b = data + i;
+        while (length < limit && a[length] == b[length])
+          length++;
+        dist = i - candidate;
+      }
+    }
+    if (length >= 3) {
+      int ls = t.lengthSymbol[length];
+      bw.put(t.litCode[257 + ls], t.litBits[257 + ls]);
+      bw.put((uint32_t)(length - t.lengthBase[ls]), t.lengthExtra[ls]);
+      int ds = t.distanceSymbol((int)dist);
+      bw.put(t.distCode[ds], 5);
+      bw.put((uint32_t)(dist - t.distBase[ds]), t.distExtra[ds]);
+      for (size_t j = i + 1; j < i + length && j + 3 <= size; j++)
+        head[hash(j)] = (int)j;
+      i += length;
+    } else {
+      bw.put(t.litCode[data[i]], t.litBits[data[i]]);
+      i++;
+    }
+  }
+  bw.put(t.litCode[256], t.litBits[256]); // end of block
+  if (!last) {
+    bw.put(0, 3); // empty stored block to reach a byte boundary
+    bw.align();
+    const unsigned char stored[4] = {0, 0, 0xff, 0xff};
+    out.insert(out.end(), stored, stored + 4);
+  } else {
+    bw.align();
+  }
+}
+
+struct PngEncoder {
+  WorkerPool *pool;
+  std::vector<std::vector<unsigned char>> filtered, compressed; // per band
+  std::vector<uint32_t> adlers;
+  std::vector<std::vector<int>> heads; // per worker
+
+  explicit PngEncoder(WorkerPool *workers) : pool(workers) {}
+
+  // rows points at the top row, pitch may be negative (bottom-up sources);
+  // channels is 3 or 4, alpha is dropped. Writes an 8-bit RGB PNG to png.
+  void encode(const unsigned char *rows, ptrdiff_t pitch, int channels,
+              int width, int height, std::vector<unsigned char> &png) {
+    int bands = (height + PNG_BAND_ROWS - 1) / PNG_BAND_ROWS;
+    filtered.resize(bands);
+    compressed.resize(bands);
+    adlers.resize(bands);
+    heads.resize(pool->workerCount());
+    size_t rowBytes = (size_t)width * 3;
+    pool->parallelFor(bands, [&](int band, int worker) {
+      int y0 = band * PNG_BAND_ROWS;
+      int y1 = std::min(height, y0 + PNG_BAND_ROWS);
+      std::vector<unsigned char> &out = filtered[band];
+      out.resize((y1 - y0) * (rowBytes + 1));
+      std::vector<unsigned char> current(rowBytes), previous(rowBytes);
+      auto load = [&](int y, std::vector<unsigned char> &dst) {
+        const unsigned char *src = rows + (ptrdiff_t)y * pitch;
+        for (int x = 0; x < width; x++)
+          memcpy(&dst[x * 3], src + x * channels, 3);
+      };
+      if (y0 > 0)
+        load(y0 - 1, previous);
+      else
+        std::fill(previous.begin(), previous.end(), 0);
+      for (int y = y0; y < y1; y++) {
+        load(y, current);
+        unsigned char *row = &out[(y - y0) * (rowBytes + 1)];
+        filterRow(current.data(), previous.data(), rowBytes, row);
+        current.swap(previous);
+      }
+      adlers[band] = adler32(out.data(), out.size());
+      deflateBand(out.data(), out.size(), band == bands - 1, compressed[band],
+                  heads[worker]);
+    });
+
+    png.clear();
+    static const unsigned char signature[8] = {0x89, 'P',  'N',  'G',
+                                               '\r', '\n', 0x1a, '\n'};
+    png.insert(png.end(), signature, signature + 8);
+    unsigned char ihdr[13] = {};
+    storeBE32(ihdr, (uint32_t)width);
+    storeBE32(ihdr + 4, (uint32_t)height);
+    ihdr[8] = 8; // bit depth
+    ihdr[9] = 2; // truecolour
+    chunk(png, "IHDR", ihdr, 13);
+
+    size_t idatSize = 2 + 4;
+    for (const std::vector<unsigned char> &c : compressed)
+      idatSize += c.size();
+    size_t start = png.size();
+    png.resize(start + 8);
+    storeBE32(&png[start], (uint32_t)idatSize);
+    memcpy(&png[start + 4], "IDAT", 4);
+    png.push_back(0x78); // zlib header: deflate, 32K window, no dictionary
+    png.push_back(0x01);
+    uint32_t adler = adlers[0];
+    for (int b = 0; b < bands; b++) {
+      png.insert(png.end(), compressed[b].begin(), compressed[b].end());
+      if (b > 0)
+        adler = adler32Combine(adler, adlers[b], filtered[b].size());
+    }
+    unsigned char trailer[4];
+    storeBE32(trailer, adler);
+    png.insert(png.end(), trailer, trailer + 4);
+    unsigned char crc[4];
+    storeBE32(crc, crc32Update(0, &png[start + 4], idatSize + 4));
+    png.insert(png.end(), crc, crc + 4);
+    chunk(png, "IEND", nullptr, 0);
+  }
+
+  static void filterRow(const unsigned char *row, const unsigned char *above,
+                        size_t size, unsigned char *out) {
+    long cost[3] = {};
+    for (size_t i = 0; i < size; i++) {
+      unsigned char left = i >= 3 ? row[i - 3] : 0;
+      cost[0] += std::abs((signed char)row[i]);
+      cost[1] += std::abs((signed char)(row[i] - left));
+      cost[2] += std::abs((signed char)(row[i] - above[i]));
+    }
+    int type = 0;
+    for (int f = 1; f < 3; f++)
+      if (cost[f] < cost[type])
+        type = f;
+    out[0] = (unsigned char)type;
+    for (size_t i = 0; i < size; i++) {
+      unsigned char left = i >= 3 ? row[i - 3] : 0;
+      out[1 + i] = type == 0   ? row[i]
+                   : type == 1 ? (unsigned char)(row[i] - left)
+                               : (unsigned char)(row[i] - above[i]);
+    }
+  }
+
+  static void storeBE32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+  }
+
+  static void chunk(std::vector<unsigned char> &png, const char *type,
+                    const unsigned char *data, uint32_t size) {
+    size_t start = png.size();
+    png.resize(start + 8 + size + 4);
+    storeBE32(&png[start], size);
+    memcpy(&png[start + 4], type, 4);
+    if (size)
+      memcpy(&png[start + 8], data, size);
+    storeBE32(&png[start + 8 + size],
+              crc32Update(0, &png[start + 4], size + 4));
+  }
+};
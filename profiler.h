@@ -0,0 +1,267 @@
+#pragma once
+// CPU/GPU timeline capture. Scoped zones, counters and frame markers are
+// appended to per-thread chunked buffers (one writer each, published with
+// release stores, so recording takes no locks) and written as Chrome trace
+// JSON by stopProfiler(); open it in chrome://tracing or ui.perfetto.dev.
+// GPU scopes from gpuTimers land on their own "GPU" track, shifted onto the
+// CPU clock by sampling GL_TIMESTAMP.
+#include "glad/glad.h"
+#include "perfHud.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+
+const int PROFILE_CHUNK_EVENTS = 4096;
+const long PROFILE_MAX_EVENTS = 1 << 22; // further events are dropped
+const int PROFILE_GPU_RESYNC = 256;      // GPU frames between clock samples
+
+enum ProfileKind : uint8_t {
+  PROFILE_KIND_ZONE,
+  PROFILE_KIND_COUNTER,
+  PROFILE_KIND_FRAME
+};
+
+struct ProfileEvent {
+  const char *name; // must outlive the capture (string literals)
+  uint64_t start;   // ns since startProfiler
+  union {
+    uint64_t duration; // zones
+    double value;      // counters
+  };
+  ProfileKind kind;
+};
+
+struct ProfileChunk {
+  ProfileEvent events[PROFILE_CHUNK_EVENTS];
+  std::atomic<uint32_t> count{0};
+  std::atomic<ProfileChunk *> next{nullptr};
+};
+
+struct ProfileThread {
+  uint32_t id = 0;
+  std::atomic<const char *> name{nullptr};
+  ProfileChunk *head = nullptr, *tail = nullptr; // never empty once used
+  ProfileThread *next = nullptr;
+
+  void push(const ProfileEvent &event);
+};
+
+struct Profiler {
+  std::atomic<bool> enabled{false};
+  FILE *file = nullptr;
+  std::chrono::steady_clock::time_point origin;
+  std::mutex registryMutex; // taken once per thread, on its first event
+  ProfileThread *threads = nullptr;
+  uint32_t nextId = 1;
+  std::atomic<long> events{0}, dropped{0};
+  ProfileThread gpu; // written only by the GL thread
+  int64_t gpuOffset = 0; // CPU ns minus GPU ns
+  int gpuFrames = 0;
+
+  uint64_t now() const {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - origin)
+        .count();
+  }
+};
+
+inline Profiler profiler;
+inline thread_local ProfileThread *profileThread = nullptr;
+
+inline void ProfileThread::push(const ProfileEvent &event) {
+  if (profiler.events.fetch_add(1, std::memory_order_relaxed) >=
+      PROFILE_MAX_EVENTS) {
+    profiler.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  uint32_t n = tail->count.load(std::memory_order_relaxed);
+  if (n == PROFILE_CHUNK_EVENTS) {
+    ProfileChunk *chunk = new ProfileChunk;
+    tail->next.store(chunk, std::memory_order_release);
+    tail = chunk;
+    n = 0;
+  }
+  tail->events[n] = event;
+  tail->count.store(n + 1, std::memory_order_release);
+}
+
+inline ProfileThread *currentProfileThread() {
+  if (!profileThread) {
+    ProfileThread *t = new ProfileThread;
+    std::lock_guard<std::mutex> lock(profiler.registryMutex);
+    t->id = profiler.nextId++;
+    t->next = profiler.threads;
+    t->head = t->tail = new ProfileChunk;
+    profiler.threads = t;
+    profileThread = t;
+  }
+  return profileThread;
+}
+
+inline bool profilerEnabled() {
+  return profiler.enabled.load(std::memory_order_relaxed);
+}
+
+// Names the calling thread's track; the pointer is kept, so pass a literal.
+inline void profileThreadName(const char *name) {
+  if (profilerEnabled())
+    currentProfileThread()->name.store(name, std::memory_order_relaxed);
+}
+
+inline void profileCounter(const char *name, double value) {
+  if (!profilerEnabled())
+    return;
+  ProfileEvent e{name, profiler.now(), {}, PROFILE_KIND_COUNTER};
+  e.value = value;
+  currentProfileThread()->push(e);
+}
+
+inline void profileFrameMark() {
+  if (profilerEnabled())
+    currentProfileThread()->push(
+        {"frame", profiler.now(), {}, PROFILE_KIND_FRAME});
+}
+
+struct ProfileZone {
+  const char *name;
+  uint64_t start;
+  explicit ProfileZone(const char *zoneName)
+      : name(profilerEnabled() ? zoneName : nullptr),
+        start(name ? profiler.now() : 0) {}
+  ~ProfileZone() {
+    if (!name || !profilerEnabled())
+      return;
+    ProfileEvent e{name, start, {}, PROFILE_KIND_ZONE};
+    e.duration = profiler.now() - start;
+    currentProfileThread()->push(e);
+  }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name)                                                     \
+  ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+
+inline bool startProfiler(const char *path) {
+  profiler.file = fopen(path, "wb");
+  if (!profiler.file) {
+    fprintf(stderr, "Failed to open profile output %s\n", path);
+    return false;
+  }
+  profiler.origin = std::chrono::steady_clock::now();
+  profiler.gpu.id = 0xffff;
+  profiler.gpu.name = "GPU";
+  profiler.gpu.head = profiler.gpu.tail = new ProfileChunk;
+  profiler.enabled = true;
+  return true;
+}
+
+// Samples both clocks back to back; the midpoint of the CPU reads is matched
+// with the GPU timestamp.
+inline void syncProfilerGpuClock() {
+  uint64_t before = profiler.now();
+  GLint64 gpuNow = 0;
+  glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+  uint64_t after = profiler.now();
+  profiler.gpuOffset = (int64_t)((before + after) / 2) - gpuNow;
+}
+
+inline void profileGpuResults(const GpuTimers &timers) {
+  if (!profilerEnabled())
+    return;
+  if (++profiler.gpuFrames % PROFILE_GPU_RESYNC == 0)
+    syncProfilerGpuClock();
+  for (int i = 0; i < timers.resultCount; i++) {
+    ProfileEvent e{timers.names[i],
+                   (uint64_t)((int64_t)timers.begins[i] + profiler.gpuOffset),
+                   {},
+                   PROFILE_KIND_ZONE};
+    e.duration = timers.ends[i] - timers.begins[i];
+    profiler.gpu.push(e);
+  }
+}
+
+// Call on the GL thread once the context is current. Needs
+// gpuTimers.nextFrame() once per frame.
+inline void startProfilerGpu() {
+  if (!profilerEnabled())
+    return;
+  if (!gpuTimers.enabled)
+    gpuTimers.init();
+  syncProfilerGpuClock();
+  gpuTimers.collected = profileGpuResults;
+}
+
+inline void writeProfileEvent(FILE *f, uint32_t tid, const ProfileEvent &e,
+                              bool &first) {
+  fputs(first ? "\n" : ",\n", f);
+  first = false;
+  double ts = e.start / 1000.0;
+  if (e.kind == PROFILE_KIND_ZONE)
+    fprintf(f,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+            "\"pid\":1,\"tid\":%u}",
+            e.name, ts, e.duration / 1000.0, tid);
+  else if (e.kind == PROFILE_KIND_COUNTER)
+    fprintf(f,
+            "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,"
+            "\"args\":{\"value\":%g}}",
+            e.name, ts, e.value);
+  else
+    fprintf(f,
+            "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,"
+            "\"pid\":1,\"tid\":%u}",
+            e.name, ts, tid);
+}
+
+// Writes the capture. Threads that are still running may keep recording
+// into their buffers; events published before this call are all written.
+inline void stopProfiler() {
+  if (!profilerEnabled())
+    return;
+  profiler.enabled = false;
+  gpuTimers.collected = nullptr;
+  FILE *f = profiler.file;
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+  bool first = true;
+  long written = 0;
+  ProfileThread *list;
+  {
+    std::lock_guard<std::mutex> lock(profiler.registryMutex);
+    list = profiler.threads;
+  }
+  auto writeThread = [&](ProfileThread *t) {
+    const char *name = t->name.load(std::memory_order_relaxed);
+    fputs(first ? "\n" : ",\n", f);
+    first = false;
+    if (name)
+      fprintf(f,
+              "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+              "\"args\":{\"name\":\"%s\"}}",
+              t->id, name);
+    else
+      fprintf(f,
+              "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+              "\"args\":{\"name\":\"thread %u\"}}",
+              t->id, t->id);
+    for (ProfileChunk *c = t->head; c;
+         c = c->next.load(std::memory_order_acquire)) {
+      uint32_t n = c->count.load(std::memory_order_acquire);
+      for (uint32_t i = 0; i < n; i++)
+        writeProfileEvent(f, t->id, c->events[i], first);
+      written += n;
+    }
+  };
+  for (ProfileThread *t = list; t; t = t->next)
+    writeThread(t);
+  writeThread(&profiler.gpu);
+  fputs("\n]}\n", f);
+  fclose(f);
+  profiler.file = nullptr;
+  fprintf(stderr, "Profile: %ld events written", written);
+  if (profiler.dropped)
+    fprintf(stderr, ", %ld dropped", profiler.dropped.load());
+  fputc('\n', stderr);
+}
@@ -0,0 +1,129 @@
+#pragma once
+// Dedicated render thread. It owns the GL context and executes frame N while
+// the main thread (events, input, simulation, matrix math) fills frame N+1
+// into the other half of a double-buffered command list.
+#include "commandBuffer.h"
+#include "profiler.h"
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct DrawCommand {
+  unsigned int vao;
+  int indexCount;
+  glm::mat4 model;
+  unsigned int indexType = GL_UNSIGNED_INT;
+  unsigned int firstIndex = 0;
+  int baseVertex = 0;
+  int indirectFirst = -1; // >= 0: draws indirect[first, first + count)
+  int indirectCount = 0;
+  int cullFirst = -1; // >= 0: --gpu-cull tests meshlets [first, first + count)
+  int cullCount = 0;
+};
+
+// --gpu-pick: a draw of the ID pass, with the object's scene index and the
+// number of its first triangle within the object.
+struct PickDraw {
+  DrawCommand draw;
+  int object, firstTriangle;
+};
+
+enum CaptureFlags { CAPTURE_SCREENSHOT = 1, CAPTURE_RECORD = 2 };
+
+struct FrameCommands {
+  long index = 0;
+  int capture = 0; // CaptureFlags: read this frame back asynchronously
+  bool hud = false;
+  int width = 0, height = 0;
+  glm::vec4 clearColor;
+  glm::mat4 view, projection;
+  std::vector<DrawCommand> draws;
+  std::vector<DrawElementsIndirectCommand> indirect; // --meshlets ranges
+  std::vector<float> pyramid; // --gpu-cull with --occlusion: depth pyramid
+  int pickX = -1, pickY = -1; // --gpu-pick: pixel to identify, from bottom
+  std::vector<PickDraw> pickDraws;
+  // --parallel-record: per-worker buffers and their merged, sorted packets
+  std::vector<CommandBuffer> recorded;
+  std::vector<MergedPacket> merged;
+};
+
+struct RenderThread {
+  GLFWwindow *window = nullptr;
+  std::function<void(const FrameCommands &)> execute;
+  FrameCommands frames[2];
+  int writeSlot = 0;
+  int submitted = -1; // slot handed over, not yet picked up
+  int rendering = -1; // slot the render thread is executing
+  bool quit = false;
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::thread thread;
+
+  // The caller's context is released and made current on the render thread.
+  void start(GLFWwindow *w, std::function<void(const FrameCommands &)> fn) {
+    window = w;
+    execute = std::move(fn);
+    glfwMakeContextCurrent(nullptr);
+    thread = std::thread([this] { run(); });
+  }
+
+  // Slot for the next frame; blocks while the render thread still reads it.
+  FrameCommands &frame() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] {
+      return rendering != writeSlot && submitted != writeSlot;
+    });
+    return frames[writeSlot];
+  }
+
+  void submit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return submitted == -1; });
+    submitted = writeSlot;
+    writeSlot ^= 1;
+    changed.notify_all();
+  }
+
+  // Drains the pending frame and hands the context back to the caller.
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    changed.notify_all();
+    thread.join();
+    glfwMakeContextCurrent(window);
+  }
+
+  void run() {
+    glfwMakeContextCurrent(window);
+    profileThreadName("render");
+    for (;;) {
+      int slot;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return submitted != -1 || quit; });
+        if (submitted == -1)
+          break;
+        slot = rendering = submitted;
+        submitted = -1;
+      }
+      changed.notify_all();
+      execute(frames[slot]);
+      {
+        PROFILE_ZONE("swap");
+        glfwSwapBuffers(window);
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        rendering = -1;
+      }
+      changed.notify_all();
+    }
+    glfwMakeContextCurrent(nullptr);
+  }
+};
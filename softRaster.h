@@ -0,0 +1,361 @@
+#pragma once
+// CPU reference rasterizer for the demos' vertex/index arrays. Triangles are
+// transformed, clipped against the near plane and binned into screen tiles;
+// tiles are then shaded in parallel with 4-wide edge functions, a depth
+// buffer and perspective-correct per-vertex color, matching what the GL path
+// draws closely enough to serve as a golden reference on machines without a
+// GPU. Row 0 is the bottom row, like glReadPixels.
+#include "workerPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const int SOFT_TILE_SIZE = 64;
+const int SOFT_BIN_CHUNK = 1024; // triangles per binning job
+
+struct SoftVertexLayout {
+  int stride;       // floats per vertex
+  int positionSize; // 2 or 3 floats at offset 0
+  int colorOffset;  // offset of the rgb color, in floats
+};
+
+struct SoftFramebuffer {
+  int width = 0, height = 0;
+  int pitch = 0; // width rounded up to a multiple of 4
+  std::vector<uint32_t> color; // RGBA8, little-endian r in the low byte
+  std::vector<float> depth;
+
+  void resize(int w, int h) {
+    width = w;
+    height = h;
+    pitch = (w + 3) & ~3;
+    color.assign((size_t)pitch * h, 0);
+    depth.assign((size_t)pitch * h, 1.0f);
+  }
+
+  void clear(float r, float g, float b, float a) {
+    std::fill(color.begin(), color.end(), packColor(r, g, b, a));
+    std::fill(depth.begin(), depth.end(), 1.0f);
+  }
+
+  static uint32_t packColor(float r, float g, float b, float a) {
+    auto c = [](float v) {
+      return (uint32_t)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f);
+    };
+    return c(r) | c(g) << 8 | c(b) << 16 | c(a) << 24;
+  }
+
+  // Tightly packed top-down RGB, the layout image files use.
+  void readRGB(std::vector<unsigned char> &out) const {
+    out.resize((size_t)width * height * 3);
+    for (int y = 0; y < height; y++) {
+      const uint32_t *row = &color[(size_t)(height - 1 - y) * pitch];
+      unsigned char *dst = &out[(size_t)y * width * 3];
+      for (int x = 0; x < width; x++) {
+        dst[x * 3 + 0] = row[x] & 0xff;
+        dst[x * 3 + 1] = row[x] >> 8 & 0xff;
+        dst[x * 3 + 2] = row[x] >> 16 & 0xff;
+      }
+    }
+  }
+
+  bool writePPM(const char *path) const {
+    FILE *f = fopen(path, "wb");
+    if (!f)
+      return false;
+    std::vector<unsigned char> rgb;
+    readRGB(rgb);
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    fwrite(rgb.data(), 1, rgb.size(), f);
+    fclose(f);
+    return true;
+  }
+};
+
+struct SoftClipVertex {
+  float x, y, z, w;
+  float r, g, b;
+};
+
+// Screen-space triangle, wound so that its signed area is positive.
+struct SoftTriangle {
+  float x[3], y[3], z[3]; // window coordinates, z in [0, 1]
+  float invW[3];
+  float r[3], g[3], b[3]; // color divided by w
+  float area;
+  int minX, minY, maxX, maxY; // inclusive pixel bounds
+};
+
+struct SoftRasterizer {
+  WorkerPool *pool;
+  SoftFramebuffer framebuffer;
+  bool depthTest = true;
+  std::vector<SoftTriangle> triangles;
+  std::vector<SoftClipVertex> clipVertices;
+  std::vector<std::vector<uint32_t>> bins; // [chunk * tileCount + tile]
+  int tilesX = 0, tilesY = 0;
+
+  explicit SoftRasterizer(WorkerPool *workers) : pool(workers) {}
+
+  void resize(int w, int h) {
+    framebuffer.resize(w, h);
+    tilesX = (w + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    tilesY = (h + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+  }
+
+  // Transforms and clips one draw; shading happens in render(). mvp is a
+  // column-major 4x4 matrix; indices may be null for non-indexed draws.
+  void draw(const float *vertices, int vertexCount, SoftVertexLayout layout,
+            const unsigned int *indices, int indexCount, const float *mvp) {
+    clipVertices.resize(vertexCount);
+    pool->parallelFor((vertexCount + 4095) / 4096, [&](int chunk, int) {
+      int end = std::min(vertexCount, (chunk + 1) * 4096);
+      for (int i = chunk * 4096; i < end; i++) {
+        const float *v = vertices + (size_t)i * layout.stride;
+        float px = v[0], py = v[1], pz = layout.positionSize > 2 ? v[2] : 0;
+        SoftClipVertex &o = clipVertices[i];
+        o.x = mvp[0] * px + mvp[4] * py + mvp[8] * pz + mvp[12];
+        o.y = mvp[1] * px + mvp[5] * py + mvp[9] * pz + mvp[13];
+        o.z = mvp[2] * px + mvp[6] * py + mvp[10] * pz + mvp[14];
+        o.w = mvp[3] * px + mvp[7] * py + mvp[11] * pz + mvp[15];
+        o.r = v[layout.colorOffset];
+        o.g = v[layout.colorOffset + 1];
+        o.b = v[layout.colorOffset + 2];
+      }
+    });
+    int count = indices ? indexCount : vertexCount;
+    for (int i = 0; i + 2 < count; i += 3) {
+      unsigned int a = indices ? indices[i] : i;
+      unsigned int b = indices ? indices[i + 1] : i + 1;
+      unsigned int c = indices ? indices[i + 2] : i + 2;
+      clipAndSetup(clipVertices[a], clipVertices[b], clipVertices[c]);
+    }
+  }
+
+  // Sutherland-Hodgman against the near plane (z >= -w), then fan.
+  void clipAndSetup(const SoftClipVertex &a, const SoftClipVertex &b,
+                    const SoftClipVertex &c) {
+    const SoftClipVertex in[3] = {a, b, c};
+    SoftClipVertex out[4];
+    int n = 0;
+    for (int i = 0; i < 3; i++) {
+      const SoftClipVertex &p = in[i], &q = in[(i + 1) % 3];
+      float dp = p.z + p.w, dq = q.z + q.w;
+      if (dp >= 0)
+        out[n++] = p;
+      if ((dp >= 0) != (dq >= 0)) {
+        float t = dp / (dp - dq);
+        SoftClipVertex m;
+        m.x = p.x + (q.x - p.x) * t;
+        m.y = p.y + (q.y - p.y) * t;
+        m.z = p.z + (q.z - p.z) * t;
+        m.w = p.w + (q.w - p.w) * t;
+        m.r = p.r + (q.r - p.r) * t;
+        m.g = p.g + (q.g - p.g) * t;
+        m.b = p.b + (q.b - p.b) * t;
+        out[n++] = m;
+      }
+    }
+    for (int i = 1; i + 1 < n; i++)
+      setup(out[0], out[i], out[i + 1]);
+  }
+
+  void setup(const SoftClipVertex &v0, const SoftClipVertex &v1,
+             const SoftClipVertex &v2) {
+    const SoftClipVertex *v[3] = {&v0, &v1, &v2};
+    SoftTriangle t;
+    for (int i = 0; i < 3; i++) {
+      float invW = 1.0f / v[i]->w;
+      t.x[i] = (v[i]->x * invW * 0.5f + 0.5f) * framebuffer.width;
+      t.y[i] = (v[i]->y * invW * 0.5f + 0.5f) * framebuffer.height;
+      t.z[i] = v[i]->z * invW * 0.5f + 0.5f;
+      t.invW[i] = invW;
+      t.r[i] = v[i]->r * invW;
+      t.g[i] = v[i]->g * invW;
+      t.b[i] = v[i]->b * invW;
+    }
+    t.area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) -
+             (t.y[1] - t.y[0]) * (t.x[2] - t.x[0]);
+    if (t.area == 0 || !std::isfinite(t.area))
+      return;
+    if (t.area < 0) { // no face culling in the demos: flip to CCW
+      std::swap(t.x[1], t.x[2]);
+      std::swap(t.y[1], t.y[2]);
+      std::swap(t.z[1], t.z[2]);
+      std::swap(t.invW[1], t.invW[2]);
+      std::swap(t.r[1], t.r[2]);
+      std::swap(t.g[1], t.g[2]);
+      std::swap(t.b[1], t.b[2]);
+      t.area = -t.area;
+    }
+    float minX = std::min({t.x[0], t.x[1], t.x[2]});
+    float maxX = std::max({t.x[0], t.x[1], t.x[2]});
+    float minY = std::min({t.y[0], t.y[1], t.y[2]});
+    float maxY = std::max({t.y[0], t.y[1], t.y[2]});
+    float w = (float)framebuffer.width, h = (float)framebuffer.height;
+    t.minX = (int)std::floor(std::max(minX, 0.0f));
+    t.minY = (int)std::floor(std::max(minY, 0.0f));
+    t.maxX = (int)std::ceil(std::min(maxX, w - 1));
+    t.maxY = (int)std::ceil(std::min(maxY, h - 1));
+    if (t.minX > t.maxX || t.minY > t.maxY)
+      return;
+    triangles.push_back(t);
+  }
+
+  // Bins all triangles submitted since the last render and shades the tiles.
+  void render() {
+    int tileCount = tilesX * tilesY;
+    int chunks = ((int)triangles.size() + SOFT_BIN_CHUNK - 1) / SOFT_BIN_CHUNK;
+    if (bins.size() < (size_t)chunks * tileCount)
+      bins.resize((size_t)chunks * tileCount);
+    pool->parallelFor(chunks, [&](int chunk, int) {
+      std::vector<uint32_t> *chunkBins = &bins[(size_t)chunk * tileCount];
+      for (int i = 0; i < tileCount; i++)
+        chunkBins[i].clear();
+      int end = std::min((int)triangles.size(), (chunk + 1) * SOFT_BIN_CHUNK);
+      for (int i = chunk * SOFT_BIN_CHUNK; i < end; i++) {
+        const SoftTriangle &t = triangles[i];
+        for (int ty = t.minY / SOFT_TILE_SIZE; ty <= t.maxY / SOFT_TILE_SIZE;
+             ty++)
+          for (int tx = t.minX / SOFT_TILE_SIZE;
+               tx <= t.maxX / SOFT_TILE_SIZE; tx++)
+            chunkBins[ty * tilesX + tx].push_back(i);
+      }
+    });
+    // Chunks are visited in submission order so equal-depth ties and
+    // depth-test-off draws resolve like the GL path.
+    pool->parallelFor(tileCount, [&](int tile, int) {
+      int x0 = tile % tilesX * SOFT_TILE_SIZE;
+      int y0 = tile / tilesX * SOFT_TILE_SIZE;
+      int x1 = std::min(x0 + SOFT_TILE_SIZE, framebuffer.width) - 1;
+      int y1 = std::min(y0 + SOFT_TILE_SIZE, framebuffer.height) - 1;
+      for (int chunk = 0; chunk < chunks; chunk++)
+        for (uint32_t i : bins[(size_t)chunk * tileCount + tile])
+          shade(triangles[i], std::max(x0, triangles[i].minX),
+                std::max(y0, triangles[i].minY),
+                std::min(x1, triangles[i].maxX),
+                std::min(y1, triangles[i].maxY));
+    });
+    triangles.clear();
+  }
+
+  // Edge a->b owns its pixels-on-the-line if it is a left or bottom edge.
+  static bool ownsEdge(float ax, float ay, float bx, float by) {
+    return by > ay || (by == ay && bx < ax);
+  }
+
+  void shade(const SoftTriangle &t, int x0, int y0, int x1, int y1) {
+    // edge i is opposite vertex i: E_i(p) = cross(v[i+2] - v[i+1], p - v[i+1])
+    float A[3], B[3], C[3];
+    bool owns[3];
+    for (int i = 0; i < 3; i++) {
+      int j = (i + 1) % 3, k = (i + 2) % 3;
+      A[i] = t.y[j] - t.y[k];
+      B[i] = t.x[k] - t.x[j];
+      C[i] = -(A[i] * t.x[j] + B[i] * t.y[j]);
+      owns[i] = ownsEdge(t.x[j], t.y[j], t.x[k], t.y[k]);
+    }
+    float invArea = 1.0f / t.area;
+    x0 &= ~3; // 4-wide spans start on pitch-aligned columns
+    for (int y = y0; y <= y1; y++) {
+      float py = y + 0.5f;
+      uint32_t *colorRow = &framebuffer.color[(size_t)y * framebuffer.pitch];
+      float *depthRow = &framebuffer.depth[(size_t)y * framebuffer.pitch];
+#ifdef __SSE2__
+      const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+      __m128 e[3], step[3], own[3];
+      for (int i = 0; i < 3; i++) {
+        e[i] = _mm_add_ps(
+            _mm_mul_ps(_mm_set1_ps(A[i]),
+                       _mm_add_ps(_mm_set1_ps((float)x0), lane)),
+            _mm_set1_ps(B[i] * py + C[i]));
+        step[i] = _mm_set1_ps(A[i] * 4.0f);
+        own[i] = _mm_castsi128_ps(_mm_set1_epi32(owns[i] ? -1 : 0));
+      }
+      const __m128 zero = _mm_setzero_ps();
+      for (int x = x0; x <= x1; x += 4) {
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int i = 0; i < 3; i++) {
+          __m128 in = _mm_or_ps(_mm_cmpgt_ps(e[i], zero),
+                                _mm_and_ps(_mm_cmpeq_ps(e[i], zero), own[i]));
+          inside = _mm_and_ps(inside, in);
+        }
+        int mask = _mm_movemask_ps(inside);
+        // lanes past the span belong to the next tile (or the padding)
+        if (x1 - x < 3)
+          mask &= (1 << (x1 - x + 1)) - 1;
+        if (mask) {
+          __m128 b0 = _mm_mul_ps(e[0], _mm_set1_ps(invArea));
+          __m128 b1 = _mm_mul_ps(e[1], _mm_set1_ps(invArea));
+          __m128 b2 = _mm_mul_ps(e[2], _mm_set1_ps(invArea));
+          auto interp = [&](const float *v) {
+            return _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(b0, _mm_set1_ps(v[0])),
+                           _mm_mul_ps(b1, _mm_set1_ps(v[1]))),
+                _mm_mul_ps(b2, _mm_set1_ps(v[2])));
+          };
+          __m128 z = interp(t.z);
+          __m128 one = _mm_set1_ps(1.0f);
+          __m128 pass =
+              _mm_and_ps(_mm_cmpge_ps(z, zero), _mm_cmple_ps(z, one));
+          if (depthTest)
+            pass = _mm_and_ps(pass,
+                              _mm_cmplt_ps(z, _mm_loadu_ps(depthRow + x)));
+          mask &= _mm_movemask_ps(pass);
+          if (mask) {
+            __m128 w = _mm_div_ps(one, interp(t.invW));
+            auto channel = [&](const float *v) {
+              __m128 c = _mm_min_ps(_mm_max_ps(_mm_mul_ps(interp(v), w), zero),
+                                    one);
+              return _mm_cvttps_epi32(_mm_add_ps(
+                  _mm_mul_ps(c, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+            };
+            __m128i rgba = _mm_or_si128(
+                _mm_or_si128(channel(t.r), _mm_slli_epi32(channel(t.g), 8)),
+                _mm_or_si128(_mm_slli_epi32(channel(t.b), 16),
+                             _mm_set1_epi32((int)0xff000000u)));
+            alignas(16) uint32_t colors[4];
+            alignas(16) float depths[4];
+            _mm_store_si128((__m128i *)colors, rgba);
+            _mm_store_ps(depths, z);
+            for (int l = 0; l < 4; l++)
+              if (mask & (1 << l)) {
+                colorRow[x + l] = colors[l];
+                depthRow[x + l] = depths[l];
+              }
+          }
+        }
+        for (int i = 0; i < 3; i++)
+          e[i] = _mm_add_ps(e[i], step[i]);
+      }
+#else
+      for (int x = std::max(x0, t.minX); x <= x1; x++) {
+        float px = x + 0.5f, e[3];
+        bool inside = true;
+        for (int i = 0; i < 3; i++) {
+          e[i] = A[i] * px + B[i] * py + C[i];
+          inside &= e[i] > 0 || (e[i] == 0 && owns[i]);
+        }
+        if (!inside)
+          continue;
+        float b0 = e[0] * invArea, b1 = e[1] * invArea, b2 = e[2] * invArea;
+        auto interp = [&](const float *v) {
+          return b0 * v[0] + b1 * v[1] + b2 * v[2];
+        };
+        float z = interp(t.z);
+        if (z < 0 || z > 1 || (depthTest && !(z < depthRow[x])))
+          continue;
+        float w = 1.0f / interp(t.invW);
+        colorRow[x] = SoftFramebuffer::packColor(
+            interp(t.r) * w, interp(t.g) * w, interp(t.b) * w, 1.0f);
+        depthRow[x] = z;
+      }
+#endif
+    }
+  }
+};
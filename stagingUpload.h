@@ -0,0 +1,102 @@
+#pragma once
+// Streams large client-memory ranges (usually straight out of a mapped file)
+// into GL buffers, shared by the mesh loaders.
+#include "glad/glad.h"
+#include "glTrace.h"
+#include <algorithm>
+#include <cstring>
+
+const size_t STAGING_BLOCK_SIZE = 4 << 20; // two blocks in flight
+const GLuint64 STAGING_FENCE_TIMEOUT = 1000000000; // 1 s
+
+// Copies client memory into the buffer bound to GL_COPY_WRITE_BUFFER. With
+// GL 4.4 the bytes go through a persistently mapped, coherent staging buffer
+// in two fenced blocks, so the driver never has to hold a copy of the
+// source; otherwise glBufferSubData reads the source directly. A --trace run
+// takes the glBufferSubData path too, as writes through the mapping would
+// never reach the trace.
+struct StagingUploader {
+  unsigned int staging = 0;
+  unsigned char *mapped = nullptr;
+  GLsync fences[2] = {};
+  int block = 0;
+  size_t used = 0; // within the current block
+
+  void init() {
+    if (!GLAD_GL_VERSION_4_4 || !glBufferStorage || glTraceActive())
+      return;
+    GLbitfield flags =
+        GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &staging);
+    glBindBuffer(GL_COPY_READ_BUFFER, staging);
+    glBufferStorage(GL_COPY_READ_BUFFER, STAGING_BLOCK_SIZE * 2, nullptr,
+                    flags);
+    mapped = (unsigned char *)glMapBufferRange(
+        GL_COPY_READ_BUFFER, 0, STAGING_BLOCK_SIZE * 2, flags);
+    if (!mapped) {
+      glDeleteBuffers(1, &staging);
+      staging = 0;
+    }
+  }
+
+  // Sizes the buffer bound to GL_COPY_WRITE_BUFFER. It is immutable when
+  // staging is available, since only copies ever write it.
+  void allocate(size_t size) {
+    if (mapped)
+      glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, 0);
+    else
+      glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STATIC_DRAW);
+  }
+
+  void upload(size_t dstOffset, const void *src, size_t size) {
+    if (!mapped) {
+      glBufferSubData(GL_COPY_WRITE_BUFFER, dstOffset, size, src);
+      return;
+    }
+    const unsigned char *s = (const unsigned char *)src;
+    while (size) {
+      if (used == STAGING_BLOCK_SIZE)
+        nextBlock();
+      size_t n = std::min(size, STAGING_BLOCK_SIZE - used);
+      size_t at = block * STAGING_BLOCK_SIZE + used;
+      memcpy(mapped + at, s, n);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, at,
+                          dstOffset, n);
+      used += n;
+      s += n;
+      dstOffset += n;
+      size -= n;
+    }
+  }
+
+  // Fences the block just filled and waits until the GPU has copied out of
+  // the other one before it is overwritten.
+  void nextBlock() {
+    fences[block] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    block ^= 1;
+    used = 0;
+    if (fences[block]) {
+      glClientWaitSync(fences[block], GL_SYNC_FLUSH_COMMANDS_BIT,
+                       STAGING_FENCE_TIMEOUT);
+      glDeleteSync(fences[block]);
+      fences[block] = nullptr;
+    }
+  }
+
+  // The staging buffer is deleted once the copies read from it complete;
+  // GL keeps it alive until then.
+  void destroy() {
+    for (GLsync &fence : fences)
+      if (fence) {
+        glDeleteSync(fence);
+        fence = nullptr;
+      }
+    if (!staging)
+      return;
+    glBindBuffer(GL_COPY_READ_BUFFER, staging);
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+    glDeleteBuffers(1, &staging);
+    staging = 0;
+    mapped = nullptr;
+  }
+};
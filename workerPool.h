@@ -0,0 +1,92 @@
+#pragma once
+// Persistent worker threads for data-parallel loops. The calling thread takes
+// part as worker 0, so per-worker scratch arrays need workerCount() entries.
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+struct WorkerPool {
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake, done;
+  // type-erased job, so parallelFor never allocates
+  void (*invoke)(void *, int, int) = nullptr;
+  void *context = nullptr;
+  std::atomic<int> next{0};
+  int count = 0;
+  int generation = 0;
+  int busy = 0;
+  bool quit = false;
+
+  explicit WorkerPool(int workers = -1) {
+    if (workers < 0) {
+      int hw = (int)std::thread::hardware_concurrency();
+      workers = hw > 1 ? hw - 1 : 0;
+    }
+    for (int i = 0; i < workers; i++)
+      threads.emplace_back([this, i] { run(i + 1); });
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      quit = true;
+    }
+    wake.notify_all();
+    for (std::thread &t : threads)
+      t.join();
+  }
+
+  int workerCount() const { return (int)threads.size() + 1; }
+
+  // Calls fn(index, worker) for every index in [0, n); returns when all done.
+  template <typename Fn> void parallelFor(int n, Fn &&fn) {
+    if (threads.empty() || n <= 1) {
+      for (int i = 0; i < n; i++)
+        fn(i, 0);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      invoke = [](void *ctx, int i, int worker) {
+        (*(std::remove_reference_t<Fn> *)ctx)(i, worker);
+      };
+      context = (void *)&fn;
+      count = n;
+      next.store(0, std::memory_order_relaxed);
+      busy = (int)threads.size();
+      generation++;
+    }
+    wake.notify_all();
+    drain(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+  }
+
+  void drain(int worker) {
+    for (int i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+      invoke(context, i, worker);
+  }
+
+  void run(int worker) {
+    int seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return quit || generation != seen; });
+        if (quit)
+          return;
+        seen = generation;
+      }
+      drain(worker);
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busy == 0)
+          done.notify_one();
+      }
+    }
+  }
+};